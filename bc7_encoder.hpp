@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.hpp"
+
+// BC7 encoder used by the texture cooker. Only emits mode 6 (one subset,
+// RGBA 7.7.7.7 endpoints with a unique p-bit each, 4-bit indices), which
+// handles smooth colour and alpha gradients well and is simple enough to
+// search exhaustively over the p-bits.
+namespace bc7 {
+
+inline constexpr uint32_t WEIGHTS4[16]{0,  4,  9,  13, 17, 21, 26, 30,
+                                       34, 38, 43, 47, 51, 55, 60, 64};
+
+using Block = std::array<uint8_t, 16>;
+
+namespace detail {
+
+struct Endpoints {
+  // 7 bit values per channel, before the p-bit is appended
+  uint8_t quantized[2][4];
+  uint8_t pbit[2];
+};
+
+inline uint8_t expand(uint8_t quantized, uint8_t pbit) {
+  return static_cast<uint8_t>(quantized << 1 | pbit);
+}
+
+inline uint8_t interpolate(uint32_t e0, uint32_t e1, uint32_t index) {
+  const uint32_t w = WEIGHTS4[index];
+  return static_cast<uint8_t>(((64 - w) * e0 + w * e1 + 32) >> 6);
+}
+
+inline Endpoints quantize(const float (&e0)[4],
+                          const float (&e1)[4],
+                          uint8_t p0,
+                          uint8_t p1) {
+  Endpoints result{.pbit{p0, p1}};
+  const float* ends[2]{e0, e1};
+  for (int e = 0; e < 2; ++e) {
+    for (int c = 0; c < 4; ++c) {
+      const float v = std::round((ends[e][c] - result.pbit[e]) / 2.f);
+      result.quantized[e][c] =
+          static_cast<uint8_t>(std::clamp(v, 0.f, 127.f));
+    }
+  }
+  return result;
+}
+
+// Picks the closest palette entry for each texel, returning the total
+// squared error
+inline uint32_t assignIndices(const uint8_t (&texels)[16][4],
+                              const Endpoints& ends,
+                              uint8_t (&indices)[16]) {
+  uint8_t palette[16][4];
+  for (uint32_t i = 0; i < 16; ++i) {
+    for (int c = 0; c < 4; ++c) {
+      palette[i][c] =
+          interpolate(expand(ends.quantized[0][c], ends.pbit[0]),
+                      expand(ends.quantized[1][c], ends.pbit[1]), i);
+    }
+  }
+
+  uint32_t total = 0;
+  for (int t = 0; t < 16; ++t) {
+    uint32_t best = UINT32_MAX;
+    for (uint8_t i = 0; i < 16; ++i) {
+      uint32_t error = 0;
+      for (int c = 0; c < 4; ++c) {
+        const int d = int(texels[t][c]) - int(palette[i][c]);
+        error += d * d;
+      }
+      if (error < best) {
+        best = error;
+        indices[t] = i;
+      }
+    }
+    total += best;
+  }
+  return total;
+}
+
+// Least squares fit of the endpoints to the texels given fixed indices
+inline bool refit(const uint8_t (&texels)[16][4],
+                  const uint8_t (&indices)[16],
+                  float (&e0)[4],
+                  float (&e1)[4]) {
+  float aa = 0, ab = 0, bb = 0;
+  float ax[4]{}, bx[4]{};
+  for (int t = 0; t < 16; ++t) {
+    const float w = WEIGHTS4[indices[t]] / 64.f;
+    const float a = 1.f - w;
+    aa += a * a;
+    ab += a * w;
+    bb += w * w;
+    for (int c = 0; c < 4; ++c) {
+      ax[c] += a * texels[t][c];
+      bx[c] += w * texels[t][c];
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f) {
+    return false;
+  }
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.f, 255.f);
+    e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.f, 255.f);
+  }
+  return true;
+}
+
+class BitWriter {
+ public:
+  void put(uint32_t value, uint32_t bits) {
+    for (uint32_t i = 0; i < bits; ++i, ++position) {
+      if (value >> i & 1) {
+        block[position / 8] |= static_cast<uint8_t>(1u << position % 8);
+      }
+    }
+  }
+
+  const Block& data() const { return block; }
+
+ private:
+  Block block{};
+  uint32_t position = 0;
+};
+
+inline Block pack(Endpoints ends, uint8_t (&indices)[16]) {
+  // the anchor index is stored without its top bit, so it has to be < 8
+  if (indices[0] & 8) {
+    std::swap(ends.quantized[0], ends.quantized[1]);
+    std::swap(ends.pbit[0], ends.pbit[1]);
+    for (auto& index : indices) {
+      index = 15 - index;
+    }
+  }
+
+  BitWriter writer;
+  writer.put(1u << 6, 7);  // mode 6
+  for (int c = 0; c < 4; ++c) {
+    writer.put(ends.quantized[0][c], 7);
+    writer.put(ends.quantized[1][c], 7);
+  }
+  writer.put(ends.pbit[0], 1);
+  writer.put(ends.pbit[1], 1);
+  writer.put(indices[0], 3);
+  for (int t = 1; t < 16; ++t) {
+    writer.put(indices[t], 4);
+  }
+  return writer.data();
+}
+
+}  // namespace detail
+
+// Encodes 4x4 RGBA8 texels, in row-major order
+inline Block encodeBlock(const uint8_t (&texels)[16][4]) {
+  using namespace detail;
+
+  // start from the extremes along the principal axis of the block's colours
+  float mean[4]{};
+  for (const auto& texel : texels) {
+    for (int c = 0; c < 4; ++c) {
+      mean[c] += texel[c] / 16.f;
+    }
+  }
+  float covariance[4][4]{};
+  for (const auto& texel : texels) {
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+      }
+    }
+  }
+  float axis[4]{1, 1, 1, 1};
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[4]{};
+    float length = 0;
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        next[i] += covariance[i][j] * axis[j];
+      }
+      length = std::max(length, std::abs(next[i]));
+    }
+    if (length < 1e-6f) {
+      break;
+    }
+    for (int i = 0; i < 4; ++i) {
+      axis[i] = next[i] / length;
+    }
+  }
+
+  float minT = 0, maxT = 0;
+  for (const auto& texel : texels) {
+    float t = 0;
+    for (int c = 0; c < 4; ++c) {
+      t += (texel[c] - mean[c]) * axis[c];
+    }
+    minT = std::min(minT, t);
+    maxT = std::max(maxT, t);
+  }
+  float axisLength = 0;
+  for (float a : axis) {
+    axisLength += a * a;
+  }
+  if (axisLength > 0) {
+    minT /= axisLength;
+    maxT /= axisLength;
+  }
+
+  float e0[4], e1[4];
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = std::clamp(mean[c] + minT * axis[c], 0.f, 255.f);
+    e1[c] = std::clamp(mean[c] + maxT * axis[c], 0.f, 255.f);
+  }
+
+  // try every p-bit combination, refining the endpoints once for each
+  Endpoints best{};
+  uint8_t bestIndices[16]{};
+  uint32_t bestError = UINT32_MAX;
+  for (uint8_t p = 0; p < 4 && bestError > 0; ++p) {
+    const uint8_t p0 = p & 1, p1 = p >> 1;
+    Endpoints ends = quantize(e0, e1, p0, p1);
+    uint8_t indices[16];
+    uint32_t error = assignIndices(texels, ends, indices);
+
+    float r0[4], r1[4];
+    if (error > 0 && refit(texels, indices, r0, r1)) {
+      Endpoints refined = quantize(r0, r1, p0, p1);
+      uint8_t refinedIndices[16];
+      const uint32_t refinedError =
+          assignIndices(texels, refined, refinedIndices);
+      if (refinedError < error) {
+        error = refinedError;
+        ends = refined;
+        std::copy(std::begin(refinedIndices), std::end(refinedIndices),
+                  indices);
+      }
+    }
+
+    if (error < bestError) {
+      bestError = error;
+      best = ends;
+      std::copy(std::begin(indices), std::end(indices), bestIndices);
+    }
+  }
+
+  return pack(best, bestIndices);
+}
+
+// Encodes a tightly packed RGBA8 image. Partial blocks at the edges are
+// padded by repeating the last row and column. Rows of blocks are encoded in
+// parallel on the shared job system.
+inline std::vector<std::byte> encodeImage(const uint8_t* rgba,
+                                          uint32_t width,
+                                          uint32_t height) {
+  const uint32_t blocksWide = (width + 3) / 4;
+  const uint32_t blocksHigh = (height + 3) / 4;
+  std::vector<std::byte> out(static_cast<size_t>(blocksWide) * blocksHigh *
+                             sizeof(Block));
+
+  auto encodeRows = [&](size_t firstRow, size_t lastRow) {
+    for (auto by = static_cast<uint32_t>(firstRow); by < lastRow; ++by) {
+      for (uint32_t bx = 0; bx < blocksWide; ++bx) {
+        uint8_t texels[16][4];
+        for (uint32_t t = 0; t < 16; ++t) {
+          const uint32_t x = std::min(bx * 4 + t % 4, width - 1);
+          const uint32_t y = std::min(by * 4 + t / 4, height - 1);
+          std::copy_n(rgba + (static_cast<size_t>(y) * width + x) * 4, 4,
+                      texels[t]);
+        }
+        const Block block = encodeBlock(texels);
+        std::copy_n(reinterpret_cast<const std::byte*>(block.data()),
+                    block.size(),
+                    out.data() + (static_cast<size_t>(by) * blocksWide + bx) *
+                                     sizeof(Block));
+      }
+    }
+  };
+
+  // one row of blocks at a time: rows with more detail take longer
+  JobSystem::shared().parallelFor(blocksHigh, 1, encodeRows);
+  return out;
+}
+
+}  // namespace bc7
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+// Pre-recorded primary command buffers, one per (frame in flight, swap chain
+// image) pair, replayed until something they reference changes.
+//
+// Staleness is tracked with a generation counter: invalidate() bumps it, and
+// a command buffer recorded under an older generation is re-recorded the
+// next time it's used. Invalidate whenever the swap chain, the pipeline or
+// the scene (buffers, descriptor sets, draw parameters) changes.
+class CommandCache {
+ public:
+  struct Stats {
+    uint64_t recorded = 0;
+    uint64_t replayed = 0;
+    // CPU time spent preparing command buffers, by outcome
+    double recordSeconds = 0;
+    double replaySeconds = 0;
+
+    // average CPU time per frame saved by replaying instead of recording
+    double savedSecondsPerFrame() const {
+      if (recorded == 0 || replayed == 0) {
+        return 0;
+      }
+      return recordSeconds / recorded - replaySeconds / replayed;
+    }
+  };
+
+  // (Re)allocates command buffers for `imageCount` swap chain images. All of
+  // them start out stale.
+  void init(VkDevice device,
+            VkCommandPool pool,
+            uint32_t frameCount,
+            uint32_t imageCount) {
+    destroy();
+    this->device = device;
+    this->pool = pool;
+    this->imageCount = imageCount;
+
+    commandBuffers.resize(frameCount * imageCount);
+    generations.assign(commandBuffers.size(), 0);
+
+    VkCommandBufferAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = static_cast<uint32_t>(commandBuffers.size())};
+    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate cached command buffers");
+    }
+  }
+
+  // Safe to call from any thread, e.g. a startup job creating a pipeline
+  void invalidate() { generation.fetch_add(1, std::memory_order_relaxed); }
+
+  // Returns the command buffer for the given frame slot and image, calling
+  // `record(commandBuffer)` first if it's stale, or `replay(commandBuffer)`
+  // otherwise.
+  template <typename Record, typename Replay>
+  VkCommandBuffer get(uint32_t frame,
+                      uint32_t image,
+                      Record&& record,
+                      Replay&& replay) {
+    auto start = std::chrono::steady_clock::now();
+
+    const size_t index = static_cast<size_t>(frame) * imageCount + image;
+    VkCommandBuffer commandBuffer = commandBuffers[index];
+    const uint64_t current = generation.load(std::memory_order_relaxed);
+    const bool stale = generations[index] != current;
+    if (stale) {
+      vkResetCommandBuffer(commandBuffer, 0);
+      record(commandBuffer);
+      generations[index] = current;
+    } else {
+      replay(commandBuffer);
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (stale) {
+      ++stats.recorded;
+      stats.recordSeconds += elapsed.count();
+    } else {
+      ++stats.replayed;
+      stats.replaySeconds += elapsed.count();
+    }
+    return commandBuffer;
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(std::ostream& out) const {
+    out << "command cache: " << stats.recorded << " recorded, "
+        << stats.replayed << " replayed, "
+        << stats.savedSecondsPerFrame() * 1e6
+        << " us of CPU time saved per replayed frame\n";
+  }
+
+  // Frees the command buffers. Destroying the pool frees them too.
+  void destroy() {
+    if (!commandBuffers.empty()) {
+      vkFreeCommandBuffers(device, pool,
+                           static_cast<uint32_t>(commandBuffers.size()),
+                           commandBuffers.data());
+    }
+    commandBuffers.clear();
+    generations.clear();
+  }
+
+ private:
+  VkDevice device = VK_NULL_HANDLE;
+  VkCommandPool pool = VK_NULL_HANDLE;
+  uint32_t imageCount = 0;
+  // indexed by frame * imageCount + image
+  std::vector<VkCommandBuffer> commandBuffers;
+  std::vector<uint64_t> generations;
+  // starts ahead of the recorded generations so everything begins stale
+  std::atomic<uint64_t> generation{1};
+  Stats stats;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Scoped CPU markers, exported in the Chrome trace event format (load the
+// file in chrome://tracing or https://ui.perfetto.dev).
+//
+//   void drawFrame() {
+//     TRACE_SCOPE("drawFrame");
+//     ...
+//   }
+//
+// Each thread appends to its own fixed-size ring, so recording an event
+// takes no locks; only the first event of a thread registers its ring.
+// When the ring is full the oldest events are overwritten. Names must
+// outlive the trace, i.e. be string literals or __func__. While tracing is
+// disabled a marker costs a relaxed atomic load.
+namespace trace {
+
+inline constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+struct Event {
+  const char* name;
+  uint64_t beginNs;
+  uint64_t endNs;
+};
+
+namespace detail {
+
+struct ThreadBuffer {
+  std::vector<Event> events = std::vector<Event>(EVENTS_PER_THREAD);
+  // total number of events written; only the owning thread writes it
+  std::atomic<uint64_t> written{0};
+  uint32_t threadId = 0;
+  std::string threadName;
+};
+
+struct Registry {
+  std::atomic<bool> enabled{false};
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::mutex mutex;
+  // never shrinks, so the rings outlive the threads that wrote them
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+inline Registry& registry() {
+  static Registry instance;
+  return instance;
+}
+
+inline ThreadBuffer& threadBuffer() {
+  thread_local ThreadBuffer* buffer = [] {
+    auto& reg = registry();
+    std::lock_guard lock(reg.mutex);
+    auto& added = reg.buffers.emplace_back(std::make_unique<ThreadBuffer>());
+    added->threadId = static_cast<uint32_t>(reg.buffers.size());
+    added->threadName = "thread " + std::to_string(added->threadId);
+    return added.get();
+  }();
+  return *buffer;
+}
+
+}  // namespace detail
+
+inline void setEnabled(bool enabled) {
+  detail::registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+inline bool isEnabled() {
+  return detail::registry().enabled.load(std::memory_order_relaxed);
+}
+
+inline uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - detail::registry().start)
+      .count();
+}
+
+// Name shown for the calling thread in the trace
+inline void setThreadName(std::string name) {
+  auto& buffer = detail::threadBuffer();
+  std::lock_guard lock(detail::registry().mutex);
+  buffer.threadName = std::move(name);
+}
+
+inline void record(const char* name, uint64_t beginNs, uint64_t endNs) {
+  auto& buffer = detail::threadBuffer();
+  const uint64_t index = buffer.written.load(std::memory_order_relaxed);
+  buffer.events[index % EVENTS_PER_THREAD] = {name, beginNs, endNs};
+  // publish the event to writeChromeJson()
+  buffer.written.store(index + 1, std::memory_order_release);
+}
+
+class Scope {
+ public:
+  explicit Scope(const char* name)
+      : name(isEnabled() ? name : nullptr), beginNs(this->name ? now() : 0) {}
+  ~Scope() {
+    if (name) {
+      record(name, beginNs, now());
+    }
+  }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  const char* name;
+  uint64_t beginNs;
+};
+
+// Writes every retained event. Meant to be called once the traced threads
+// are idle; events recorded concurrently may or may not be included.
+inline void writeChromeJson(std::ostream& out) {
+  auto& reg = detail::registry();
+  std::lock_guard lock(reg.mutex);
+
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  // timestamps are in microseconds; keep the nanoseconds
+  out << std::fixed << std::setprecision(3);
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  const char* separator = "";
+  for (const auto& buffer : reg.buffers) {
+    out << separator
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+        << buffer->threadId << ", \"args\": {\"name\": \"" << buffer->threadName
+        << "\"}}";
+    separator = ",\n";
+
+    const uint64_t written = buffer->written.load(std::memory_order_acquire);
+    const uint64_t first =
+        written > EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+    for (uint64_t i = first; i < written; ++i) {
+      const Event& event = buffer->events[i % EVENTS_PER_THREAD];
+      out << separator << "{\"name\": \"" << event.name
+          << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId
+          << ", \"ts\": " << event.beginNs / 1000.0
+          << ", \"dur\": " << (event.endNs - event.beginNs) / 1000.0 << "}";
+    }
+  }
+  out << "\n]}\n";
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) \
+  ::trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+// Marks the enclosing function, named after it
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+// Hands out descriptor set layouts and descriptor sets without anyone sizing
+// a pool for them.
+//
+// Sets come from chains of pools: when a pool runs out
+// (VK_ERROR_OUT_OF_POOL_MEMORY or VK_ERROR_FRAGMENTED_POOL) another one,
+// twice as big up to a limit, is added and the allocation retried. Sets that
+// live until destroy() come from one chain; transient sets come from a chain
+// per frame in flight, which beginFrame() resets wholesale with
+// vkResetDescriptorPool once the frame's fence has signalled, or from a chain
+// for work that finishes on its own schedule, like uploads, reset once none
+// of its sets is in use. Nothing is ever freed one set at a time.
+//
+// Layouts with the same bindings, and sets with the same layout and contents,
+// are created once and shared: both are cached by a hash of their contents.
+// Layouts needing extension structs (binding flags, update-after-bind pools)
+// are out of scope; see TextureTable.
+//
+// Not thread-safe; use it from the thread creating the resources.
+class DescriptorAllocator {
+ public:
+  struct Stats {
+    uint64_t poolsCreated = 0;
+    uint64_t setsAllocated = 0;
+    uint64_t setRequests = 0;
+    uint64_t setHits = 0;
+    uint64_t layoutRequests = 0;
+    uint64_t layoutHits = 0;
+
+    // the share of requests for a set or a layout served from the caches
+    double hitRate() const {
+      const uint64_t requests = setRequests + layoutRequests;
+      return requests == 0
+                 ? 0
+                 : static_cast<double>(setHits + layoutHits) / requests;
+    }
+  };
+
+  // What a set holds at one binding: `buffer` for buffer descriptor types,
+  // `image` for image and sampler ones. Array bindings take one per element.
+  struct Descriptor {
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDescriptorBufferInfo buffer{};
+    VkDescriptorImageInfo image{};
+    uint32_t arrayElement = 0;
+  };
+
+  void init(VkDevice device, uint32_t frameCount) {
+    this->device = device;
+    frames.resize(frameCount);
+    frameSets.resize(frameCount);
+  }
+
+  // The layout with `bindings`, created on first use. It lives until
+  // destroy(); don't destroy it yourself.
+  VkDescriptorSetLayout layout(
+      std::span<const VkDescriptorSetLayoutBinding> bindings) {
+    ++stats.layoutRequests;
+    std::vector<VkDescriptorSetLayoutBinding> sorted(bindings.begin(),
+                                                     bindings.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+      return a.binding < b.binding;
+    });
+    Key key;
+    for (const auto& binding : sorted) {
+      key.insert(key.end(), {binding.binding,
+                             static_cast<uint64_t>(binding.descriptorType),
+                             binding.descriptorCount, binding.stageFlags});
+      if (binding.pImmutableSamplers) {
+        for (uint32_t i = 0; i < binding.descriptorCount; ++i) {
+          key.push_back(handleBits(binding.pImmutableSamplers[i]));
+        }
+      }
+    }
+    if (auto it = layouts.find(key); it != layouts.end()) {
+      ++stats.layoutHits;
+      return it->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(sorted.size()),
+        .pBindings = sorted.data()};
+    VkDescriptorSetLayout created;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &created) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor set layout");
+    }
+    layouts.emplace(std::move(key), created);
+    return created;
+  }
+
+  // A set of `layout` holding `descriptors`, which lives until destroy().
+  // Asking again for the same contents returns the same set, so whatever it
+  // points at must not be replaced by something else under the same handle.
+  VkDescriptorSet set(VkDescriptorSetLayout layout,
+                      std::span<const Descriptor> descriptors) {
+    return cachedSet(persistent, persistentSets, layout, descriptors);
+  }
+
+  // A set of `layout` holding `descriptors` for `frame` only: it's gone once
+  // beginFrame(frame) is called again, and so must not be bound in cached
+  // command buffers
+  VkDescriptorSet frameSet(uint32_t frame,
+                           VkDescriptorSetLayout layout,
+                           std::span<const Descriptor> descriptors) {
+    return cachedSet(frames[frame], frameSets[frame], layout, descriptors);
+  }
+
+  // Frees `frame`'s transient sets. Call once its fence has signalled.
+  void beginFrame(uint32_t frame) {
+    reset(frames[frame]);
+    frameSets[frame].clear();
+  }
+
+  // A set of `layout` holding `descriptors` for commands that don't finish
+  // with a frame, such as uploads. Call releaseTransientSet() once they have
+  // finished executing; the sets are freed together when none is in use.
+  // Never cached: what they point at usually goes away with them.
+  VkDescriptorSet transientSet(VkDescriptorSetLayout layout,
+                               std::span<const Descriptor> descriptors) {
+    VkDescriptorSet set = allocate(transient, layout);
+    write(set, descriptors);
+    ++transientSetsInUse;
+    return set;
+  }
+
+  void releaseTransientSet() {
+    if (--transientSetsInUse == 0) {
+      reset(transient);
+    }
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(std::ostream& out) const {
+    out << "descriptors: " << stats.setsAllocated << " sets allocated from "
+        << stats.poolsCreated << " pools, " << stats.setHits << "/"
+        << stats.setRequests << " sets and " << stats.layoutHits << "/"
+        << stats.layoutRequests << " layouts from the cache (hit rate "
+        << stats.hitRate() * 100 << "%)\n";
+  }
+
+  // Destroys every pool, and so every set, and every layout
+  void destroy() {
+    if (device == VK_NULL_HANDLE) {
+      return;
+    }
+    destroy(persistent);
+    destroy(transient);
+    transientSetsInUse = 0;
+    for (auto& chain : frames) {
+      destroy(chain);
+    }
+    frames.clear();
+    persistentSets.clear();
+    frameSets.clear();
+    for (const auto& [key, layout] : layouts) {
+      vkDestroyDescriptorSetLayout(device, layout, nullptr);
+    }
+    layouts.clear();
+    device = VK_NULL_HANDLE;
+  }
+
+ private:
+  // sets in the first pool of a chain, doubled for each pool after that
+  static constexpr uint32_t FIRST_POOL_SETS = 16;
+  static constexpr uint32_t MAX_POOL_SETS = 4096;
+
+  // descriptors of each type per set in a pool, covering the sets in the
+  // tree with a few to spare; a mip generator set takes 14 storage images
+  static constexpr std::array<std::pair<VkDescriptorType, uint32_t>, 7>
+      POOL_RATIOS{{{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+                   {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+                   {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+                   {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 16},
+                   {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+                   {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1},
+                   {VK_DESCRIPTOR_TYPE_SAMPLER, 1}}};
+
+  // A content hash key: the words describing a layout or a set's contents
+  using Key = std::vector<uint64_t>;
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return hashBytes(std::as_bytes(std::span(key)));
+    }
+  };
+
+  template <typename Cache>
+  using KeyMap = std::unordered_map<Key, Cache, KeyHash>;
+
+  struct PoolChain {
+    // pools sets can still come from, the last one first
+    std::vector<VkDescriptorPool> ready;
+    // pools that have run out, until the chain is reset
+    std::vector<VkDescriptorPool> full;
+    uint32_t nextPoolSets = FIRST_POOL_SETS;
+  };
+
+  // Non-dispatchable handles are pointers on 64-bit platforms and integers
+  // elsewhere
+  template <typename Handle>
+  static uint64_t handleBits(Handle handle) {
+    if constexpr (std::is_pointer_v<Handle>) {
+      return reinterpret_cast<uintptr_t>(handle);
+    } else {
+      return handle;
+    }
+  }
+
+  VkDescriptorSet cachedSet(PoolChain& chain,
+                            KeyMap<VkDescriptorSet>& cache,
+                            VkDescriptorSetLayout layout,
+                            std::span<const Descriptor> descriptors) {
+    ++stats.setRequests;
+    Key key{handleBits(layout)};
+    for (const Descriptor& descriptor : descriptors) {
+      key.insert(key.end(),
+                 {descriptor.binding, static_cast<uint64_t>(descriptor.type),
+                  handleBits(descriptor.buffer.buffer),
+                  descriptor.buffer.offset, descriptor.buffer.range,
+                  handleBits(descriptor.image.sampler),
+                  handleBits(descriptor.image.imageView),
+                  static_cast<uint64_t>(descriptor.image.imageLayout),
+                  descriptor.arrayElement});
+    }
+    if (auto it = cache.find(key); it != cache.end()) {
+      ++stats.setHits;
+      return it->second;
+    }
+
+    VkDescriptorSet set = allocate(chain, layout);
+    write(set, descriptors);
+    cache.emplace(std::move(key), set);
+    return set;
+  }
+
+  void write(VkDescriptorSet set, std::span<const Descriptor> descriptors) {
+    std::vector<VkWriteDescriptorSet> writes;
+    writes.reserve(descriptors.size());
+    for (const Descriptor& descriptor : descriptors) {
+      const bool image =
+          descriptor.type == VK_DESCRIPTOR_TYPE_SAMPLER ||
+          descriptor.type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+          descriptor.type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+          descriptor.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ||
+          descriptor.type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      writes.push_back(
+          {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstSet = set,
+           .dstBinding = descriptor.binding,
+           .dstArrayElement = descriptor.arrayElement,
+           .descriptorCount = 1,
+           .descriptorType = descriptor.type,
+           .pImageInfo = image ? &descriptor.image : nullptr,
+           .pBufferInfo = image ? nullptr : &descriptor.buffer});
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+  }
+
+  VkDescriptorSet allocate(PoolChain& chain, VkDescriptorSetLayout layout) {
+    // a pool that's just been created failing too means the set can never
+    // fit, so only one retry
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      if (chain.ready.empty()) {
+        chain.ready.push_back(createPool(chain));
+      }
+      VkDescriptorSetAllocateInfo allocInfo{
+          .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+          .descriptorPool = chain.ready.back(),
+          .descriptorSetCount = 1,
+          .pSetLayouts = &layout};
+      VkDescriptorSet set;
+      const VkResult result =
+          vkAllocateDescriptorSets(device, &allocInfo, &set);
+      if (result == VK_SUCCESS) {
+        ++stats.setsAllocated;
+        return set;
+      }
+      if (result != VK_ERROR_OUT_OF_POOL_MEMORY &&
+          result != VK_ERROR_FRAGMENTED_POOL) {
+        break;
+      }
+      chain.full.push_back(chain.ready.back());
+      chain.ready.pop_back();
+    }
+    throw std::runtime_error("failed to allocate descriptor set");
+  }
+
+  VkDescriptorPool createPool(PoolChain& chain) {
+    const uint32_t sets = chain.nextPoolSets;
+    chain.nextPoolSets = std::min(sets * 2, MAX_POOL_SETS);
+
+    std::array<VkDescriptorPoolSize, POOL_RATIOS.size()> poolSizes;
+    for (size_t i = 0; i < POOL_RATIOS.size(); ++i) {
+      poolSizes[i] = {.type = POOL_RATIOS[i].first,
+                      .descriptorCount = POOL_RATIOS[i].second * sets};
+    }
+    VkDescriptorPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = sets,
+        .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+        .pPoolSizes = poolSizes.data()};
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor pool");
+    }
+    ++stats.poolsCreated;
+    return pool;
+  }
+
+  void reset(PoolChain& chain) {
+    for (VkDescriptorPool pool : chain.ready) {
+      vkResetDescriptorPool(device, pool, 0);
+    }
+    for (VkDescriptorPool pool : chain.full) {
+      vkResetDescriptorPool(device, pool, 0);
+      chain.ready.push_back(pool);
+    }
+    chain.full.clear();
+  }
+
+  void destroy(PoolChain& chain) {
+    for (VkDescriptorPool pool : chain.ready) {
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    for (VkDescriptorPool pool : chain.full) {
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    chain = {};
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  PoolChain persistent;
+  std::vector<PoolChain> frames;
+  PoolChain transient;
+  uint32_t transientSetsInUse = 0;
+  KeyMap<VkDescriptorSetLayout> layouts;
+  KeyMap<VkDescriptorSet> persistentSets;
+  std::vector<KeyMap<VkDescriptorSet>> frameSets;
+  Stats stats;
+};
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "descriptor_allocator.hpp"
+#include "frustum.hpp"
+#include "gpu_resources.hpp"
+#include "memory_allocator.hpp"
+#include "parallel_recorder.hpp"
+#include "types.hpp"
+#include "upload_service.hpp"
+#include "utils.hpp"
+
+// Frustum culls a draw list on the GPU and draws what's left with indirect
+// draws, so the CPU's cost per frame doesn't grow with the number of draws.
+// Each draw's bounding sphere and command live in a storage buffer; a
+// compute shader (shaders/draw_cull.comp) tests the spheres against the
+// frustum every frame and writes the indirect draws.
+//
+// With VK_KHR_draw_indirect_count (and multiDrawIndirect) the shader packs
+// the visible draws together and counts them, and one
+// vkCmdDrawIndexedIndirectCount draws exactly those. Otherwise it writes
+// every draw in place, with no instances if it was culled, for plain
+// vkCmdDrawIndexedIndirect.
+class DrawCuller {
+ public:
+  // draws culled by each workgroup of the culling shader
+  static constexpr uint32_t CULL_GROUP_SIZE = 64;
+
+  static bool drawIndirectCountSupported(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+    return features.multiDrawIndirect &&
+           hasDeviceExtension(physicalDevice,
+                              VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  }
+
+  // Creates the culling pipeline. The device is expected to have
+  // multiDrawIndirect enabled if it supports it, and if `drawIndirectCount`,
+  // VK_KHR_draw_indirect_count.
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            DeviceMemoryAllocator& allocator,
+            DescriptorAllocator& descriptors,
+            VkPipelineCache pipelineCache,
+            bool drawIndirectCount,
+            uint32_t frameCount,
+            const std::string& shaderPath) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->descriptors = &descriptors;
+
+    maxDrawIndirectCount = maxIndirectDrawCount(physicalDevice);
+
+    if (drawIndirectCount) {
+      drawIndexedIndirectCount =
+          reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+              vkGetDeviceProcAddr(device,
+                                  "vkCmdDrawIndexedIndirectCountKHR"));
+      if (!drawIndexedIndirectCount) {
+        throw std::runtime_error(
+            "failed to load vkCmdDrawIndexedIndirectCountKHR");
+      }
+    }
+
+    std::array<VkDescriptorSetLayoutBinding, BINDING_COUNT> bindings;
+    for (uint32_t binding = 0; binding < BINDING_COUNT; ++binding) {
+      bindings[binding] = {.binding = binding,
+                           .descriptorType = descriptorType(binding),
+                           .descriptorCount = 1,
+                           .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT};
+    }
+    setLayout = descriptors.layout(bindings);
+
+    frames.resize(frameCount);
+    for (auto& frame : frames) {
+      createBuffer(device, *allocator, sizeof(Culling),
+                   VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   frame.cullingBuffer, frame.cullingMemory);
+      // the draw count, also read back by collect()
+      createBuffer(device, *allocator, sizeof(uint32_t),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                       VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   frame.countBuffer, frame.countMemory);
+      *static_cast<uint32_t*>(frame.countMemory.mapped) = NOT_SUBMITTED;
+    }
+
+    createPipeline(pipelineCache, shaderPath);
+  }
+
+  // Uploads the draws with a bounding sphere each, from the positions of the
+  // vertices they use, and fills in the descriptor sets. `indices` are the
+  // mesh's indices into `vertices`, without the draws' vertex offsets.
+  void upload(UploadService& uploads,
+              std::span<const DrawCommand> draws,
+              std::span<const uint32_t> indices,
+              std::span<const Vertex> vertices) {
+    drawCount = static_cast<uint32_t>(draws.size());
+    if (drawCount == 0) {
+      throw std::runtime_error("there are no draws to cull");
+    }
+    // the count can't go over the device's limit, so past it every draw is
+    // issued and the culled ones have no instances
+    compact = drawIndexedIndirectCount && drawCount <= maxDrawIndirectCount;
+
+    std::vector<DrawObject> objects;
+    objects.reserve(draws.size());
+    for (const DrawCommand& draw : draws) {
+      objects.push_back(
+          {.boundingSphere = boundingSphere(
+               indices.subspan(draw.firstIndex, draw.indexCount), vertices),
+           .indexCount = draw.indexCount,
+           .firstIndex = draw.firstIndex,
+           .vertexOffset = draw.vertexOffset});
+    }
+    auto bytes = std::as_bytes(std::span(objects));
+    createBuffer(device, *allocator, bytes.size(),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, objectBuffer,
+                 objectMemory);
+    uploads.uploadBuffer(objectBuffer, 0, bytes);
+
+    for (Frame& frame : frames) {
+      createBuffer(device, *allocator,
+                   sizeof(VkDrawIndexedIndirectCommand) * drawCount,
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                       VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.drawBuffer,
+                   frame.drawMemory);
+
+      const std::array<VkDescriptorBufferInfo, BINDING_COUNT> buffers{{
+          {objectBuffer, 0, VK_WHOLE_SIZE},
+          {frame.cullingBuffer, 0, VK_WHOLE_SIZE},
+          {frame.drawBuffer, 0, VK_WHOLE_SIZE},
+          {frame.countBuffer, 0, VK_WHOLE_SIZE},
+      }};
+      std::array<DescriptorAllocator::Descriptor, BINDING_COUNT> contents;
+      for (uint32_t binding = 0; binding < BINDING_COUNT; ++binding) {
+        contents[binding] = {.binding = binding,
+                             .type = descriptorType(binding),
+                             .buffer = buffers[binding]};
+      }
+      frame.descriptorSet = descriptors->set(setLayout, contents);
+    }
+  }
+
+  // Sets the frame's frustum from the matrix taking model space to clip
+  // space. Call before submitting the frame.
+  void updateCulling(uint32_t frame, const glm::mat4& modelViewProj) {
+    Culling culling{.objectCount = drawCount, .compact = compact};
+    const auto planes = frustumPlanes(modelViewProj);
+    std::copy(planes.begin(), planes.end(), culling.frustumPlanes);
+    std::memcpy(frames[frame].cullingMemory.mapped, &culling, sizeof(culling));
+  }
+
+  // Records the culling dispatch, outside the render pass
+  void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame) {
+    const Frame& current = frames[frame];
+    // the previous use of the draws and the count is over before they're
+    // rewritten
+    VkMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(commandBuffer, current.countBuffer, 0, sizeof(uint32_t),
+                    0);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipelineLayout, 0, 1, &current.descriptorSet, 0,
+                            nullptr);
+    vkCmdDispatch(commandBuffer,
+                  (drawCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+  }
+
+  // Records the draws, inside the render pass. The caller has bound the
+  // graphics pipeline and everything the draws use.
+  void recordDraw(VkCommandBuffer commandBuffer, uint32_t frame) {
+    const Frame& current = frames[frame];
+    if (compact) {
+      drawIndexedIndirectCount(commandBuffer, current.drawBuffer, 0,
+                               current.countBuffer, 0, drawCount,
+                               sizeof(VkDrawIndexedIndirectCommand));
+      return;
+    }
+    drawIndexedIndirectBatched(commandBuffer, current.drawBuffer, drawCount,
+                               maxDrawIndirectCount);
+  }
+
+  // Makes the frame's draw count readable by collect() once the frame's
+  // fence has signalled. Recorded after the render pass.
+  void recordStatsReadback(VkCommandBuffer commandBuffer, uint32_t frame) {
+    VkBufferMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = frames[frame].countBuffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier,
+                         0, nullptr);
+  }
+
+  // Adds the frame's last draw count to the totals. Call once its fence has
+  // signalled, before it's submitted again.
+  void collect(uint32_t frame) {
+    auto* count = static_cast<uint32_t*>(frames[frame].countMemory.mapped);
+    if (*count == NOT_SUBMITTED) {
+      return;
+    }
+    ++framesCulled;
+    drawn += *count;
+    // the culling pass zeroes it before counting again
+    *count = NOT_SUBMITTED;
+  }
+
+  void printStats(std::ostream& out) const {
+    const double frameCount =
+        static_cast<double>(std::max<uint64_t>(framesCulled, 1));
+    out << "GPU culling ("
+        << (compact ? "indirect count" : "indirect, culled draws empty")
+        << "): " << drawCount << " draws per frame, on average "
+        << drawn / frameCount << " drawn\n";
+  }
+
+  void destroy() {
+    if (device == VK_NULL_HANDLE) {
+      return;
+    }
+    for (auto& frame : frames) {
+      destroyBuffer(device, *allocator, frame.cullingBuffer,
+                    frame.cullingMemory);
+      destroyBuffer(device, *allocator, frame.countBuffer, frame.countMemory);
+      destroyBuffer(device, *allocator, frame.drawBuffer, frame.drawMemory);
+    }
+    frames.clear();
+    destroyBuffer(device, *allocator, objectBuffer, objectMemory);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    device = VK_NULL_HANDLE;
+  }
+
+ private:
+  // see shaders/draw_cull.comp
+  enum Binding : uint32_t {
+    OBJECTS_BINDING,
+    CULLING_BINDING,
+    DRAWS_BINDING,
+    COUNT_BINDING,
+    BINDING_COUNT
+  };
+
+  // in the count buffer while the frame's count hasn't been written since
+  // collect() last read it; the GPU never counts this many draws
+  static constexpr uint32_t NOT_SUBMITTED =
+      std::numeric_limits<uint32_t>::max();
+
+  // matches the DrawObject struct in shaders/draw_cull.comp (std430)
+  struct DrawObject {
+    // xyz: centre in model space, w: radius
+    glm::vec4 boundingSphere;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t padding = 0;
+  };
+  static_assert(sizeof(DrawObject) == 32, "must match the std430 layout");
+
+  // matches the Culling block in shaders/draw_cull.comp (std140)
+  struct Culling {
+    glm::vec4 frustumPlanes[6];
+    uint32_t objectCount;
+    uint32_t compact;
+  };
+
+  struct Frame {
+    VkBuffer cullingBuffer = VK_NULL_HANDLE;
+    Allocation cullingMemory;
+    VkBuffer countBuffer = VK_NULL_HANDLE;
+    Allocation countMemory;
+    VkBuffer drawBuffer = VK_NULL_HANDLE;
+    Allocation drawMemory;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  };
+
+  static VkDescriptorType descriptorType(uint32_t binding) {
+    return binding == CULLING_BINDING ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                      : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  }
+
+  // The sphere around the centre of the box bounding the vertices `indices`
+  // use. Looser than a fitted sphere, but draws are cut from consecutive
+  // triangles and are roughly box shaped anyway.
+  static glm::vec4 boundingSphere(std::span<const uint32_t> indices,
+                                  std::span<const Vertex> vertices) {
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(std::numeric_limits<float>::lowest());
+    for (uint32_t index : indices) {
+      lo = glm::min(lo, vertices[index].pos);
+      hi = glm::max(hi, vertices[index].pos);
+    }
+    if (indices.empty()) {
+      return glm::vec4(0.f);
+    }
+    return glm::vec4((lo + hi) * 0.5f, glm::length(hi - lo) * 0.5f);
+  }
+
+  void createPipeline(VkPipelineCache pipelineCache,
+                      const std::string& shaderPath) {
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &setLayout};
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
+                               &pipelineLayout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create draw culling layout");
+    }
+
+    pipeline = createComputePipeline(device, pipelineCache, pipelineLayout,
+                                     shaderPath);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceMemoryAllocator* allocator = nullptr;
+  DescriptorAllocator* descriptors = nullptr;
+  uint32_t maxDrawIndirectCount = 1;
+  PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;
+  // whether the culling shader packs the visible draws for the count draw
+  bool compact = false;
+
+  // owned by the descriptor allocator
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+
+  uint32_t drawCount = 0;
+  VkBuffer objectBuffer = VK_NULL_HANDLE;
+  Allocation objectMemory;
+
+  std::vector<Frame> frames;
+  uint64_t framesCulled = 0;
+  uint64_t drawn = 0;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <array>
+
+#include "types.hpp"
+
+// The six planes bounding the view volume of `viewProj`, in the space it
+// transforms from: left, right, bottom, top, near, far. Each is normalized
+// and points inwards, so dot(plane.xyz, p) + plane.w is the signed distance
+// of p from it.
+inline std::array<glm::vec4, 6> frustumPlanes(const glm::mat4& viewProj) {
+  // Gribb and Hartmann: each clip plane is a sum or difference of rows of
+  // the matrix. Depth runs from 0 to 1, so near is just the third row.
+  auto row = [&](int i) {
+    return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i],
+                     viewProj[3][i]);
+  };
+  std::array<glm::vec4, 6> planes{row(3) + row(0), row(3) - row(0),
+                                  row(3) + row(1), row(3) - row(1),
+                                  row(2),          row(3) - row(2)};
+  for (glm::vec4& plane : planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return planes;
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// GPU timings of named scopes, measured with timestamp queries.
+//
+// Each slot owns a query pool, and is meant to be written by one submission
+// at a time: one slot per frame in flight, plus any for one-off work such as
+// uploads. Results are read back without waiting. For frame slots, begin() is
+// called after the frame's fence has signalled, so they're always available
+// by then; other slots are polled by collect().
+//
+// A slot can be written by several command buffers recorded once and
+// replayed, e.g. one per swap chain image: the scopes are kept per command
+// buffer, so results are attributed to whichever one was last submitted.
+class GpuProfiler {
+ public:
+  static constexpr uint32_t MAX_SCOPES_PER_SLOT = 32;
+  // samples kept per scope for the rolling statistics
+  static constexpr size_t HISTORY_SIZE = 256;
+  static constexpr uint32_t INVALID_SCOPE = ~0u;
+
+  struct ScopeStats {
+    std::string name;
+    uint64_t samples;
+    double lastMs;
+    double minMs;
+    double avgMs;
+    double p99Ms;
+  };
+
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            uint32_t queueFamily,
+            uint32_t slotCount) {
+    this->device = device;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                             families.data());
+    const uint32_t validBits = families[queueFamily].timestampValidBits;
+    if (validBits == 0) {
+      // timestamps aren't supported on this queue; every call is a no-op
+      return;
+    }
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    slots.resize(slotCount);
+    for (auto& slot : slots) {
+      VkQueryPoolCreateInfo createInfo{
+          .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+          .queryType = VK_QUERY_TYPE_TIMESTAMP,
+          .queryCount = MAX_SCOPES_PER_SLOT * 2};
+      if (vkCreateQueryPool(device, &createInfo, nullptr, &slot.pool) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool");
+      }
+    }
+  }
+
+  bool enabled() const { return !slots.empty(); }
+
+  // Starts recording scopes for `slot` into `commandBuffer`, outside of any
+  // render pass. Picks up the slot's previous results first; if those aren't
+  // available yet, nothing is measured until the next begin().
+  void begin(VkCommandBuffer commandBuffer, uint32_t slot) {
+    if (!enabled()) {
+      return;
+    }
+    auto& s = slots[slot];
+    s.recording = !s.pending || read(s);
+    // without the reset, the buffer writes no queries at all
+    recorded[commandBuffer].clear();
+    if (s.recording) {
+      s.scopes.clear();
+      vkCmdResetQueryPool(commandBuffer, s.pool, 0, MAX_SCOPES_PER_SLOT * 2);
+    }
+  }
+
+  // For `commandBuffer`, recorded earlier for `slot` with begin(), which is
+  // about to be submitted again: picks up the slot's previous results and
+  // expects the scopes recorded into that buffer to be written again.
+  void replay(VkCommandBuffer commandBuffer, uint32_t slot) {
+    if (!enabled()) {
+      return;
+    }
+    auto& s = slots[slot];
+    const auto& scopes = recorded[commandBuffer];
+    if (s.pending && !read(s) && scopes.empty()) {
+      // the buffer doesn't touch the queries, so the results still to come
+      // are the previous submission's
+      return;
+    }
+    s.scopes = scopes;
+    s.pending = !s.scopes.empty();
+  }
+
+  uint32_t beginScope(VkCommandBuffer commandBuffer,
+                      uint32_t slot,
+                      std::string_view name) {
+    if (!enabled()) {
+      return INVALID_SCOPE;
+    }
+    auto& s = slots[slot];
+    if (!s.recording || s.scopes.size() == MAX_SCOPES_PER_SLOT) {
+      return INVALID_SCOPE;
+    }
+    const uint32_t query = static_cast<uint32_t>(s.scopes.size()) * 2;
+    s.scopes.push_back(scopeId(name));
+    recorded[commandBuffer].push_back(s.scopes.back());
+    s.pending = true;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        s.pool, query);
+    return query / 2;
+  }
+
+  void endScope(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t scope) {
+    if (scope == INVALID_SCOPE) {
+      return;
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        slots[slot].pool, scope * 2 + 1);
+  }
+
+  // Times the commands recorded during its lifetime
+  class Scope {
+   public:
+    Scope(GpuProfiler& profiler,
+          VkCommandBuffer commandBuffer,
+          uint32_t slot,
+          std::string_view name)
+        : profiler(profiler),
+          commandBuffer(commandBuffer),
+          slot(slot),
+          scope(profiler.beginScope(commandBuffer, slot, name)) {}
+    ~Scope() { profiler.endScope(commandBuffer, slot, scope); }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    GpuProfiler& profiler;
+    VkCommandBuffer commandBuffer;
+    uint32_t slot;
+    uint32_t scope;
+  };
+
+  // Reads back whichever slots have finished, without waiting
+  void collect() {
+    for (auto& slot : slots) {
+      if (slot.pending) {
+        read(slot);
+      }
+    }
+  }
+
+  std::vector<ScopeStats> statistics() const {
+    std::vector<ScopeStats> result;
+    for (const auto& history : histories) {
+      if (history.samples.empty()) {
+        continue;
+      }
+      std::vector<double> sorted = history.samples;
+      std::sort(sorted.begin(), sorted.end());
+      double sum = 0;
+      for (double sample : sorted) {
+        sum += sample;
+      }
+      const size_t p99 = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+      result.push_back({.name = history.name,
+                        .samples = history.count,
+                        .lastMs = history.lastMs,
+                        .minMs = sorted.front(),
+                        .avgMs = sum / sorted.size(),
+                        .p99Ms = sorted[p99]});
+    }
+    return result;
+  }
+
+  void writeJson(std::ostream& out) const {
+    out << "{\n  \"timestampPeriodNs\": " << timestampPeriod
+        << ",\n  \"scopes\": [";
+    const char* separator = "\n";
+    for (const auto& stats : statistics()) {
+      out << separator << "    {\"name\": \"" << stats.name
+          << "\", \"samples\": " << stats.samples
+          << ", \"lastMs\": " << stats.lastMs
+          << ", \"minMs\": " << stats.minMs << ", \"avgMs\": " << stats.avgMs
+          << ", \"p99Ms\": " << stats.p99Ms << "}";
+      separator = ",\n";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+  void writeCsv(std::ostream& out) const {
+    out << "scope,samples,last_ms,min_ms,avg_ms,p99_ms\n";
+    for (const auto& stats : statistics()) {
+      out << stats.name << "," << stats.samples << "," << stats.lastMs << ","
+          << stats.minMs << "," << stats.avgMs << "," << stats.p99Ms << "\n";
+    }
+  }
+
+  void printStats(std::ostream& out) const {
+    if (!enabled()) {
+      out << "GPU timestamps are not supported on the graphics queue\n";
+      return;
+    }
+    out << "GPU timings over the last " << HISTORY_SIZE
+        << " samples (min / avg / p99):\n";
+    for (const auto& stats : statistics()) {
+      out << "  " << stats.name << ": " << stats.minMs << " / " << stats.avgMs
+          << " / " << stats.p99Ms << " ms\n";
+    }
+  }
+
+  void destroy() {
+    for (auto& slot : slots) {
+      vkDestroyQueryPool(device, slot.pool, nullptr);
+    }
+    slots.clear();
+    recorded.clear();
+  }
+
+ private:
+  struct Slot {
+    VkQueryPool pool = VK_NULL_HANDLE;
+    // scope id of each begin/end query pair, as last recorded or replayed
+    std::vector<uint32_t> scopes;
+    bool recording = false;
+    // whether the queries have been written since they were last read
+    bool pending = false;
+  };
+
+  struct History {
+    std::string name;
+    // ring of the last HISTORY_SIZE samples
+    std::vector<double> samples;
+    size_t next = 0;
+    uint64_t count = 0;
+    double lastMs = 0;
+  };
+
+  uint32_t scopeId(std::string_view name) {
+    auto it = scopeIds.find(std::string(name));
+    if (it != scopeIds.end()) {
+      return it->second;
+    }
+    const uint32_t id = static_cast<uint32_t>(histories.size());
+    histories.push_back({.name = std::string(name)});
+    scopeIds.emplace(name, id);
+    return id;
+  }
+
+  // Returns false, leaving the slot pending, if the results aren't all
+  // available yet
+  bool read(Slot& slot) {
+    const uint32_t queryCount = static_cast<uint32_t>(slot.scopes.size()) * 2;
+    // value and availability of each query
+    std::vector<uint64_t> results(queryCount * 2);
+    VkResult result = vkGetQueryPoolResults(
+        device, slot.pool, 0, queryCount, results.size() * sizeof(uint64_t),
+        results.data(), 2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+      throw std::runtime_error("failed to read timestamp queries");
+    }
+    for (uint32_t query = 0; query < queryCount; ++query) {
+      if (results[query * 2 + 1] == 0) {
+        return false;
+      }
+    }
+
+    for (size_t i = 0; i < slot.scopes.size(); ++i) {
+      const uint64_t ticks =
+          (results[i * 4 + 2] - results[i * 4]) & timestampMask;
+      record(histories[slot.scopes[i]], ticks * timestampPeriod / 1e6);
+    }
+    slot.pending = false;
+    return true;
+  }
+
+  static void record(History& history, double ms) {
+    if (history.samples.size() < HISTORY_SIZE) {
+      history.samples.push_back(ms);
+    } else {
+      history.samples[history.next] = ms;
+    }
+    history.next = (history.next + 1) % HISTORY_SIZE;
+    ++history.count;
+    history.lastMs = ms;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  float timestampPeriod = 1.f;
+  uint64_t timestampMask = ~0ull;
+  std::vector<Slot> slots;
+  // the scope ids each command buffer writes, as recorded by begin() and
+  // beginScope(), for replay()
+  std::unordered_map<VkCommandBuffer, std::vector<uint32_t>> recorded;
+  std::vector<History> histories;
+  std::unordered_map<std::string, uint32_t> scopeIds;
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "memory_allocator.hpp"
+#include "utils.hpp"
+
+// Device queries, buffer and pipeline creation and draw recording shared by
+// the helpers that own their GPU resources (the draw culler, the meshlet
+// renderer, the mip generator, the texture table).
+
+// Whether `physicalDevice` offers the device extension `name`
+inline bool hasDeviceExtension(VkPhysicalDevice physicalDevice,
+                               const char* name) {
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, extensions.data());
+  return std::any_of(extensions.begin(), extensions.end(),
+                     [&](const VkExtensionProperties& extension) {
+                       return std::strcmp(extension.extensionName, name) == 0;
+                     });
+}
+
+// The most draws one indirect draw call can take: the device's limit with
+// multiDrawIndirect, which the device is expected to have enabled if it
+// supports it, and one without
+inline uint32_t maxIndirectDrawCount(VkPhysicalDevice physicalDevice) {
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+  if (!features.multiDrawIndirect) {
+    return 1;
+  }
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  return std::max(1u, properties.limits.maxDrawIndirectCount);
+}
+
+// Records the `drawCount` VkDrawIndexedIndirectCommands at the start of
+// `buffer`, as many per vkCmdDrawIndexedIndirect as `maxDrawCount` (from
+// maxIndirectDrawCount()) allows
+inline void drawIndexedIndirectBatched(VkCommandBuffer commandBuffer,
+                                       VkBuffer buffer,
+                                       uint32_t drawCount,
+                                       uint32_t maxDrawCount) {
+  const uint32_t batch = std::max(1u, maxDrawCount);
+  for (uint32_t first = 0; first < drawCount; first += batch) {
+    vkCmdDrawIndexedIndirect(commandBuffer, buffer,
+                             first * sizeof(VkDrawIndexedIndirectCommand),
+                             std::min(batch, drawCount - first),
+                             sizeof(VkDrawIndexedIndirectCommand));
+  }
+}
+
+// Creates `buffer` and binds it to memory from `allocator`
+inline void createBuffer(VkDevice device,
+                         DeviceMemoryAllocator& allocator,
+                         VkDeviceSize size,
+                         VkBufferUsageFlags usage,
+                         VkMemoryPropertyFlags properties,
+                         VkBuffer& buffer,
+                         Allocation& memory) {
+  VkBufferCreateInfo bufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                .size = size,
+                                .usage = usage,
+                                .sharingMode = VK_SHARING_MODE_EXCLUSIVE};
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer");
+  }
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, buffer, &requirements);
+  memory = allocator.allocate(requirements, properties, AllocationKind::Linear);
+  vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+// Undoes createBuffer() and resets both handles
+inline void destroyBuffer(VkDevice device,
+                          DeviceMemoryAllocator& allocator,
+                          VkBuffer& buffer,
+                          Allocation& memory) {
+  vkDestroyBuffer(device, buffer, nullptr);
+  allocator.free(memory);
+  buffer = VK_NULL_HANDLE;
+  memory = {};
+}
+
+// A compute pipeline running the `main` of the SPIR-V at `shaderPath`. The
+// shader module only lives for the call.
+inline VkPipeline createComputePipeline(VkDevice device,
+                                        VkPipelineCache pipelineCache,
+                                        VkPipelineLayout layout,
+                                        const std::string& shaderPath) {
+  auto code = readFile(shaderPath);
+  VkShaderModuleCreateInfo moduleInfo{
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = code.size(),
+      .pCode = reinterpret_cast<const uint32_t*>(code.data())};
+  VkShaderModule module;
+  if (vkCreateShaderModule(device, &moduleInfo, nullptr, &module) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create shader module");
+  }
+  VkComputePipelineCreateInfo pipelineInfo{
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage{.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+             .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+             .module = module,
+             .pName = "main"},
+      .layout = layout};
+  VkPipeline pipeline;
+  VkResult result = vkCreateComputePipelines(device, pipelineCache, 1,
+                                             &pipelineInfo, nullptr, &pipeline);
+  vkDestroyShaderModule(device, module, nullptr);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create compute pipeline: " +
+                             shaderPath);
+  }
+  return pipeline;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+
+// A run of triangles that has to be drawn on its own: its indices are
+// relative to vertexOffset
+struct IndexChunk {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  int32_t vertexOffset;
+};
+
+// An index buffer ready for upload, in the narrowest type that works
+struct PackedIndices {
+  VkIndexType type = VK_INDEX_TYPE_UINT32;
+  std::vector<std::byte> data;
+  // cover every index, in order
+  std::vector<IndexChunk> chunks;
+
+  uint32_t indexSize() const {
+    return type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+  }
+};
+
+// 16-bit chunks smaller than this on average aren't worth the extra draws
+inline constexpr size_t MIN_AVERAGE_CHUNK_TRIANGLES = 1024;
+
+// Splits the triangles of `indices` into runs whose vertices each fit in a
+// 16-bit range. Meshes ordered by mesh::optimizeVertexFetch() use vertices
+// roughly in order, so the runs come out long. Nothing, if a triangle on its
+// own spans more than that range.
+inline std::optional<std::vector<IndexChunk>> splitInto16BitChunks(
+    std::span<const uint32_t> indices) {
+  static constexpr uint32_t RANGE = std::numeric_limits<uint16_t>::max();
+  std::vector<IndexChunk> chunks;
+  size_t begin = 0;
+  uint32_t lo = std::numeric_limits<uint32_t>::max(), hi = 0;
+  for (size_t i = 0; i + 3 <= indices.size(); i += 3) {
+    const auto [triangleLo, triangleHi] =
+        std::minmax({indices[i], indices[i + 1], indices[i + 2]});
+    if (triangleHi - triangleLo > RANGE) {
+      return std::nullopt;
+    }
+    const uint32_t newLo = std::min(lo, triangleLo);
+    const uint32_t newHi = std::max(hi, triangleHi);
+    if (newHi - newLo > RANGE && i > begin) {
+      chunks.push_back({.firstIndex = static_cast<uint32_t>(begin),
+                        .indexCount = static_cast<uint32_t>(i - begin),
+                        .vertexOffset = static_cast<int32_t>(lo)});
+      begin = i;
+      lo = triangleLo;
+      hi = triangleHi;
+    } else {
+      lo = newLo;
+      hi = newHi;
+    }
+  }
+  if (begin < indices.size()) {
+    const size_t count = indices.size() - begin;
+    chunks.push_back({.firstIndex = static_cast<uint32_t>(begin),
+                      .indexCount = static_cast<uint32_t>(count),
+                      .vertexOffset = static_cast<int32_t>(lo)});
+  }
+  return chunks;
+}
+
+// Picks 16-bit indices when the mesh has few enough vertices, or when it
+// splits into few enough 16-bit chunks, and 32-bit indices otherwise (or
+// when `allow16` is false, or a single triangle is too wide for 16 bits)
+inline PackedIndices packIndices(std::span<const uint32_t> indices,
+                                 size_t vertexCount,
+                                 bool allow16 = true) {
+  PackedIndices packed;
+  const size_t triangles = indices.size() / 3;
+  if (allow16 && !indices.empty()) {
+    std::optional<std::vector<IndexChunk>> chunks;
+    if (vertexCount <= size_t{std::numeric_limits<uint16_t>::max()} + 1) {
+      chunks = std::vector<IndexChunk>{
+          {.firstIndex = 0,
+           .indexCount = static_cast<uint32_t>(indices.size()),
+           .vertexOffset = 0}};
+    } else {
+      chunks = splitInto16BitChunks(indices);
+    }
+    if (chunks && (chunks->size() == 1 || triangles / chunks->size() >=
+                                              MIN_AVERAGE_CHUNK_TRIANGLES)) {
+      packed.type = VK_INDEX_TYPE_UINT16;
+      packed.data.resize(indices.size() * sizeof(uint16_t));
+      auto* out = reinterpret_cast<uint16_t*>(packed.data.data());
+      for (const IndexChunk& chunk : *chunks) {
+        for (uint32_t i = chunk.firstIndex;
+             i < chunk.firstIndex + chunk.indexCount; ++i) {
+          out[i] = static_cast<uint16_t>(indices[i] - chunk.vertexOffset);
+        }
+      }
+      packed.chunks = std::move(*chunks);
+      return packed;
+    }
+  }
+
+  auto bytes = std::as_bytes(indices);
+  packed.data.assign(bytes.begin(), bytes.end());
+  packed.chunks = {{.firstIndex = 0,
+                    .indexCount = static_cast<uint32_t>(indices.size()),
+                    .vertexOffset = 0}};
+  return packed;
+}
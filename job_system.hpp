@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_trace.hpp"
+
+// Work-stealing job scheduler.
+//
+//   auto decode = jobs.spawn([&] { image = decode(png); });
+//   auto parse = jobs.spawn([&] { mesh = parse(obj); });
+//   auto upload = jobs.spawn([&] { upload(image, mesh); }, {decode, parse});
+//   jobs.wait(upload);
+//
+// Each worker owns a deque: jobs spawned from a worker go to the back of its
+// own deque, which it pops from the back (newest first, while their data is
+// still in cache). Idle workers steal from the front of the others' deques,
+// taking the oldest jobs, which tend to be the biggest. Jobs spawned from
+// other threads are dealt out round-robin.
+//
+// A job with dependencies is queued once all of them have finished. wait()
+// runs other jobs until the awaited one is done rather than blocking, so it
+// can be called from inside a job too. An exception thrown by a job is
+// rethrown by wait(). A job whose dependency threw never runs: it fails with
+// the same exception, and so do its own dependents.
+class JobSystem {
+ public:
+  struct Job;
+  using Handle = std::shared_ptr<Job>;
+
+  struct Job {
+    std::function<void()> fn;
+    // unfinished dependencies, plus one while spawn() is still adding them
+    std::atomic<uint32_t> blockers{1};
+    std::atomic<bool> done{false};
+    // thrown by the job, or by a dependency, in which case it doesn't run
+    std::exception_ptr error;
+
+    // guards `finished` and `dependents`, and `error` until the job runs
+    std::mutex mutex;
+    bool finished = false;
+    std::vector<Handle> dependents;
+  };
+
+  // Workers plus the thread calling wait() cover every hardware thread
+  static unsigned defaultWorkerCount() {
+    return std::max(1u, std::thread::hardware_concurrency()) - 1;
+  }
+
+  explicit JobSystem(unsigned workerCount = defaultWorkerCount()) {
+    workerCount = std::max(workerCount, 1u);
+    for (unsigned i = 0; i < workerCount; ++i) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < workerCount; ++i) {
+      workers.emplace_back([this, i] { workerLoop(i); });
+    }
+  }
+
+  ~JobSystem() {
+    {
+      std::lock_guard lock(sleepMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  // Process-wide instance with the default number of workers
+  static JobSystem& shared() {
+    static JobSystem instance;
+    return instance;
+  }
+
+  unsigned workerCount() const { return static_cast<unsigned>(workers.size()); }
+
+  // Threads that run jobs while someone waits: the workers and the waiter
+  unsigned concurrency() const { return workerCount() + 1; }
+
+  Handle spawn(std::function<void()> fn,
+               std::span<const Handle> dependencies = {}) {
+    auto job = std::make_shared<Job>();
+    job->fn = std::move(fn);
+    for (const Handle& dependency : dependencies) {
+      std::exception_ptr failed;
+      {
+        std::lock_guard lock(dependency->mutex);
+        if (!dependency->finished) {
+          job->blockers.fetch_add(1, std::memory_order_relaxed);
+          dependency->dependents.push_back(job);
+        } else {
+          failed = dependency->error;
+        }
+      }
+      if (failed) {
+        fail(job, failed);
+      }
+    }
+    unblock(job);
+    return job;
+  }
+
+  Handle spawn(std::function<void()> fn,
+               std::initializer_list<Handle> dependencies) {
+    return spawn(std::move(fn),
+                 std::span<const Handle>(dependencies.begin(),
+                                         dependencies.size()));
+  }
+
+  void wait(const Handle& job) {
+    while (!job->done.load(std::memory_order_acquire)) {
+      if (!runOne()) {
+        std::this_thread::yield();
+      }
+    }
+    if (job->error) {
+      std::rethrow_exception(job->error);
+    }
+  }
+
+  // Waits for all of `jobs`, then rethrows the first exception, if any
+  void wait(std::span<const Handle> jobs) {
+    std::exception_ptr error;
+    for (const Handle& job : jobs) {
+      try {
+        wait(job);
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Calls fn(begin, end) over [0, count) in chunks of `grain` items, on the
+  // calling thread and as many workers as there are chunks for. Chunks are
+  // handed out one at a time, so uneven chunks still balance out.
+  template <typename Fn>
+  void parallelFor(size_t count, size_t grain, Fn&& fn) {
+    grain = std::max<size_t>(grain, 1);
+    const size_t chunks = (count + grain - 1) / grain;
+    std::atomic<size_t> next{0};
+    auto run = [&] {
+      try {
+        for (size_t chunk; (chunk = next.fetch_add(
+                                1, std::memory_order_relaxed)) < chunks;) {
+          fn(chunk * grain, std::min(count, (chunk + 1) * grain));
+        }
+      } catch (...) {
+        // leave the remaining chunks alone
+        next.store(chunks, std::memory_order_relaxed);
+        throw;
+      }
+    };
+
+    std::vector<Handle> helpers;
+    const size_t helperCount =
+        std::min<size_t>(chunks > 0 ? chunks - 1 : 0, workerCount());
+    for (size_t i = 0; i < helperCount; ++i) {
+      helpers.push_back(spawn(run));
+    }
+
+    std::exception_ptr error;
+    try {
+      run();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // the helpers reference this frame, so they must finish either way
+    try {
+      wait(helpers);
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+ private:
+  static constexpr unsigned NO_WORKER = ~0u;
+  // attempts to find a job before a worker goes to sleep
+  static constexpr int SPIN_COUNT = 64;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Handle> jobs;
+  };
+
+  // which system and worker the calling thread belongs to, if any
+  static inline thread_local const JobSystem* currentSystem = nullptr;
+  static inline thread_local unsigned currentWorker = NO_WORKER;
+
+  unsigned self() const {
+    return currentSystem == this ? currentWorker : NO_WORKER;
+  }
+
+  // Marks `job` as failed by a dependency's `error`, before it's unblocked,
+  // unless another dependency got there first
+  static void fail(const Handle& job, const std::exception_ptr& error) {
+    std::lock_guard lock(job->mutex);
+    if (!job->error) {
+      job->error = error;
+    }
+  }
+
+  void unblock(const Handle& job) {
+    if (job->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      enqueue(job);
+    }
+  }
+
+  void enqueue(Handle job) {
+    unsigned target = self();
+    if (target == NO_WORKER) {
+      target = nextQueue.fetch_add(1, std::memory_order_relaxed) %
+               queues.size();
+    }
+    // counted before it's visible, so `queued` never underflows
+    queued.fetch_add(1);
+    {
+      std::lock_guard lock(queues[target]->mutex);
+      queues[target]->jobs.push_back(std::move(job));
+    }
+    if (sleeping.load() > 0) {
+      // pairs with the check in workerLoop(): either the worker saw the job
+      // before sleeping, or it's asleep and gets this notification
+      { std::lock_guard lock(sleepMutex); }
+      wake.notify_one();
+    }
+  }
+
+  Handle pop(unsigned worker) {
+    auto& queue = *queues[worker];
+    std::lock_guard lock(queue.mutex);
+    if (queue.jobs.empty()) {
+      return nullptr;
+    }
+    Handle job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+  }
+
+  Handle steal(unsigned victim) {
+    auto& queue = *queues[victim];
+    std::unique_lock lock(queue.mutex, std::try_to_lock);
+    if (!lock || queue.jobs.empty()) {
+      return nullptr;
+    }
+    Handle job = std::move(queue.jobs.front());
+    queue.jobs.pop_front();
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+  }
+
+  Handle next() {
+    const unsigned worker = self();
+    if (worker != NO_WORKER) {
+      if (Handle job = pop(worker)) {
+        return job;
+      }
+    }
+    const unsigned count = static_cast<unsigned>(queues.size());
+    const unsigned start = worker != NO_WORKER
+                               ? worker + 1
+                               : nextVictim.fetch_add(1, std::memory_order_relaxed);
+    for (unsigned i = 0; i < count; ++i) {
+      const unsigned victim = (start + i) % count;
+      if (victim == worker) {
+        continue;
+      }
+      if (Handle job = steal(victim)) {
+        return job;
+      }
+    }
+    return nullptr;
+  }
+
+  bool runOne() {
+    Handle job = next();
+    if (!job) {
+      return false;
+    }
+    execute(job);
+    return true;
+  }
+
+  void execute(const Handle& job) {
+    // set by fail() before the last unblock(), so no lock is needed here
+    if (!job->error) {
+      try {
+        job->fn();
+      } catch (...) {
+        job->error = std::current_exception();
+      }
+    }
+    // release whatever the job captured
+    job->fn = nullptr;
+
+    std::vector<Handle> dependents;
+    {
+      std::lock_guard lock(job->mutex);
+      job->finished = true;
+      dependents.swap(job->dependents);
+    }
+    job->done.store(true, std::memory_order_release);
+    for (const Handle& dependent : dependents) {
+      // their input was never produced
+      if (job->error) {
+        fail(dependent, job->error);
+      }
+      unblock(dependent);
+    }
+  }
+
+  void workerLoop(unsigned worker) {
+    currentSystem = this;
+    currentWorker = worker;
+    trace::setThreadName("worker " + std::to_string(worker));
+
+    int idle = 0;
+    while (true) {
+      if (runOne()) {
+        idle = 0;
+        continue;
+      }
+      if (++idle < SPIN_COUNT) {
+        std::this_thread::yield();
+        continue;
+      }
+      idle = 0;
+
+      std::unique_lock lock(sleepMutex);
+      sleeping.fetch_add(1);
+      wake.wait(lock, [&] { return stopping || queued.load() > 0; });
+      sleeping.fetch_sub(1);
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<unsigned> nextQueue{0};
+  std::atomic<unsigned> nextVictim{0};
+  // jobs sitting in a queue
+  std::atomic<size_t> queued{0};
+
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  std::atomic<unsigned> sleeping{0};
+  bool stopping = false;
+};
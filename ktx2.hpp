@@ -0,0 +1,238 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+// Minimal reader and writer for KTX2 textures: 2D, a single layer and face,
+// no supercompression. That's all the texture cooker produces.
+namespace ktx2 {
+
+inline constexpr uint8_t IDENTIFIER[12]{0xAB, 'K',  'T', 'X',  ' ',  '2',
+                                        '0',  0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(Header) == 80);
+
+struct LevelIndex {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+// Size of a texel block of the formats we know how to handle
+struct FormatInfo {
+  uint32_t blockWidth;
+  uint32_t blockHeight;
+  uint32_t blockBytes;
+};
+
+inline FormatInfo formatInfo(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+      return {1, 1, 4};
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+      return {4, 4, 16};
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+      return {4, 4, 8};
+    default:
+      throw std::runtime_error("unsupported KTX2 texture format");
+  }
+}
+
+// Data Format Descriptor for the formats the cooker writes. Required by the
+// spec even though our own loader only looks at vkFormat.
+inline std::vector<uint32_t> basicDfd(VkFormat format) {
+  constexpr uint32_t MODEL_RGBSDA = 1, MODEL_BC7 = 134;
+  constexpr uint32_t PRIMARIES_BT709 = 1;
+  constexpr uint32_t TRANSFER_LINEAR = 1;
+  constexpr uint32_t CHANNEL_ALPHA = 15;
+
+  struct Sample {
+    uint32_t bitOffset, bitLength, channel, upper;
+  };
+  uint32_t model;
+  FormatInfo info = formatInfo(format);
+  std::vector<Sample> samples;
+  switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+      model = MODEL_RGBSDA;
+      samples = {{0, 8, 0, 255},
+                 {8, 8, 1, 255},
+                 {16, 8, 2, 255},
+                 {24, 8, CHANNEL_ALPHA, 255}};
+      break;
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+      model = MODEL_BC7;
+      samples = {{0, 128, 0, UINT32_MAX}};
+      break;
+    default:
+      throw std::runtime_error("no data format descriptor for format");
+  }
+
+  const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+  std::vector<uint32_t> dfd{
+      4 + blockSize,     // dfdTotalSize
+      0,                 // vendorId = Khronos, descriptorType = basic
+      2 | blockSize << 16,  // versionNumber, descriptorBlockSize
+      model | PRIMARIES_BT709 << 8 | TRANSFER_LINEAR << 16,
+      (info.blockWidth - 1) | (info.blockHeight - 1) << 8,
+      info.blockBytes,  // bytesPlane0
+      0};
+  for (const auto& sample : samples) {
+    dfd.push_back(sample.bitOffset | (sample.bitLength - 1) << 16 |
+                  sample.channel << 24);
+    dfd.push_back(0);  // sample position
+    dfd.push_back(0);  // lower
+    dfd.push_back(sample.upper);
+  }
+  return dfd;
+}
+
+// `levels` holds the data of each mip level, base level first
+inline void write(const std::string& path,
+                  VkFormat format,
+                  uint32_t width,
+                  uint32_t height,
+                  const std::vector<std::vector<std::byte>>& levels) {
+  const FormatInfo info = formatInfo(format);
+  const auto dfd = basicDfd(format);
+  const uint32_t levelCount = static_cast<uint32_t>(levels.size());
+
+  Header header{.vkFormat = static_cast<uint32_t>(format),
+                .typeSize = 1,
+                .pixelWidth = width,
+                .pixelHeight = height,
+                .pixelDepth = 0,
+                .layerCount = 0,
+                .faceCount = 1,
+                .levelCount = levelCount,
+                .supercompressionScheme = 0};
+  memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+  header.dfdByteOffset =
+      static_cast<uint32_t>(sizeof(Header) + levelCount * sizeof(LevelIndex));
+  header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+  // mip data is stored smallest level first, each aligned to the block size
+  std::vector<LevelIndex> index(levelCount);
+  uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+  for (uint32_t level = levelCount; level-- > 0;) {
+    offset = (offset + info.blockBytes - 1) / info.blockBytes * info.blockBytes;
+    index[level] = {.byteOffset = offset,
+                    .byteLength = levels[level].size(),
+                    .uncompressedByteLength = levels[level].size()};
+    offset += levels[level].size();
+  }
+
+  const bool written = writeFileAtomically(path, [&](std::ofstream& out) {
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(index.data()),
+              index.size() * sizeof(LevelIndex));
+    out.write(reinterpret_cast<const char*>(dfd.data()), header.dfdByteLength);
+    for (uint32_t level = levelCount; level-- > 0;) {
+      out.seekp(static_cast<std::streamoff>(index[level].byteOffset));
+      out.write(reinterpret_cast<const char*>(levels[level].data()),
+                levels[level].size());
+    }
+  });
+  if (!written) {
+    throw std::runtime_error("unable to write " + path);
+  }
+}
+
+// A memory-mapped KTX2 file
+class File {
+ public:
+  explicit File(const std::string& path) : file(path) {
+    auto bytes = file.bytes();
+    if (bytes.size() < sizeof(Header)) {
+      throw std::runtime_error("truncated KTX2 file");
+    }
+    memcpy(&header, bytes.data(), sizeof(Header));
+    if (memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0) {
+      throw std::runtime_error("not a KTX2 file");
+    }
+    if (header.supercompressionScheme != 0 || header.pixelDepth > 1 ||
+        header.layerCount > 1 || header.faceCount != 1) {
+      throw std::runtime_error("unsupported KTX2 layout");
+    }
+
+    info = formatInfo(format());
+    levels.resize(std::max(header.levelCount, 1u));
+    if (sizeof(Header) + levels.size() * sizeof(LevelIndex) > bytes.size()) {
+      throw std::runtime_error("truncated KTX2 file");
+    }
+    memcpy(levels.data(), bytes.data() + sizeof(Header),
+           levels.size() * sizeof(LevelIndex));
+    for (const auto& level : levels) {
+      if (level.byteOffset + level.byteLength > bytes.size()) {
+        throw std::runtime_error("truncated KTX2 file");
+      }
+    }
+  }
+
+  VkFormat format() const { return static_cast<VkFormat>(header.vkFormat); }
+  uint32_t width() const { return header.pixelWidth; }
+  uint32_t height() const { return header.pixelHeight; }
+  uint32_t levelCount() const { return static_cast<uint32_t>(levels.size()); }
+  const FormatInfo& blockInfo() const { return info; }
+
+  VkExtent2D levelExtent(uint32_t level) const {
+    return {std::max(width() >> level, 1u), std::max(height() >> level, 1u)};
+  }
+
+  // bytes per row of texel blocks
+  VkDeviceSize levelRowPitch(uint32_t level) const {
+    const uint32_t blocksWide =
+        (levelExtent(level).width + info.blockWidth - 1) / info.blockWidth;
+    return static_cast<VkDeviceSize>(blocksWide) * info.blockBytes;
+  }
+
+  std::span<const std::byte> levelData(uint32_t level) const {
+    return file.bytes().subspan(levels[level].byteOffset,
+                                levels[level].byteLength);
+  }
+
+ private:
+  MappedFile file;
+  Header header;
+  FormatInfo info;
+  std::vector<LevelIndex> levels;
+};
+
+}  // namespace ktx2
@@ -9,53 +9,107 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
-
 #include <algorithm>
 #include <chrono>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <set>
+#include <sstream>
 #include <span>
 #include <stdexcept>
-
+#include <utility>
+
+#include "command_cache.hpp"
+#include "cpu_trace.hpp"
+#include "descriptor_allocator.hpp"
+#include "draw_culler.hpp"
+#include "gpu_profiler.hpp"
+#include "index_packing.hpp"
+#include "job_system.hpp"
+#include "ktx2.hpp"
+#include "memory_allocator.hpp"
+#include "mesh_cache.hpp"
+#include "meshlet_renderer.hpp"
+#include "mip_chain.hpp"
+#include "mip_generator.hpp"
+#include "options.hpp"
+#include "parallel_recorder.hpp"
+#include "pipeline_cache.hpp"
+#include "texture_table.hpp"
 #include "types.hpp"
+#include "uniform_ring.hpp"
+#include "upload_service.hpp"
 #include "utils.hpp"
+#include "vertex_packing.hpp"
 
 class HelloTriangleApplication {
  public:
+  explicit HelloTriangleApplication(const Options& options)
+      : options(options) {}
+
   void run() {
+    if (!options.tracePath.empty()) {
+      trace::setEnabled(true);
+      trace::setThreadName("main");
+    }
+
     initWindow();
     initVulkan();
+    if (options.recordBenchmark) {
+      benchmarkRecording();
+    }
+    if (options.mipBenchmark) {
+      benchmarkMipmaps();
+    }
+    if (options.instanceBenchmark) {
+      benchmarkInstances();
+    }
     mainLoop();
     cleanup();
+
+    if (!options.tracePath.empty()) {
+      writeTrace(options.tracePath);
+    }
   }
 
  private:
-  const uint32_t WIDTH = 800;
-  const uint32_t HEIGHT = 600;
+  const Options options;
 
   static constexpr char MODEL_PATH[]{"resources/viking_room.obj"};
   static constexpr char TEXTURE_PATH[]{"resources/viking_room.png"};
+  // Variants of the texture written by tools/texture_cooker.cpp, in order of
+  // preference. Any that exist and are supported beat decoding TEXTURE_PATH.
+  static constexpr char COOKED_TEXTURE_BASE[]{"resources/viking_room"};
+  static constexpr std::pair<VkFormat, const char*> COOKED_TEXTURE_FORMATS[]{
+      {VK_FORMAT_BC7_UNORM_BLOCK, ".bc7.ktx2"},
+      {VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, ".etc2.ktx2"},
+      {VK_FORMAT_ASTC_4x4_UNORM_BLOCK, ".astc.ktx2"},
+      {VK_FORMAT_R8G8B8A8_UNORM, ".rgba8.ktx2"}};
 
   // The number of frames that we can draw to at the same time.
   static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
 
   static constexpr char VERT_SHADER_SPV[]{"shaders/triangle_app_vert.spv"};
   static constexpr char FRAG_SHADER_SPV[]{"shaders/triangle_app_frag.spv"};
+  static constexpr char BINDLESS_FRAG_SHADER_SPV[]{"shaders/bindless_frag.spv"};
+  static constexpr char DOWNSAMPLE_SHADER_SPV[]{"shaders/downsample_comp.spv"};
+  static constexpr char MESHLET_TASK_SHADER_SPV[]{"shaders/meshlet_task.spv"};
+  static constexpr char MESHLET_MESH_SHADER_SPV[]{"shaders/meshlet_mesh.spv"};
+  static constexpr char MESHLET_CULL_SHADER_SPV[]{
+      "shaders/meshlet_cull_comp.spv"};
+  static constexpr char DRAW_CULL_SHADER_SPV[]{"shaders/draw_cull_comp.spv"};
+  static constexpr char PIPELINE_CACHE_PATH[]{"pipeline_cache.bin"};
 
   const std::vector<const char*> validationLayers{
       "VK_LAYER_KHRONOS_validation"};
 
-  const std::vector<const char*> deviceExtensions{
-      VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-#if defined(__APPLE__) && defined(__arm64__)
-      "VK_KHR_portability_subset"
-#endif
-  };
+  // Offscreen colour targets used instead of swap chain images in headless
+  // mode, one per frame in flight. The swapChain* members describe them.
+  static constexpr VkFormat OFFSCREEN_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
 
 #if NDEBUG
   const bool enableValidationLayers = false;
@@ -65,12 +119,15 @@ class HelloTriangleApplication {
 
   GLFWwindow* window;
   VkInstance instance;
+  // the API version the instance was created for
+  uint32_t instanceVersion = VK_API_VERSION_1_0;
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
-  VkSurfaceKHR surface;
-  VkSwapchainKHR swapChain;
+  VkQueue transferQueue;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
   std::vector<VkImage> swapChainImages;
   std::vector<VkImageView> swapChainImageViews;
   VkFormat swapChainImageFormat;
@@ -79,9 +136,12 @@ class HelloTriangleApplication {
   VkDescriptorSetLayout descriptorSetLayout;
   VkPipelineLayout pipelineLayout;
   VkPipeline graphicsPipeline;
+  PipelineCache pipelineCache;
   VkCommandPool commandPool;
-  VkDescriptorPool descriptorPool;
-  std::vector<VkDescriptorSet> descriptorSets;
+  // every descriptor set layout and set outside the texture table
+  DescriptorAllocator descriptors;
+  // one set for every frame: the uniforms are picked by dynamic offset
+  VkDescriptorSet descriptorSet;
 
   // For each frame we want to draw to, we need a separate command buffer and
   // synchronization objects
@@ -89,11 +149,38 @@ class HelloTriangleApplication {
   std::vector<VkSemaphore> imageAvailableSemaphores;
   std::vector<VkSemaphore> renderFinishedSemaphores;
   std::vector<VkFence> inFlightFences;
+  // with --cache-commands, replaces commandBuffers
+  CommandCache commandCache;
+  // records the draw list into secondary command buffers on worker threads
+  ParallelRecorder recorder;
 
   std::vector<VkFramebuffer> swapChainFramebuffers;
 
+  DeviceMemoryAllocator allocator;
+  UploadService uploads;
+
+  // GPU timings: one profiler slot per frame in flight, plus one for work
+  // recorded into upload batches
+  GpuProfiler gpuProfiler;
+  // builds texture mip chains in one compute dispatch
+  MipGenerator mipGenerator;
+  static constexpr uint32_t UPLOAD_PROFILER_SLOT = MAX_FRAMES_IN_FLIGHT;
+
+  // Host-to-device uploads are staged through this persistently mapped ring
+  static constexpr VkDeviceSize STAGING_RING_SIZE = 32ull << 20;
+  VkBuffer stagingBuffer;
+  Allocation stagingBufferMemory;
+
   bool framebufferResized = false;
   uint32_t currentFrame = 0;
+  // number of frames submitted so far
+  uint64_t frameCount = 0;
+
+  // headless mode only: the offscreen images, and host-visible buffers each
+  // frame is copied into after rendering
+  std::vector<Allocation> offscreenImagesMemory;
+  std::vector<VkBuffer> readbackBuffers;
+  std::vector<Allocation> readbackBuffersMemory;
 
   // const std::vector<Vertex> vertices{
   //     {.pos{-0.5f, -0.5f, 0.f}, .color{1.f, 0, 0}, .texCoord{0, 1.f}},
@@ -109,37 +196,99 @@ class HelloTriangleApplication {
   // // limited to 65535 vertices
   // const std::vector<uint16_t> indices{0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4};
 
-  std::vector<Vertex> vertices;
-  std::vector<uint32_t> indices;
+  // vertices and indices, mapped straight from the mesh cache file
+  LoadedMesh model;
+  // the draw calls recorded each frame, over consecutive ranges of indices
+  std::vector<DrawCommand> drawList;
+  // PackedVertex in the vertex buffer instead of Vertex, see
+  // chooseVertexFormat()
+  bool packedVertices = false;
+  // undoes the packing in the vertex shader
+  VertexQuantization vertexQuantization;
   VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
-  VkBuffer indexBuffer;
-  VkDeviceMemory indexBufferMemory;
+  Allocation vertexBufferMemory;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  Allocation indexBufferMemory;
+  // picked per mesh by packIndices(); 16-bit meshes may come in several
+  // chunks, each drawn with its own vertex offset
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  std::vector<IndexChunk> indexChunks;
+
+  // with --meshlets: the model's meshlets, built by loadModel(), and how
+  // they're drawn, see chooseMeshletPath()
+  mesh::MeshletMesh meshlets;
+  std::optional<MeshletRenderer::Path> meshletPath;
+  MeshletRenderer meshletRenderer;
+  // with --gpu-culling: whether the device has vkCmdDrawIndexedIndirectCount,
+  // see chooseDrawCulling()
+  bool drawIndirectCount = false;
+  DrawCuller drawCuller;
+
+  // with --bindless, if the device has descriptor indexing: textures are
+  // read out of the texture table, set TEXTURE_TABLE_SET, by index instead
+  // of from binding 1 of set 0. See chooseTextureBinding().
+  bool bindless = false;
+  TextureTable textureTable;
+  static constexpr uint32_t TEXTURE_TABLE_SET = 2;
+  // stands in for the meshlets' set 1 when there are no mesh shaders
+  VkDescriptorSetLayout emptySetLayout = VK_NULL_HANDLE;
+  // the model's texture in the table
+  uint32_t textureIndex = 0;
+
+  // CPU side of the texture, filled in by decodeTexture() before the device
+  // exists: the cooked variants on disk, or else the decoded source image
+  std::vector<std::pair<VkFormat, ktx2::File>> cookedTextures;
+  struct {
+    stbi_uc* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    // whether any texel isn't fully opaque
+    bool translucent = false;
+  } sourceTexture;
 
   uint32_t mipLevels;
+  VkFormat textureFormat;
   VkImage textureImage;
-  VkDeviceMemory textureImageMemory;
+  Allocation textureImageMemory;
   VkImageView textureImageView;
   VkSampler textureSampler;
 
   // The color and depth buffers that we'll be performing the rendering into
   VkImage colorImage;
-  VkDeviceMemory colorImageMemory;
+  Allocation colorImageMemory;
   VkImageView colorImageView;
 
   VkImage depthImage;
-  VkDeviceMemory depthImageMemory;
+  Allocation depthImageMemory;
   VkImageView depthImageView;
 
-  std::vector<VkBuffer> uniformBuffers;
-  std::vector<VkDeviceMemory> uniformBuffersMemory;
-  std::vector<void*> uniformBuffersMapped;
+  // the uniforms of every frame in flight, see updateUniformBuffer()
+  UniformRing uniformRing;
+  // room for each frame's uniforms, with space to spare for per-object data
+  static constexpr VkDeviceSize UNIFORM_RING_FRAME_SIZE = 64 << 10;
+
+  // the copies of the model: where each sits on the grid, and a buffer of
+  // their transforms per frame in flight, rewritten every frame
+  std::vector<glm::vec3> instancePositions;
+  std::vector<VkBuffer> instanceBuffers;
+  std::vector<Allocation> instanceBuffersMemory;
+  // how many of them are drawn; all but during benchmarkInstances()
+  uint32_t instanceCount = 1;
+  // the radius of the sphere around the origin the model spins in
+  float modelRadius = 1.f;
+  // how much further back the camera is to see the whole grid
+  float sceneScale = 1.f;
+  // how far instances bob up and down, in model radii
+  static constexpr float INSTANCE_BOB_HEIGHT = 0.1f;
 
   VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
   struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // falls back to the graphics family if there's no separate transfer
+    // family
+    std::optional<uint32_t> transferFamily;
 
     bool isComplete() const {
       return graphicsFamily.has_value() && presentFamily.has_value();
@@ -152,46 +301,6 @@ class HelloTriangleApplication {
     std::vector<VkPresentModeKHR> presentModes;
   };
 
-  class ScopedCommandBuffer {
-   public:
-    ScopedCommandBuffer(VkDevice device, VkCommandPool pool, VkQueue queue)
-        : device(device), commandPool(pool), queue(queue) {
-      VkCommandBufferAllocateInfo allocInfo{
-          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-          .commandBufferCount = 1,
-          .commandPool = commandPool,
-          .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY};
-
-      vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-      VkCommandBufferBeginInfo beingInfo{
-          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-          .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
-
-      vkBeginCommandBuffer(commandBuffer, &beingInfo);
-    }
-    ~ScopedCommandBuffer() {
-      vkEndCommandBuffer(commandBuffer);
-
-      VkSubmitInfo submitInfo{.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                              .commandBufferCount = 1,
-                              .pCommandBuffers = &commandBuffer};
-
-      vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-      vkQueueWaitIdle(queue);
-
-      vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-    }
-
-    operator VkCommandBuffer() const noexcept { return commandBuffer; }
-
-   private:
-    VkDevice device;
-    VkCommandBuffer commandBuffer;
-    VkCommandPool commandPool;
-    VkQueue queue;
-  };
-
   static void frameBufferResizeCallback(GLFWwindow* window,
                                         int width,
                                         int height) {
@@ -201,12 +310,18 @@ class HelloTriangleApplication {
   }
 
   void initWindow() {
+    TRACE_FUNCTION();
+    if (options.headless) {
+      return;
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
     window =
-        glfwCreateWindow(WIDTH, HEIGHT, "Hello Triangle", nullptr, nullptr);
+        glfwCreateWindow(options.width, options.height, "Hello Triangle",
+                         nullptr, nullptr);
 
     glfwSetWindowUserPointer(window, this);
     glfwSetFramebufferSizeCallback(window, frameBufferResizeCallback);
@@ -231,6 +346,7 @@ class HelloTriangleApplication {
   }
 
   void createInstance() {
+    TRACE_FUNCTION();
     if (enableValidationLayers && !checkValidationLayerSupport()) {
       throw std::runtime_error(
           "Validation layers requested, but not supported");
@@ -242,7 +358,19 @@ class HelloTriangleApplication {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // mesh shaders need Vulkan 1.2 and descriptor indexing 1.1; everything
+    // else gets by with 1.0
+    if (options.meshlets || options.bindless) {
+      auto enumerateInstanceVersion =
+          reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+              vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+      // a 1.0 loader doesn't have it
+      if (enumerateInstanceVersion) {
+        enumerateInstanceVersion(&instanceVersion);
+      }
+      instanceVersion = std::min(instanceVersion, VK_API_VERSION_1_2);
+    }
+    appInfo.apiVersion = instanceVersion;
 
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -259,13 +387,16 @@ class HelloTriangleApplication {
       std::cout << ext.extensionName << "\n";
     }
 
-    uint32_t glfwExtensionCount;
     std::vector<const char*> requiredExtensions;
-    const char** glfwExtensions;
-
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-    for (int i = 0; i < glfwExtensionCount; ++i) {
-      requiredExtensions.emplace_back(glfwExtensions[i]);
+    // no surface in headless mode, so none of the WSI extensions are needed
+    if (!options.headless) {
+      uint32_t glfwExtensionCount;
+      const char** glfwExtensions;
+
+      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+      for (int i = 0; i < glfwExtensionCount; ++i) {
+        requiredExtensions.emplace_back(glfwExtensions[i]);
+      }
     }
 
 #if defined __APPLE__ && defined __arm64__
@@ -309,6 +440,7 @@ class HelloTriangleApplication {
   }
 
   void pickPhysicalDevice() {
+    TRACE_FUNCTION();
     uint32_t deviceCount;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
     if (deviceCount == 0) {
@@ -320,7 +452,7 @@ class HelloTriangleApplication {
     for (const auto& device : devices) {
       if (isDeviceSuitable(device, surface)) {
         physicalDevice = device;
-        msaaSamples = getMaxUsableSampleCount(physicalDevice);
+        msaaSamples = chooseSampleCount(physicalDevice);
         break;
       }
     }
@@ -334,8 +466,8 @@ class HelloTriangleApplication {
     auto indices = findQueueFamilies(device, surface);
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    bool swapChainAdequate = options.headless;
+    if (extensionsSupported && !options.headless) {
       auto swapChainSupport = querySwapChainSupport(device, surface);
       swapChainAdequate = !(swapChainSupport.formats.empty() ||
                             swapChainSupport.presentModes.empty());
@@ -356,6 +488,7 @@ class HelloTriangleApplication {
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                          extensions.data());
 
+    auto deviceExtensions = requiredDeviceExtensions();
     std::set<std::string> requiredExtensions(deviceExtensions.begin(),
                                              deviceExtensions.end());
 
@@ -367,6 +500,17 @@ class HelloTriangleApplication {
     return requiredExtensions.empty();
   }
 
+  std::vector<const char*> requiredDeviceExtensions() const {
+    std::vector<const char*> extensions;
+    if (!options.headless) {
+      extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+#if defined(__APPLE__) && defined(__arm64__)
+    extensions.push_back("VK_KHR_portability_subset");
+#endif
+    return extensions;
+  }
+
   VkSurfaceFormatKHR chooseSwapSurfaceFormat(
       std::span<VkSurfaceFormatKHR const> formats) {
     // Prefer 32-bit SRGB, otherwise just return the first format available
@@ -434,6 +578,21 @@ class HelloTriangleApplication {
     return VK_SAMPLE_COUNT_1_BIT;
   }
 
+  // The sample count asked for on the command line, if the device supports
+  // it, otherwise the highest it does
+  VkSampleCountFlagBits chooseSampleCount(VkPhysicalDevice physicalDevice) {
+    auto maxSamples = getMaxUsableSampleCount(physicalDevice);
+    if (options.msaa == 0) {
+      return maxSamples;
+    }
+    if (options.msaa > maxSamples) {
+      std::cout << options.msaa << "x MSAA is not supported, using "
+                << maxSamples << "x\n";
+      return maxSamples;
+    }
+    return static_cast<VkSampleCountFlagBits>(options.msaa);
+  }
+
   static QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
                                               VkSurfaceKHR surface) {
     QueueFamilyIndices indices;
@@ -450,7 +609,13 @@ class HelloTriangleApplication {
       }
 
       VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      if (surface != VK_NULL_HANDLE) {
+        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                             &presentSupport);
+      } else {
+        // nothing is presented without a surface (headless mode)
+        presentSupport = indices.graphicsFamily == static_cast<uint32_t>(i);
+      }
 
       if (presentSupport) {
         indices.presentFamily = i;
@@ -461,6 +626,24 @@ class HelloTriangleApplication {
       }
     }
 
+    // Prefer a transfer-only family (usually a DMA engine), then anything
+    // that can transfer without graphics. Graphics queues can always
+    // transfer.
+    indices.transferFamily = indices.graphicsFamily;
+    int bestScore = 0;
+    for (int i = 0; i < queueFamilies.size(); ++i) {
+      const auto flags = queueFamilies[i].queueFlags;
+      if (!hasFlags(flags, VK_QUEUE_TRANSFER_BIT) ||
+          hasFlags(flags, VK_QUEUE_GRAPHICS_BIT)) {
+        continue;
+      }
+      int score = hasFlags(flags, VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+      if (score > bestScore) {
+        bestScore = score;
+        indices.transferFamily = i;
+      }
+    }
+
     return indices;
   }
 
@@ -492,13 +675,28 @@ class HelloTriangleApplication {
   }
 
   void createLogicalDevice() {
+    TRACE_FUNCTION();
     auto indices = findQueueFamilies(physicalDevice, surface);
 
-    VkPhysicalDeviceFeatures deviceFeatures{.samplerAnisotropy = VK_TRUE};
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    // the compressed formats are only used when these are supported, see
+    // loadCookedTexture()
+    VkPhysicalDeviceFeatures deviceFeatures{
+        // lets the indirect draws go in one call, see MeshletRenderer and
+        // DrawCuller
+        .multiDrawIndirect = (meshletPath.has_value() || options.gpuCulling) &&
+                             supportedFeatures.multiDrawIndirect,
+        .samplerAnisotropy = VK_TRUE,
+        .textureCompressionETC2 = supportedFeatures.textureCompressionETC2,
+        .textureCompressionASTC_LDR =
+            supportedFeatures.textureCompressionASTC_LDR,
+        .textureCompressionBC = supportedFeatures.textureCompressionBC};
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies{indices.graphicsFamily.value(),
-                                           indices.presentFamily.value()};
+                                           indices.presentFamily.value(),
+                                           indices.transferFamily.value()};
     float queuePriority = 1.f;
     for (auto queueFamily : uniqueQueueFamilies) {
       VkDeviceQueueCreateInfo queueCreateInfo{};
@@ -517,6 +715,24 @@ class HelloTriangleApplication {
 
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+    auto deviceExtensions = requiredDeviceExtensions();
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+        .taskShader = VK_TRUE,
+        .meshShader = VK_TRUE};
+    if (meshletPath == MeshletRenderer::Path::MESH_SHADER) {
+      deviceExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+      deviceCreateInfo.pNext = &meshShaderFeatures;
+    }
+    if (drawIndirectCount) {
+      deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+    auto indexingFeatures = TextureTable::requiredFeatures();
+    if (bindless) {
+      deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+      indexingFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+      deviceCreateInfo.pNext = &indexingFeatures;
+    }
     deviceCreateInfo.enabledExtensionCount =
         static_cast<uint32_t>(deviceExtensions.size());
     deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
@@ -528,9 +744,16 @@ class HelloTriangleApplication {
 
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    vkGetDeviceQueue(device, indices.transferFamily.value(), 0,
+                     &transferQueue);
   }
 
   void createSurface() {
+    TRACE_FUNCTION();
+    if (options.headless) {
+      return;
+    }
+
     if (glfwCreateWindowSurface(instance, window, nullptr, &surface) !=
         VK_SUCCESS) {
       throw std::runtime_error("failed to create window surface");
@@ -541,7 +764,7 @@ class HelloTriangleApplication {
                     VkBufferUsageFlags usage,
                     VkMemoryPropertyFlags properties,
                     VkBuffer& buffer,
-                    VkDeviceMemory& memory) const {
+                    Allocation& memory) {
     VkBufferCreateInfo bufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
                                   .size = size,
                                   .usage = usage,
@@ -554,17 +777,10 @@ class HelloTriangleApplication {
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex =
-            findMemoryType(memRequirements.memoryTypeBits, properties)};
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
-      throw std::runtime_error("failed to allocate vertex buffer memory");
-    }
+    memory =
+        allocator.allocate(memRequirements, properties, AllocationKind::Linear);
 
-    vkBindBufferMemory(device, buffer, memory, 0);
+    vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
   }
 
   void createImage(uint32_t width,
@@ -576,7 +792,7 @@ class HelloTriangleApplication {
                    VkImageUsageFlags usage,
                    VkMemoryPropertyFlags properties,
                    VkImage& image,
-                   VkDeviceMemory& memory) {
+                   Allocation& memory) {
     VkImageCreateInfo imageInfo{.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
                                 .imageType = VK_IMAGE_TYPE_2D,
                                 .extent.width = static_cast<uint32_t>(width),
@@ -598,126 +814,344 @@ class HelloTriangleApplication {
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex =
-            findMemoryType(memRequirements.memoryTypeBits, properties)};
+    memory = allocator.allocate(memRequirements, properties,
+                                tiling == VK_IMAGE_TILING_OPTIMAL
+                                    ? AllocationKind::Optimal
+                                    : AllocationKind::Linear);
 
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
-      throw std::runtime_error("failed to allocate image memory");
+    vkBindImageMemory(device, image, memory.memory, memory.offset);
+  }
+
+  // Steps that don't depend on each other run as jobs alongside the rest:
+  // - loadModel() and decodeTexture() only read files, so they start before
+  //   there is a device, and are waited for right before their uploads
+  // - createGraphicsPipeline() starts once the render pass and descriptor
+  //   set layout exist, and is waited for at the end
+  // Everything else stays on this thread, in order.
+  void initVulkan() {
+    TRACE_FUNCTION();
+    auto start = std::chrono::steady_clock::now();
+    auto& jobs = JobSystem::shared();
+    std::vector<JobSystem::Handle> pending;
+    // runs `fn` as a job, or to completion first with --serial-startup
+    auto startupJob = [&](void (HelloTriangleApplication::*fn)()) {
+      auto job = jobs.spawn([this, fn] { (this->*fn)(); });
+      pending.push_back(job);
+      if (options.serialStartup) {
+        jobs.wait(job);
+      }
+      return job;
+    };
+
+    try {
+      auto model = startupJob(&HelloTriangleApplication::loadModel);
+      auto texture = startupJob(&HelloTriangleApplication::decodeTexture);
+
+      createInstance();
+      createSurface();
+      pickPhysicalDevice();
+      chooseMeshletPath();
+      chooseDrawCulling();
+      chooseTextureBinding();
+      createLogicalDevice();
+      createAllocator();
+      createDescriptorAllocator();
+      createUploadService();
+      createPipelineCache();
+      createGpuProfiler();
+      createMipGenerator();
+      chooseVertexFormat();
+      if (options.headless) {
+        createOffscreenTargets();
+      } else {
+        createSwapChain();
+      }
+      createImageViews();
+      createRenderPass();
+
+      createDescriptorSetLayout();
+      createMeshletRenderer();
+      createDrawCuller();
+      createTextureTable();
+
+      // only needs the device, the render pass and the set layouts
+      auto pipeline =
+          startupJob(&HelloTriangleApplication::createGraphicsPipeline);
+      createCommandPool();
+      createCommandBuffers();
+
+      // TODO: DRY - duplicated in recreateSwapChain
+      createColorResources();
+      createDepthResources();
+      createFramebuffers();
+      createCommandCache();
+      createRecorder();
+
+      jobs.wait(texture);
+      createTextureImage();
+      createTextureImageView();
+      createTextureSampler();
+
+      jobs.wait(model);
+      createVertexBuffer();
+      createIndexBuffer();
+      uploadMeshlets();
+      buildDrawList();
+      uploadDrawList();
+      createInstanceBuffers();
+      createUniformBuffers();
+
+      createDescriptorSets();
+
+      createSyncObjects();
+
+      jobs.wait(pipeline);
+    } catch (...) {
+      // the jobs reference this object, so they must finish either way
+      for (const auto& job : pending) {
+        try {
+          jobs.wait(job);
+        } catch (...) {
+        }
+      }
+      throw;
+    }
+
+    // kick off the uploads recorded above. The first frame is ordered behind
+    // them on the graphics queue, so there's no need to wait here.
+    {
+      TRACE_SCOPE("flush uploads");
+      uploads.flush();
     }
 
-    vkBindImageMemory(device, image, memory, 0);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "initialized Vulkan in " << elapsed.count() << " ms ("
+              << (options.serialStartup ? "serial" : "parallel")
+              << " startup)\n";
+
+    allocator.printStats(std::cout);
+    printStagingStats();
   }
 
-  void initVulkan() {
-    createInstance();
-    createSurface();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
+  void createAllocator() {
+    TRACE_FUNCTION();
+    allocator.init(physicalDevice, device);
+  }
 
-    createDescriptorSetLayout();
+  void createDescriptorAllocator() {
+    TRACE_FUNCTION();
+    descriptors.init(device, MAX_FRAMES_IN_FLIGHT);
+  }
 
-    createGraphicsPipeline();
-    createCommandPool();
-    createCommandBuffers();
+  void createGpuProfiler() {
+    TRACE_FUNCTION();
+    auto indices = findQueueFamilies(physicalDevice, surface);
+    gpuProfiler.init(physicalDevice, device, indices.graphicsFamily.value(),
+                     MAX_FRAMES_IN_FLIGHT + 1);
+  }
 
-    // TODO: DRY - duplicated in recreateSwapChain
-    createColorResources();
-    createDepthResources();
-    createFramebuffers();
+  void createMipGenerator() {
+    TRACE_FUNCTION();
+    mipGenerator.init(physicalDevice, device, allocator, descriptors,
+                      pipelineCache.handle(), DOWNSAMPLE_SHADER_SPV);
+  }
+
+  // Mesh shaders if the device has them and they weren't ruled out, the
+  // culling dispatch and indirect draws otherwise. Decided before the device
+  // is created, as mesh shaders have to be enabled on it.
+  void chooseMeshletPath() {
+    if (!options.meshlets) {
+      return;
+    }
+    if (!options.noMeshShaders &&
+        MeshletRenderer::meshShadersSupported(physicalDevice,
+                                              instanceVersion)) {
+      meshletPath = MeshletRenderer::Path::MESH_SHADER;
+      std::cout << "drawing meshlets with mesh shaders\n";
+    } else {
+      meshletPath = MeshletRenderer::Path::INDIRECT;
+      std::cout << "drawing meshlets with compute culling and indirect "
+                   "draws\n";
+    }
+  }
+
+  void createMeshletRenderer() {
+    TRACE_FUNCTION();
+    if (!meshletPath) {
+      return;
+    }
+    meshletRenderer.init(physicalDevice, device, allocator, descriptors,
+                         pipelineCache.handle(), *meshletPath,
+                         MAX_FRAMES_IN_FLIGHT, MESHLET_CULL_SHADER_SPV);
+  }
+
+  // With --gpu-culling, only the visible draws are drawn if the device can
+  // take their count from a buffer; otherwise all of them are, the culled
+  // ones with no instances
+  void chooseDrawCulling() {
+    if (!options.gpuCulling) {
+      return;
+    }
+    drawIndirectCount = DrawCuller::drawIndirectCountSupported(physicalDevice);
+    std::cout << "culling draws on the GPU, drawing them with "
+              << (drawIndirectCount ? "vkCmdDrawIndexedIndirectCount"
+                                    : "vkCmdDrawIndexedIndirect")
+              << "\n";
+  }
+
+  // The texture table needs VK_EXT_descriptor_indexing, which has to be
+  // enabled on the device; without it, --bindless falls back to the
+  // combined image sampler in set 0
+  void chooseTextureBinding() {
+    if (!options.bindless) {
+      return;
+    }
+    bindless = TextureTable::supported(physicalDevice, instanceVersion);
+    std::cout << (bindless ? "reading textures from a bindless texture table\n"
+                           : "descriptor indexing isn't supported, binding "
+                             "the texture directly\n");
+  }
 
-    loadModel();
-    createTextureImage();
-    createTextureImageView();
-    createTextureSampler();
+  void createTextureTable() {
+    TRACE_FUNCTION();
+    if (!bindless) {
+      return;
+    }
+    textureTable.init(physicalDevice, device);
+    if (meshletPath != MeshletRenderer::Path::MESH_SHADER) {
+      emptySetLayout = descriptors.layout({});
+    }
+  }
 
-    createVertexBuffer();
-    createIndexBuffer();
-    createUniformBuffers();
+  void createDrawCuller() {
+    TRACE_FUNCTION();
+    if (!options.gpuCulling) {
+      return;
+    }
+    drawCuller.init(physicalDevice, device, allocator, descriptors,
+                    pipelineCache.handle(), drawIndirectCount,
+                    MAX_FRAMES_IN_FLIGHT,
+                    DRAW_CULL_SHADER_SPV);
+  }
+
+  // the draws' bounds and commands go to the GPU once; the culling pass
+  // turns them into the frame's indirect draws
+  void uploadDrawList() {
+    TRACE_FUNCTION();
+    if (!options.gpuCulling) {
+      return;
+    }
+    drawCuller.upload(uploads, drawList, model.indices, model.vertices);
+    commandCache.invalidate();
+  }
 
-    createDescriptorPool();
-    createDescriptorSets();
+  void uploadMeshlets() {
+    TRACE_FUNCTION();
+    if (!meshletPath) {
+      return;
+    }
+    meshletRenderer.upload(uploads, meshlets, vertexBuffer);
+    commandCache.invalidate();
+  }
 
-    createSyncObjects();
+  void createPipelineCache() {
+    TRACE_FUNCTION();
+    pipelineCache.init(physicalDevice, device, PIPELINE_CACHE_PATH);
   }
 
-  void createDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 2> poolSizes{
-        {{.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-          .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)},
-         {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-          .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)}}};
+  void createUploadService() {
+    TRACE_FUNCTION();
+    auto indices = findQueueFamilies(physicalDevice, surface);
 
-    VkDescriptorPoolCreateInfo poolInfo{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .poolSizeCount = poolSizes.size(),
-        .pPoolSizes = poolSizes.data(),
-        .maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)};
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        physicalDevice, &queueFamilyCount, queueFamilies.data());
 
-    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
-        VK_SUCCESS) {
-      throw std::runtime_error("failed to create descriptor pool");
+    uploads.init(
+        device, indices.graphicsFamily.value(), graphicsQueue,
+        indices.transferFamily.value(), transferQueue,
+        queueFamilies[indices.transferFamily.value()]
+            .minImageTransferGranularity);
+    if (uploads.hasDedicatedTransferQueue()) {
+      std::cout << "using dedicated transfer queue family "
+                << indices.transferFamily.value() << "\n";
     }
+
+    createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 stagingBuffer, stagingBufferMemory);
+    uploads.initStaging(stagingBuffer, stagingBufferMemory.mapped,
+                        STAGING_RING_SIZE);
+  }
+
+  void printStagingStats() const {
+    const auto& stats = uploads.stagingStats();
+    std::cout << "staging ring: " << (stats.used >> 10) << "/"
+              << (stats.capacity >> 10) << " KiB in use (peak "
+              << (stats.peakUsed >> 10) << " KiB), "
+              << (stats.bytesStaged >> 10) << " KiB staged in "
+              << stats.allocations << " uploads, " << stats.stalls
+              << " stalls\n";
   }
 
   void createDescriptorSets() {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
-                                               descriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = descriptorPool,
-        .descriptorSetCount = static_cast<uint32_t>(layouts.size()),
-        .pSetLayouts = layouts.data()};
-
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) !=
-        VK_SUCCESS) {
-      throw std::runtime_error("failed to allocate descriptor sets");
+    TRACE_FUNCTION();
+    // recorded command buffers bind the old sets
+    commandCache.invalidate();
+    // the range one frame's uniforms take; where it starts is the dynamic
+    // offset
+    std::vector<DescriptorAllocator::Descriptor> contents{
+        {.binding = 0,
+         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+         .buffer = {.buffer = uniformRing.handle(),
+                    .offset = 0,
+                    .range = sizeof(UniformBufferObject)}}};
+    // the texture goes in the table rather than binding 1
+    if (!bindless) {
+      contents.push_back(
+          {.binding = 1,
+           .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+           .image = {.sampler = textureSampler,
+                     .imageView = textureImageView,
+                     .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}});
+    }
+    descriptorSet = descriptors.set(descriptorSetLayout, contents);
+
+    if (bindless) {
+      textureTable.setSampler(textureSampler);
+      textureIndex = textureTable.add(textureImageView);
     }
+  }
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      VkDescriptorBufferInfo bufferInfo{.buffer = uniformBuffers[i],
-                                        .offset = 0,
-                                        .range = sizeof(UniformBufferObject)};
-
-      VkDescriptorImageInfo imageInfo{
-          .imageView = textureImageView,
-          .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-          .sampler = textureSampler};
-
-      std::array<VkWriteDescriptorSet, 2> descriptorWrites{
-          {{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = descriptorSets[i],
-            .dstBinding = 0,
-            .dstArrayElement = 0,  // descriptors can be arrays
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .pBufferInfo = &bufferInfo},
-           {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = descriptorSets[i],
-            .dstBinding = 1,
-            .dstArrayElement = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
-            .pImageInfo = &imageInfo}}};
-
-      vkUpdateDescriptorSets(device, descriptorWrites.size(),
-                             descriptorWrites.data(), 0, nullptr);
-    }
+  // The stage that transforms vertices and reads the uniforms and push
+  // constants: the mesh shader with mesh shader meshlets
+  VkShaderStageFlags geometryStage() const {
+    return meshletPath == MeshletRenderer::Path::MESH_SHADER
+               ? VK_SHADER_STAGE_MESH_BIT_EXT
+               : VK_SHADER_STAGE_VERTEX_BIT;
+  }
+
+  // the stages reading DrawConstants: the fragment shader too for the
+  // bindless texture index
+  VkShaderStageFlags pushConstantStages() const {
+    return geometryStage() | (bindless ? VK_SHADER_STAGE_FRAGMENT_BIT : 0);
   }
 
   void createDescriptorSetLayout() {
-    // Uniforms for vertex transforms
+    TRACE_FUNCTION();
+    // Uniforms for vertex transforms, done by the mesh shader instead with
+    // mesh shader meshlets. Each frame's are at their own offset in the
+    // uniform ring.
     VkDescriptorSetLayoutBinding uboLayoutBinding{
         .binding = 0,
         .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT};
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .stageFlags = geometryStage()};
 
     // combined sampler for texture-mapping in the fragment shader
     VkDescriptorSetLayoutBinding samplerLayoutBinding{
@@ -727,200 +1161,596 @@ class HelloTriangleApplication {
         .pImmutableSamplers = nullptr,
         .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT};
 
-    std::array bindings{uboLayoutBinding, samplerLayoutBinding};
-
-    VkDescriptorSetLayoutCreateInfo layoutInfo{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = bindings.size(),
-        .pBindings = bindings.data()};
-
-    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
-                                    &descriptorSetLayout) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to create descriptor set layout");
+    // bindless textures are in the texture table instead
+    std::vector bindings{uboLayoutBinding};
+    if (!bindless) {
+      bindings.push_back(samplerLayoutBinding);
     }
+
+    descriptorSetLayout = descriptors.layout(bindings);
   }
 
   void createBufferAndTransferData(std::ranges::contiguous_range auto&& srcData,
                                    VkBuffer& dstBuffer,
-                                   VkDeviceMemory& dstMemory,
-                                   VkBufferUsageFlags usage) const {
+                                   Allocation& dstMemory,
+                                   VkBufferUsageFlags usage) {
     VkDeviceSize bufferSize = sizeof(srcData.back()) * srcData.size();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-
-    createHostVisibleBuffer(srcData, stagingBuffer, stagingMemory,
-                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-
     createBuffer(bufferSize, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, dstBuffer, dstMemory);
 
-    copyBuffer(stagingBuffer, dstBuffer, bufferSize);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingMemory, nullptr);
-  }
-
-  void createHostVisibleBuffer(std::ranges::contiguous_range auto&& srcData,
-                               VkBuffer& dstBuffer,
-                               VkDeviceMemory& dstMemory,
-                               VkBufferUsageFlags usage) const {
-    VkDeviceSize bufferSize = sizeof(srcData.back()) * srcData.size();
-
-    createBuffer(bufferSize, usage,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 dstBuffer, dstMemory);
-
-    void* data;  // host (CPU) memory that is mapped to the buffer
-    vkMapMemory(device, dstMemory, 0, bufferSize, 0, &data);
-    // copy the data
-    memcpy(data, srcData.data(), bufferSize);
-    vkUnmapMemory(device, dstMemory);
+    uploads.uploadBuffer(dstBuffer, 0, std::as_bytes(std::span(srcData)));
   }
 
   void createIndexBuffer() {
-    createBufferAndTransferData(indices, indexBuffer, indexBufferMemory,
+    TRACE_FUNCTION();
+    if (meshletPath == MeshletRenderer::Path::MESH_SHADER) {
+      // the mesh shader reads the meshlets' own indices
+      return;
+    }
+    // The indirect meshlet draws run over the triangles in meshlet order.
+    // They're written without a vertex offset, so there must be one chunk.
+    std::vector<uint32_t> meshletIndices;
+    std::span<const uint32_t> indices = model.indices;
+    if (meshletPath) {
+      meshletIndices = meshlets.indices();
+      indices = meshletIndices;
+    }
+    PackedIndices packed = packIndices(indices, model.vertices.size(),
+                                       !options.uint32Indices);
+    if (meshletPath && packed.chunks.size() > 1) {
+      packed = packIndices(indices, model.vertices.size(), false);
+    }
+    indexType = packed.type;
+    indexChunks = std::move(packed.chunks);
+    createBufferAndTransferData(packed.data, indexBuffer, indexBufferMemory,
                                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    std::cout << "index buffer: " << packed.indexSize() * 8 << "-bit, "
+              << indexChunks.size()
+              << (indexChunks.size() == 1 ? " chunk, " : " chunks, ")
+              << packed.data.size() / 1024 << " KiB\n";
+    commandCache.invalidate();
+  }
+
+  // Packed vertices if they were asked for and the device can fetch their
+  // formats. Decided up front, as the pipeline job depends on it.
+  void chooseVertexFormat() {
+    if (!options.packedVertices) {
+      return;
+    }
+    if (meshletPath == MeshletRenderer::Path::MESH_SHADER) {
+      std::cout << "mesh shaders read float vertices; not packing them\n";
+      return;
+    }
+    for (const auto& attribute : PackedVertex::getAttributeDescriptions()) {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, attribute.format,
+                                          &properties);
+      if (!hasFlags(properties.bufferFeatures,
+                    VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT)) {
+        std::cout << "packed vertex formats aren't supported, using floats\n";
+        return;
+      }
+    }
+    packedVertices = true;
   }
 
   void createVertexBuffer() {
-    createBufferAndTransferData(vertices, vertexBuffer, vertexBufferMemory,
-                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    TRACE_FUNCTION();
+    if (packedVertices) {
+      PackedMesh packed = packVertices(model.vertices);
+      vertexQuantization = packed.quantization;
+      createBufferAndTransferData(packed.vertices, vertexBuffer,
+                                  vertexBufferMemory,
+                                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+      std::cout << "packed vertices: "
+                << std::span(packed.vertices).size_bytes() / 1024
+                << " KiB instead of " << model.vertices.size_bytes() / 1024
+                << " KiB\n";
+    } else {
+      vertexQuantization = {};
+      // the mesh shader fetches vertices itself
+      createBufferAndTransferData(
+          model.vertices, vertexBuffer, vertexBufferMemory,
+          meshletPath == MeshletRenderer::Path::MESH_SHADER
+              ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+              : VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    }
+    commandCache.invalidate();
   }
 
   void createUniformBuffers() {
-    const VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    TRACE_FUNCTION();
+    uniformRing.init(physicalDevice, device, allocator, MAX_FRAMES_IN_FLIGHT,
+                     UNIFORM_RING_FRAME_SIZE);
+  }
 
+  // Lays options.instances copies of the model out on a square grid around
+  // the origin, far enough apart that they never touch as they spin, and
+  // creates the buffers their transforms go in
+  void createInstanceBuffers() {
+    TRACE_FUNCTION();
+    modelRadius = 0.f;
+    for (const Vertex& vertex : model.vertices) {
+      modelRadius = std::max(modelRadius, glm::length(vertex.pos));
+    }
+    modelRadius = std::max(modelRadius, 1e-3f);
+
+    const uint32_t columns = static_cast<uint32_t>(
+        std::ceil(std::sqrt(static_cast<double>(options.instances))));
+    const uint32_t rows = (options.instances + columns - 1) / columns;
+    const float spacing = 2.2f * modelRadius;
+    instancePositions.clear();
+    for (uint32_t i = 0; i < options.instances; ++i) {
+      instancePositions.emplace_back(
+          (i % columns - (columns - 1) * 0.5f) * spacing,
+          (i / columns - (rows - 1) * 0.5f) * spacing, 0.f);
+    }
+    const float gridRadius =
+        (std::max(columns, rows) - 1) * 0.5f * spacing + modelRadius;
+    sceneScale = gridRadius / modelRadius;
+    instanceCount = options.instances;
+
+    instanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    instanceBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      createBuffer(sizeof(InstanceData) * options.instances,
+                   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                   uniformBuffers[i], uniformBuffersMemory[i]);
-      vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0,
-                  &uniformBuffersMapped[i]);
+                   instanceBuffers[i], instanceBuffersMemory[i]);
     }
   }
 
-  ScopedCommandBuffer createCommandScope() const {
-    return {device, commandPool, graphicsQueue};
+  // Writes the transforms of the instances drawn this frame, each bobbing
+  // out of step with its neighbours. A single instance stays put, at the
+  // origin.
+  void updateInstances(uint32_t currentImage, float time) {
+    auto* instances =
+        static_cast<InstanceData*>(instanceBuffersMemory[currentImage].mapped);
+    const float bob =
+        options.instances > 1 ? INSTANCE_BOB_HEIGHT * modelRadius : 0.f;
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+      glm::vec3 position = instancePositions[i];
+      position.z += bob * std::sin(2.f * time + 0.7f * i);
+      instances[i].transform = glm::translate(glm::mat4(1.f), position);
+    }
   }
 
   void loadModel() {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string err, warn;
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-                          MODEL_PATH)) {
-      throw std::runtime_error("failed to load model");
-    }
-
-    // merge duplicate vertices
-    std::unordered_map<Vertex, uint32_t> uniqueVerts;
-    for (const auto& shape : shapes) {
-      for (const auto& index : shape.mesh.indices) {
-        Vertex vert{.pos{
-                        attrib.vertices[3 * index.vertex_index + 0],
-                        attrib.vertices[3 * index.vertex_index + 1],
-                        attrib.vertices[3 * index.vertex_index + 2],
-                    },
-                    // obj format has 0 at the bottom of the image, but our
-                    // image was loaded top-to-bottom
-                    .texCoord{
-                        attrib.texcoords[2 * index.texcoord_index + 0],
-                        1.f - attrib.texcoords[2 * index.texcoord_index + 1],
-                    },
-                    .color{1.f, 1.f, 1.f}};
-        if (const auto iter = uniqueVerts.find(vert);
-            iter != uniqueVerts.end()) {
-          indices.push_back(iter->second);
-        } else {
-          auto index = vertices.size();
-          uniqueVerts.emplace(vert, index);
-          vertices.push_back(vert);
-          indices.push_back(index);
+    TRACE_FUNCTION();
+    auto start = std::chrono::steady_clock::now();
+
+    bool fromCache;
+    mesh::OptimizationStats optimization;
+    model = MeshCache::load(MODEL_PATH, fromCache, &optimization);
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // runs on a worker during startup; one write keeps the line in one piece
+    std::ostringstream message;
+    message << "loaded " << MODEL_PATH << (fromCache ? " from cache: " : ": ")
+            << model.vertices.size() << " vertices, " << model.indices.size()
+            << " indices in " << elapsed.count() << " ms\n";
+    // FIFO cache of mesh::DEFAULT_CACHE_SIZE vertices
+    auto cacheStats = [&](const mesh::VertexCacheStats& stats) {
+      message << "ACMR " << stats.acmr << ", ATVR " << stats.atvr;
+    };
+    message << "  vertex cache: ";
+    if (fromCache) {
+      cacheStats(
+          mesh::analyzeVertexCache(model.indices, model.vertices.size()));
+    } else {
+      cacheStats(optimization.before);
+      message << " -> ";
+      cacheStats(optimization.after);
+      message << " (optimized in " << optimization.milliseconds << " ms)";
+    }
+    message << "\n";
+
+    if (options.meshlets) {
+      auto meshletStart = std::chrono::steady_clock::now();
+      meshlets = mesh::buildMeshlets(model.indices, model.vertices);
+      std::chrono::duration<double, std::milli> meshletElapsed =
+          std::chrono::steady_clock::now() - meshletStart;
+      message << "  " << meshlets.meshlets.size() << " meshlets of up to "
+              << mesh::MAX_MESHLET_VERTICES << " vertices and "
+              << mesh::MAX_MESHLET_TRIANGLES << " triangles, built in "
+              << meshletElapsed.count() << " ms\n";
+    }
+    std::cout << message.str();
+  }
+
+  // Splits the model into options.draws draw calls over consecutive triangles,
+  // which gives the recorder threads something to share and --gpu-culling
+  // something to cull. Draws that would straddle two index chunks are split
+  // between them.
+  void buildDrawList() {
+    drawList.clear();
+    if (meshletPath) {
+      // one entry standing for all the meshlets, see recordDraws()
+      drawList.push_back(
+          {.indexCount = static_cast<uint32_t>(model.indices.size()),
+           .firstIndex = 0,
+           .vertexOffset = 0});
+      return;
+    }
+    const size_t triangles = model.indices.size() / 3;
+    const size_t count =
+        std::clamp<size_t>(options.draws, 1, std::max<size_t>(triangles, 1));
+    auto chunk = indexChunks.begin();
+    for (size_t i = 0; i < count; ++i) {
+      size_t first = (triangles * i / count) * 3;
+      const size_t last = (triangles * (i + 1) / count) * 3;
+      while (first < last) {
+        while (chunk->firstIndex + chunk->indexCount <= first) {
+          ++chunk;
         }
+        const size_t end =
+            std::min<size_t>(last, chunk->firstIndex + chunk->indexCount);
+        drawList.push_back({.indexCount = static_cast<uint32_t>(end - first),
+                            .firstIndex = static_cast<uint32_t>(first),
+                            .vertexOffset = chunk->vertexOffset});
+        first = end;
       }
     }
   }
 
-  void createTextureImage() {
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH, &texWidth, &texHeight,
-                                &texChannels, STBI_rgb_alpha);
+  // The part of loading the texture that doesn't need the device: maps the
+  // cooked variants on disk, or decodes the source image if there are none
+  void decodeTexture() {
+    TRACE_FUNCTION();
+    for (auto [format, suffix] : COOKED_TEXTURE_FORMATS) {
+      const std::string path = std::string(COOKED_TEXTURE_BASE) + suffix;
+      if (!std::filesystem::exists(path)) {
+        continue;
+      }
+      ktx2::File file(path);
+      if (file.format() != format) {
+        throw std::runtime_error(path + " has an unexpected format");
+      }
+      cookedTextures.emplace_back(format, std::move(file));
+    }
+    if (cookedTextures.empty()) {
+      decodeSourceTexture();
+    }
+  }
 
-    if (!pixels) {
+  void decodeSourceTexture() {
+    TRACE_FUNCTION();
+    int texChannels;
+    sourceTexture.pixels =
+        stbi_load(TEXTURE_PATH, &sourceTexture.width, &sourceTexture.height,
+                  &texChannels, STBI_rgb_alpha);
+    if (!sourceTexture.pixels) {
       throw std::runtime_error("failed to load texture image!");
     }
+    const size_t texels =
+        static_cast<size_t>(sourceTexture.width) * sourceTexture.height;
+    sourceTexture.translucent = false;
+    for (size_t i = 0; i < texels && !sourceTexture.translucent; ++i) {
+      sourceTexture.translucent = sourceTexture.pixels[i * 4 + 3] != 255;
+    }
+  }
 
-    mipLevels = computeMipLevels(texWidth, texHeight);
-
-    VkDeviceSize imageSize = texWidth * texHeight * texChannels * 4;
+  void createTextureImage() {
+    TRACE_FUNCTION();
+    auto start = std::chrono::steady_clock::now();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+    const bool cooked = loadCookedTexture();
+    if (!cooked) {
+      loadSourceTexture();
+    }
 
-    createHostVisibleBuffer(std::span(pixels, imageSize), stagingBuffer,
-                            stagingBufferMemory,
-                            VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "loaded " << (cooked ? "cooked" : "source") << " texture ("
+              << mipLevels << " levels, " << textureImageMemory.size / 1024
+              << " KiB) in " << elapsed.count() << " ms\n";
+  }
 
-    stbi_image_free(pixels);
+  // Uploads the preferred cooked texture the device can sample from, mips and
+  // all. Returns false if there's none.
+  bool loadCookedTexture() {
+    std::vector<VkFormat> candidates;
+    for (const auto& [format, file] : cookedTextures) {
+      candidates.push_back(format);
+    }
+    if (candidates.empty()) {
+      return false;
+    }
+
+    try {
+      textureFormat = findSupportedCandidates(
+          candidates, VK_IMAGE_TILING_OPTIMAL,
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+    } catch (const std::runtime_error&) {
+      return false;
+    }
+
+    auto cooked = std::ranges::find(cookedTextures, textureFormat,
+                                    &decltype(cookedTextures)::value_type::first);
+    const ktx2::File& file = cooked->second;
+
+    mipLevels = file.levelCount();
+    createImage(file.width(), file.height(), mipLevels, VK_SAMPLE_COUNT_1_BIT,
+                textureFormat, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+                textureImageMemory);
+
+    std::vector<UploadService::ImageLevel> levels;
+    for (uint32_t level = 0; level < mipLevels; ++level) {
+      levels.push_back({.mipLevel = level,
+                        .extent = file.levelExtent(level),
+                        .data = file.levelData(level),
+                        .rowPitch = file.levelRowPitch(level),
+                        .blockHeight = file.blockInfo().blockHeight});
+    }
+    // the data is copied into the staging ring, so the file can be unmapped
+    // straight after
+    uploads.uploadImage(textureImage, mipLevels, levels);
+    transitionImageLayout(textureImage, textureFormat, mipLevels,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    cookedTextures.clear();
+    return true;
+  }
 
-    // TODO: figure how why the texture images are loaded as linear instead of
-    // SRGB (maybe something in the STB library?)
-    const VkFormat imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    // set the transfer_dst and transfer_src flags becase we need to read it
-    // to create mipmaps
-    createImage(
-        texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, imageFormat,
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-            VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+  // Fallback when there's no usable cooked texture: decode the source image
+  // and generate the mips on the GPU, or on the CPU if the GPU can't
+  void loadSourceTexture() {
+    if (!sourceTexture.pixels) {
+      // there were cooked textures, but none the device supports
+      decodeSourceTexture();
+    }
+    // freed on the way out if anything below throws
+    std::unique_ptr<stbi_uc, decltype(&stbi_image_free)> pixels(
+        std::exchange(sourceTexture.pixels, nullptr), stbi_image_free);
+    const int texWidth = sourceTexture.width;
+    const int texHeight = sourceTexture.height;
 
-    // transition the image for mipmap creation
-    transitionImageLayout(textureImage, imageFormat, mipLevels,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    mipLevels = computeMipLevels(texWidth, texHeight);
 
-    copyBufferToImage(stagingBuffer, textureImage,
-                      static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
+    // we asked stb for 4 channels regardless of what the file has
+    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    auto pixelBytes = std::as_bytes(std::span(pixels.get(), imageSize));
 
-    // This leaves the image in the VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-    // layout
-    generateMipmaps(textureImage, imageFormat, texWidth, texHeight, mipLevels);
+    // TODO: figure how why the texture images are loaded as linear instead of
+    // SRGB (maybe something in the STB library?)
+    textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    // The view is UNORM, but the texels are sRGB encoded
+    uint32_t filter = MipGenerator::SRGB;
+    if (sourceTexture.translucent) {
+      filter |= MipGenerator::ALPHA_WEIGHTED;
+    }
+    static_assert(uint32_t{MipGenerator::SRGB} == mipchain::SRGB &&
+                  uint32_t{MipGenerator::ALPHA_WEIGHTED} ==
+                      mipchain::ALPHA_WEIGHTED);
+
+    const bool gpuMips =
+        !options.cpuMips &&
+        canGenerateMipmaps(textureFormat, texWidth, texHeight, mipLevels);
+    std::vector<mipchain::Level> mips;
+    if (!gpuMips) {
+      TRACE_SCOPE("cpu mipmaps");
+      mips = mipchain::generate(pixelBytes, mipchain::Format::RGBA8, texWidth,
+                                texHeight, mipchain::Filter::BOX, filter,
+                                mipLevels);
+    }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    // set the transfer_dst and transfer_src flags becase we need to read it
+    // to create mipmaps, or storage to build them in a compute shader
+    VkImageUsageFlags usage =
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (gpuMips) {
+      usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      if (mipGenerator.supports(textureFormat, texWidth, texHeight,
+                                mipLevels)) {
+        usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+      }
+    }
+    createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT,
+                textureFormat, VK_IMAGE_TILING_OPTIMAL, usage,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+                textureImageMemory);
+
+    // also transitions the image for mipmap creation
+    std::vector<UploadService::ImageLevel> levels{
+        {.mipLevel = 0,
+         .extent{static_cast<uint32_t>(texWidth),
+                 static_cast<uint32_t>(texHeight)},
+         .data = pixelBytes,
+         .rowPitch = static_cast<VkDeviceSize>(texWidth) * 4}};
+    for (const auto& mip : mips) {
+      levels.push_back(
+          {.mipLevel = static_cast<uint32_t>(levels.size()),
+           .extent{mip.width, mip.height},
+           .data = mip.data,
+           .rowPitch = static_cast<VkDeviceSize>(mip.width) * 4});
+    }
+    uploads.uploadImage(textureImage, mipLevels, levels);
+
+    // the pixels have been copied into the staging ring
+    pixels.reset();
+
+    // Either way, this leaves the image in the
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL layout
+    if (gpuMips) {
+      generateMipmaps(textureImage, textureFormat, texWidth, texHeight,
+                      mipLevels, filter);
+    } else {
+      transitionImageLayout(textureImage, textureFormat, mipLevels,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
   }
 
   void createTextureImageView() {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM,
-                                       mipLevels, VK_IMAGE_ASPECT_COLOR_BIT);
+    TRACE_FUNCTION();
+    textureImageView = createImageView(textureImage, textureFormat, mipLevels,
+                                       VK_IMAGE_ASPECT_COLOR_BIT);
+  }
+
+  // Whether generateMipmaps() can fill an image in `format`: with a compute
+  // shader or with blits
+  bool canGenerateMipmaps(VkFormat format,
+                          uint32_t width,
+                          uint32_t height,
+                          uint32_t mipLevels) const {
+    if (mipGenerator.supports(format, width, height, mipLevels)) {
+      return true;
+    }
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format,
+                                        &formatProperties);
+    return hasFlags(formatProperties.optimalTilingFeatures,
+                    VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                        VK_FORMAT_FEATURE_BLIT_DST_BIT);
   }
 
+  // Fills levels 1 and up from level 0: in one compute dispatch where the
+  // format allows, with a chain of blits otherwise. Expects the image in
+  // TRANSFER_DST_OPTIMAL and leaves it in SHADER_READ_ONLY_OPTIMAL.
+  // `filter` is a combination of MipGenerator::Flags; blits ignore it.
+  // Check canGenerateMipmaps() first, or build the mips with mipchain.
   void generateMipmaps(VkImage image,
                        VkFormat imageFormat,
                        uint32_t width,
                        uint32_t height,
-                       uint32_t mipLevels) {
+                       uint32_t mipLevels,
+                       uint32_t filter) {
+    if (mipLevels <= 1) {
+      // nothing to generate, only the layout to change
+      transitionImageLayout(image, imageFormat, mipLevels,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      return;
+    }
+
+    // blits need a graphics queue
+    auto commandBuffer = uploads.graphicsCommands();
+    gpuProfiler.begin(commandBuffer, UPLOAD_PROFILER_SLOT);
+    GpuProfiler::Scope profile(gpuProfiler, commandBuffer,
+                               UPLOAD_PROFILER_SLOT, "mipmaps");
+
+    if (mipGenerator.supports(imageFormat, width, height, mipLevels)) {
+      uploads.releaseAfterCompletion(mipGenerator.record(
+          commandBuffer, image, width, height, mipLevels, filter));
+      return;
+    }
+
     VkFormatProperties formatProperties;
     vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat,
                                         &formatProperties);
-
-    if (!hasFlags(formatProperties.optimalTilingFeatures,
-                  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+    const auto features = formatProperties.optimalTilingFeatures;
+    if (!hasFlags(features, VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
       throw std::runtime_error(
-          "failed to generate mipmaps: linear filtering not supported");
+          "failed to generate mipmaps: the format supports neither storage "
+          "nor blits");
+    }
+    // nearest filtering still gives a usable chain, if a blocky one
+    blitMipmaps(commandBuffer, image, width, height, mipLevels,
+                hasFlags(features,
+                         VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+                    ? VK_FILTER_LINEAR
+                    : VK_FILTER_NEAREST);
+  }
+
+  // Times the compute downsampler against the blit chain on a scratch image,
+  // with GPU timestamps
+  void benchmarkMipmaps() {
+    static constexpr uint32_t SIZE = 2048;
+    // two scopes each, within GpuProfiler::MAX_SCOPES_PER_SLOT
+    static constexpr int ITERATIONS = 10;
+    const uint32_t levels = computeMipLevels(SIZE, SIZE);
+    if (!mipGenerator.supports(MipGenerator::FORMAT, SIZE, SIZE, levels)) {
+      std::cout << "mip benchmark: compute downsampling isn't supported\n";
+      return;
     }
-    auto commandBuffer = createCommandScope();
+
+    VkImage image;
+    Allocation imageMemory;
+    createImage(SIZE, SIZE, levels, VK_SAMPLE_COUNT_1_BIT,
+                MipGenerator::FORMAT, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+
+    // whatever the startup uploads measured has to be read first
+    vkDeviceWaitIdle(device);
+    uploads.collect();
+    gpuProfiler.collect();
+
+    auto commandBuffer = uploads.graphicsCommands();
+    gpuProfiler.begin(commandBuffer, UPLOAD_PROFILER_SLOT);
+    // both methods start from TRANSFER_DST_OPTIMAL; the contents don't
+    // matter
+    VkImageMemoryBarrier reset{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT |
+                         VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                          .baseMipLevel = 0,
+                          .levelCount = levels,
+                          .baseArrayLayer = 0,
+                          .layerCount = 1}};
+    auto resetImage = [&] {
+      vkCmdPipelineBarrier(commandBuffer,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                           nullptr, 1, &reset);
+    };
+
+    for (int i = 0; i < ITERATIONS; ++i) {
+      resetImage();
+      {
+        GpuProfiler::Scope profile(gpuProfiler, commandBuffer,
+                                   UPLOAD_PROFILER_SLOT, "mipmaps (blit)");
+        blitMipmaps(commandBuffer, image, SIZE, SIZE, levels,
+                    VK_FILTER_LINEAR);
+      }
+      resetImage();
+      {
+        GpuProfiler::Scope profile(gpuProfiler, commandBuffer,
+                                   UPLOAD_PROFILER_SLOT, "mipmaps (compute)");
+        uploads.releaseAfterCompletion(mipGenerator.record(
+            commandBuffer, image, SIZE, SIZE, levels, MipGenerator::SRGB));
+      }
+    }
+    uploads.wait(uploads.flush());
+    gpuProfiler.collect();
+
+    std::cout << "mip chain of a " << SIZE << "x" << SIZE << " image ("
+              << levels << " levels), " << ITERATIONS << " runs:\n";
+    for (const auto& stats : gpuProfiler.statistics()) {
+      if (stats.name.starts_with("mipmaps (")) {
+        std::cout << "  " << stats.name << ": " << stats.minMs << " ms min, "
+                  << stats.avgMs << " ms avg\n";
+      }
+    }
+
+    vkDestroyImage(device, image, nullptr);
+    allocator.free(imageMemory);
+  }
+
+  void blitMipmaps(VkCommandBuffer commandBuffer,
+                   VkImage image,
+                   uint32_t width,
+                   uint32_t height,
+                   uint32_t mipLevels,
+                   VkFilter filter) {
     // need a barrier to transition each level individually
     // (our transitionImage function only does the entire image)
     VkImageMemoryBarrier barrier{
@@ -968,7 +1798,7 @@ class HelloTriangleApplication {
       // doing a linear downscaling
       vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
                      image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
-                     VK_FILTER_LINEAR);
+                     filter);
 
       // Make the source mip image usable by the shader
       barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
@@ -988,7 +1818,8 @@ class HelloTriangleApplication {
     barrier.subresourceRange.baseMipLevel = mipLevels - 1;
     barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    // it was last written by a blit
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
     vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -1021,6 +1852,14 @@ class HelloTriangleApplication {
   }
 
   void createColorResources() {
+    TRACE_FUNCTION();
+    if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) {
+      // nothing to resolve, see createRenderPass()
+      colorImage = VK_NULL_HANDLE;
+      colorImageView = VK_NULL_HANDLE;
+      return;
+    }
+
     VkFormat colorFormat = swapChainImageFormat;
 
     createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples,
@@ -1035,6 +1874,7 @@ class HelloTriangleApplication {
   }
 
   void createDepthResources() {
+    TRACE_FUNCTION();
     auto depthFormat = findDepthFormat();
     createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples,
                 depthFormat, VK_IMAGE_TILING_OPTIMAL,
@@ -1080,6 +1920,7 @@ class HelloTriangleApplication {
   }
 
   void createTextureSampler() {
+    TRACE_FUNCTION();
     VkPhysicalDeviceProperties properties;
     vkGetPhysicalDeviceProperties(physicalDevice, &properties);
     VkSamplerCreateInfo samplerInfo{
@@ -1106,14 +1947,6 @@ class HelloTriangleApplication {
     }
   }
 
-  void copyBuffer(VkBuffer srcBuffer,
-                  VkBuffer dstBuffer,
-                  VkDeviceSize size) const {
-    auto commandBuffer = createCommandScope();
-    VkBufferCopy copyRegion{.size = size};
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-  }
-
   void transitionImageLayout(VkImage image,
                              VkFormat format,
                              uint32_t mipLevels,
@@ -1171,7 +2004,7 @@ class HelloTriangleApplication {
     }
 
     // Common way to perform a layout transition is employing a memory barrier
-    auto commandBuffer = createCommandScope();
+    auto commandBuffer = uploads.graphicsCommands();
     vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage,
                          0,             // dependency flags
                          0, nullptr,    // memory barriers
@@ -1179,45 +2012,8 @@ class HelloTriangleApplication {
                          1, &barrier);  // image memory barriers
   }
 
-  uint32_t findMemoryType(uint32_t typeFilter,
-                          VkMemoryPropertyFlags properties) const {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-      if (hasBit(typeFilter, i) &&
-          hasFlags(memProperties.memoryTypes[i].propertyFlags, properties)) {
-        // found it
-        return i;
-      }
-    }
-
-    throw std::runtime_error("unable to find suitable memory type");
-  }
-
-  void copyBufferToImage(VkBuffer buffer,
-                         VkImage image,
-                         uint32_t width,
-                         uint32_t height) {
-    auto commandBuffer = createCommandScope();
-    VkBufferImageCopy region{
-        .bufferOffset = 0,
-        .bufferRowLength = 0,    // indicates tightly packed
-        .bufferImageHeight = 0,  // indicates tightly packed
-        .imageSubresource{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                          .mipLevel = 0,
-                          .baseArrayLayer = 0,
-                          .layerCount = 1},
-        .imageOffset{.x = 0, .y = 0, .z = 0},
-        .imageExtent{.width = width, .height = height, .depth = 1}};
-
-    vkCmdCopyBufferToImage(
-        commandBuffer, buffer, image,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,  // current layout of the dest
-                                               // image
-        1, &region);
-  }
-
   void createCommandPool() {
+    TRACE_FUNCTION();
     auto queueFamilyIndices = findQueueFamilies(physicalDevice, surface);
 
     VkCommandPoolCreateInfo poolInfo{};
@@ -1232,6 +2028,7 @@ class HelloTriangleApplication {
   }
 
   void createCommandBuffers() {
+    TRACE_FUNCTION();
     commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
     VkCommandBufferAllocateInfo allocInfo{};
@@ -1246,6 +2043,155 @@ class HelloTriangleApplication {
     }
   }
 
+  void createCommandCache() {
+    TRACE_FUNCTION();
+    if (options.cacheCommands) {
+      commandCache.init(device, commandPool, MAX_FRAMES_IN_FLIGHT,
+                        static_cast<uint32_t>(swapChainImages.size()));
+    }
+  }
+
+  bool recorderEnabled() const {
+    return options.recordThreads > 0 || options.recordBenchmark;
+  }
+
+  // Secondaries are recorded per frame slot and swap chain image, so a cached
+  // primary command buffer keeps its own
+  uint32_t recorderSlotCount() const {
+    return MAX_FRAMES_IN_FLIGHT * static_cast<uint32_t>(swapChainImages.size());
+  }
+
+  void createRecorder() {
+    TRACE_FUNCTION();
+    if (!recorderEnabled()) {
+      return;
+    }
+    unsigned threads = options.recordThreads;
+    if (options.recordBenchmark) {
+      threads = std::max(threads, JobSystem::shared().concurrency());
+    }
+    auto indices = findQueueFamilies(physicalDevice, surface);
+    recorder.init(device, indices.graphicsFamily.value(), threads);
+    recorder.allocate(recorderSlotCount());
+  }
+
+  // Records the draw list on `threads` threads into secondary command buffers
+  // that continue the render pass on swapChainFramebuffers[imageIndex]
+  std::span<const VkCommandBuffer> recordSecondaries(uint32_t imageIndex,
+                                                     unsigned threads) {
+    VkCommandBufferInheritanceInfo inheritance{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = renderPass,
+        .subpass = 0,
+        .framebuffer = swapChainFramebuffers[imageIndex]};
+    const uint32_t slot =
+        currentFrame * static_cast<uint32_t>(swapChainImages.size()) +
+        imageIndex;
+    return recorder.record(
+        slot, inheritance, drawList.size(), threads,
+        [&](VkCommandBuffer commandBuffer, size_t begin, size_t end) {
+          recordDraws(commandBuffer, begin, end);
+        });
+  }
+
+  // Times recording the draw list into secondaries with 1 to all of the
+  // recorder's threads. Runs before the first frame, while nothing recorded
+  // by the recorder can be in flight.
+  void benchmarkRecording() {
+    static constexpr int ITERATIONS = 200;
+
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < recorder.threadCount();
+         threads *= 2) {
+      threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(recorder.threadCount());
+
+    std::cout << "recording " << drawList.size()
+              << " draws into secondary command buffers:\n";
+    double singleThreadMs = 0;
+    for (unsigned threads : threadCounts) {
+      // warm up the pools and the workers
+      recordSecondaries(0, threads);
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < ITERATIONS; ++i) {
+        recordSecondaries(0, threads);
+      }
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      const double ms = elapsed.count() / ITERATIONS;
+      if (threads == 1) {
+        singleThreadMs = ms;
+      }
+      std::cout << "  " << threads << (threads == 1 ? " thread: " : " threads: ")
+                << ms << " ms/frame (" << singleThreadMs / ms << "x)\n";
+    }
+  }
+
+  // Times whole frames drawing 1, 4, 16, ... and finally all of the
+  // instances. Frames are rendered as usual, so in a window the result is
+  // capped by vsync.
+  void benchmarkInstances() {
+    static constexpr int WARMUP_FRAMES = 10;
+    static constexpr int FRAMES = 100;
+
+    std::vector<uint32_t> counts;
+    for (uint32_t count = 1; count < options.instances; count *= 4) {
+      counts.push_back(count);
+    }
+    counts.push_back(options.instances);
+
+    auto render = [&](int frames) {
+      for (int i = 0; i < frames; ++i) {
+        if (!options.headless) {
+          glfwPollEvents();
+        }
+        drawFrame();
+      }
+      vkDeviceWaitIdle(device);
+    };
+
+    std::cout << "frame time by instance count ("
+              << model.indices.size() / 3 << " triangles each):\n";
+    for (uint32_t count : counts) {
+      instanceCount = count;
+      // the draws were recorded for the previous count
+      commandCache.invalidate();
+      render(WARMUP_FRAMES);
+
+      auto start = std::chrono::steady_clock::now();
+      render(FRAMES);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      const double ms = elapsed.count() / FRAMES;
+      std::cout << "  " << count
+                << (count == 1 ? " instance: " : " instances: ") << ms
+                << " ms/frame (" << ms * 1e6 / count << " ns per instance)\n";
+    }
+    instanceCount = options.instances;
+    commandCache.invalidate();
+  }
+
+  // The command buffer to submit this frame: recorded from scratch, or with
+  // --cache-commands, replayed if nothing it depends on has changed
+  VkCommandBuffer prepareCommandBuffer(uint32_t imageIndex) {
+    if (!options.cacheCommands) {
+      vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+      recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+      return commandBuffers[currentFrame];
+    }
+
+    return commandCache.get(
+        currentFrame, imageIndex,
+        [&](VkCommandBuffer commandBuffer) {
+          recordCommandBuffer(commandBuffer, imageIndex);
+        },
+        [&](VkCommandBuffer commandBuffer) {
+          gpuProfiler.replay(commandBuffer, currentFrame);
+        });
+  }
+
   void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1254,6 +2200,21 @@ class HelloTriangleApplication {
       throw std::runtime_error("failed to begin recording command buffer");
     }
 
+    // the frame's fence has signalled, so last use of this slot is readable
+    gpuProfiler.begin(commandBuffer, currentFrame);
+    if (meshletPath == MeshletRenderer::Path::INDIRECT) {
+      GpuProfiler::Scope profile(gpuProfiler, commandBuffer, currentFrame,
+                                 "meshlet culling");
+      meshletRenderer.recordCulling(commandBuffer, currentFrame);
+    }
+    if (options.gpuCulling) {
+      GpuProfiler::Scope profile(gpuProfiler, commandBuffer, currentFrame,
+                                 "draw culling");
+      drawCuller.recordCulling(commandBuffer, currentFrame);
+    }
+    const uint32_t renderPassScope =
+        gpuProfiler.beginScope(commandBuffer, currentFrame, "render pass");
+
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
@@ -1271,21 +2232,76 @@ class HelloTriangleApplication {
     renderPassInfo.clearValueCount = clearValues.size();
     renderPassInfo.pClearValues = clearValues.data();
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
+    if (options.recordThreads > 0) {
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                           VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+      auto secondaries = recordSecondaries(imageIndex, options.recordThreads);
+      vkCmdExecuteCommands(commandBuffer,
+                           static_cast<uint32_t>(secondaries.size()),
+                           secondaries.data());
+    } else {
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                           VK_SUBPASS_CONTENTS_INLINE);
+      recordDraws(commandBuffer, 0, drawList.size());
+    }
+
+    vkCmdEndRenderPass(commandBuffer);
+    gpuProfiler.endScope(commandBuffer, currentFrame, renderPassScope);
+    if (meshletPath) {
+      meshletRenderer.recordStatsReadback(commandBuffer, currentFrame);
+    }
+    if (options.gpuCulling) {
+      drawCuller.recordStatsReadback(commandBuffer, currentFrame);
+    }
+
+    if (options.headless) {
+      GpuProfiler::Scope profile(gpuProfiler, commandBuffer, currentFrame,
+                                 "readback");
+      recordReadback(commandBuffer, imageIndex);
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer");
+    }
+  }
 
+  // Records draws [begin, end) of the draw list, binding everything they
+  // need: secondary command buffers don't inherit any state. With meshlets,
+  // the draw list's one entry records all of them.
+  void recordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end) {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                       graphicsPipeline);
 
-    VkBuffer vertexBuffers[]{vertexBuffer};
-    VkDeviceSize offsets[]{0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    // the mesh shader pipeline has no vertex input
+    const bool meshShaders =
+        meshletPath == MeshletRenderer::Path::MESH_SHADER;
+    if (!meshShaders) {
+      VkBuffer vertexBuffers[]{vertexBuffer, instanceBuffers[currentFrame]};
+      VkDeviceSize offsets[]{0, 0};
+      vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+    }
 
+    const uint32_t uniformOffset = uniformRing.frameOffset(currentFrame);
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipelineLayout, 0, 1, &descriptorSets[currentFrame],
-                            0, nullptr);
-
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                            pipelineLayout, 0, 1, &descriptorSet, 1,
+                            &uniformOffset);
+    if (bindless) {
+      VkDescriptorSet table = textureTable.descriptorSet();
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              pipelineLayout, TEXTURE_TABLE_SET, 1, &table, 0,
+                              nullptr);
+    }
+    // the same for every draw of the model
+    const DrawConstants constants{
+        .texCoordTransform = glm::vec4(vertexQuantization.texCoordScale,
+                                       vertexQuantization.texCoordOffset),
+        .textureIndex = textureIndex};
+    vkCmdPushConstants(commandBuffer, pipelineLayout, pushConstantStages(), 0,
+                       sizeof(constants), &constants);
+
+    if (!meshShaders) {
+      vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+    }
 
     // Set up viewport and scissor dynamically
     VkViewport viewport{};
@@ -1302,22 +2318,71 @@ class HelloTriangleApplication {
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    // DRAW IT!
-    vkCmdDrawIndexed(commandBuffer, indices.size(), 1, 0, 0, 0);
-
-    vkCmdEndRenderPass(commandBuffer);
+    if (meshletPath) {
+      if (begin < end) {
+        meshletRenderer.recordDraw(commandBuffer, currentFrame,
+                                   pipelineLayout);
+      }
+      return;
+    }
+    if (options.gpuCulling) {
+      // the culled draw list is one indirect draw, recorded with the range
+      // that starts it
+      if (begin == 0 && begin < end) {
+        drawCuller.recordDraw(commandBuffer, currentFrame);
+      }
+      return;
+    }
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-      throw std::runtime_error("failed to record command buffer");
+    // DRAW IT!
+    for (size_t i = begin; i < end; ++i) {
+      const DrawCommand& draw = drawList[i];
+      vkCmdDrawIndexed(commandBuffer, draw.indexCount, instanceCount,
+                       draw.firstIndex, draw.vertexOffset, 0);
     }
   }
 
+  // Copies the rendered offscreen image into the readback buffer of its frame
+  // slot, readable by the host once the frame's fence has signalled
+  void recordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    VkBufferImageCopy copy{
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                          .mipLevel = 0,
+                          .baseArrayLayer = 0,
+                          .layerCount = 1},
+        .imageOffset{0, 0, 0},
+        .imageExtent{swapChainExtent.width, swapChainExtent.height, 1}};
+    vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex],
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readbackBuffers[imageIndex], 1, &copy);
+
+    VkBufferMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = readbackBuffers[imageIndex],
+        .offset = 0,
+        .size = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier,
+                         0, nullptr);
+  }
+
   void createFramebuffers() {
+    TRACE_FUNCTION();
     swapChainFramebuffers.resize(swapChainImageViews.size());
 
     for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-      std::array attachments{colorImageView, depthImageView,
-                             swapChainImageViews[i]};
+      std::vector attachments{colorImageView, depthImageView,
+                              swapChainImageViews[i]};
+      if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) {
+        attachments = {swapChainImageViews[i], depthImageView};
+      }
 
       VkFramebufferCreateInfo framebufferInfo{};
       framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1336,6 +2401,7 @@ class HelloTriangleApplication {
   }
 
   void createSyncObjects() {
+    TRACE_FUNCTION();
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
@@ -1359,6 +2425,14 @@ class HelloTriangleApplication {
   }
 
   void createRenderPass() {
+    TRACE_FUNCTION();
+    // without multisampling we render straight into the swap chain image
+    const bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+    // offscreen images are copied out after rendering instead of presented
+    const VkImageLayout targetLayout = options.headless
+                                           ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                           : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
     // Attachment 0: color
     VkAttachmentDescription colorAttachment{
         .format = swapChainImageFormat,
@@ -1368,7 +2442,8 @@ class HelloTriangleApplication {
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        .finalLayout = resolve ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                               : targetLayout};
 
     VkAttachmentReference colorAttachmentRef{
         .attachment = 0, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
@@ -1400,7 +2475,7 @@ class HelloTriangleApplication {
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+        .finalLayout = targetLayout};
 
     VkAttachmentReference colorResolveAttachmentRef{
         .attachment = 2, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
@@ -1410,13 +2485,15 @@ class HelloTriangleApplication {
         .colorAttachmentCount = 1,
         .pColorAttachments = &colorAttachmentRef,
         .pDepthStencilAttachment = &depthAttachmentRef,
-        .pResolveAttachments = &colorResolveAttachmentRef};
+        .pResolveAttachments = resolve ? &colorResolveAttachmentRef : nullptr};
 
-    std::array attachments{colorAttachment, depthAttachment,
-                           colorResolveAttachment};
+    std::vector attachments{colorAttachment, depthAttachment};
+    if (resolve) {
+      attachments.push_back(colorResolveAttachment);
+    }
     VkRenderPassCreateInfo renderPassInfo{
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .attachmentCount = attachments.size(),
+        .attachmentCount = static_cast<uint32_t>(attachments.size()),
         .pAttachments = attachments.data(),
         .subpassCount = 1,
         .pSubpasses = &subpass,
@@ -1457,8 +2534,19 @@ class HelloTriangleApplication {
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
                                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    // In headless mode the rendered image is copied into a readback buffer
+    // right after the render pass
+    VkSubpassDependency readbackDependency{
+        .srcSubpass = 0,
+        .dstSubpass = VK_SUBPASS_EXTERNAL,
+        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT};
+
+    std::array dependencies{dependency, readbackDependency};
+    renderPassInfo.dependencyCount = options.headless ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) !=
         VK_SUCCESS) {
@@ -1467,23 +2555,35 @@ class HelloTriangleApplication {
   }
 
   void createGraphicsPipeline() {
-    auto vertShaderModule = createShaderModule(readFile(VERT_SHADER_SPV));
-    auto fragShaderModule = createShaderModule(readFile(FRAG_SHADER_SPV));
-
-    VkPipelineShaderStageCreateInfo vertShaderStage{};
-    vertShaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStage.module = vertShaderModule;
-    vertShaderStage.pName = "main";
-
-    VkPipelineShaderStageCreateInfo fragShaderStage{};
-    fragShaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStage.module = fragShaderModule;
-    fragShaderStage.pName = "main";
+    TRACE_FUNCTION();
+    // mesh shader meshlets replace the vertex shader with a task and a mesh
+    // shader, and have no vertex input
+    const bool meshShaders =
+        meshletPath == MeshletRenderer::Path::MESH_SHADER;
+    std::vector<VkShaderModule> shaderModules;
+    auto shaderStage = [&](VkShaderStageFlagBits stage, const char* path) {
+      shaderModules.push_back(createShaderModule(readFile(path)));
+      VkPipelineShaderStageCreateInfo stageInfo{};
+      stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      stageInfo.stage = stage;
+      stageInfo.module = shaderModules.back();
+      stageInfo.pName = "main";
+      return stageInfo;
+    };
 
-    VkPipelineShaderStageCreateInfo shaderStages[]{vertShaderStage,
-                                                   fragShaderStage};
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    if (meshShaders) {
+      shaderStages.push_back(
+          shaderStage(VK_SHADER_STAGE_TASK_BIT_EXT, MESHLET_TASK_SHADER_SPV));
+      shaderStages.push_back(
+          shaderStage(VK_SHADER_STAGE_MESH_BIT_EXT, MESHLET_MESH_SHADER_SPV));
+    } else {
+      shaderStages.push_back(
+          shaderStage(VK_SHADER_STAGE_VERTEX_BIT, VERT_SHADER_SPV));
+    }
+    shaderStages.push_back(
+        shaderStage(VK_SHADER_STAGE_FRAGMENT_BIT,
+                    bindless ? BINDLESS_FRAG_SHADER_SPV : FRAG_SHADER_SPV));
 
     std::array dynamicStates{VK_DYNAMIC_STATE_VIEWPORT,
                              VK_DYNAMIC_STATE_SCISSOR};
@@ -1493,13 +2593,25 @@ class HelloTriangleApplication {
     dynamicState.dynamicStateCount = dynamicStates.size();
     dynamicState.pDynamicStates = dynamicStates.data();
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    // the vertices in binding 0, the instance transforms in binding 1
+    std::array bindingDescriptions{packedVertices
+                                       ? PackedVertex::getBindingDescription()
+                                       : Vertex::getBindingDescription(),
+                                   InstanceData::getBindingDescription()};
+    auto vertexAttributes = packedVertices
+                                ? PackedVertex::getAttributeDescriptions()
+                                : Vertex::getAttributeDescriptions();
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(
+        vertexAttributes.begin(), vertexAttributes.end());
+    for (const auto& attribute : InstanceData::getAttributeDescriptions()) {
+      attributeDescriptions.push_back(attribute);
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindingDescription,
+        .vertexBindingDescriptionCount =
+            static_cast<uint32_t>(bindingDescriptions.size()),
+        .pVertexBindingDescriptions = bindingDescriptions.data(),
         .vertexAttributeDescriptionCount =
             static_cast<uint32_t>(attributeDescriptions.size()),
         .pVertexAttributeDescriptions = attributeDescriptions.data()};
@@ -1562,10 +2674,26 @@ class HelloTriangleApplication {
     colorBlending.attachmentCount = 1;
     colorBlending.pAttachments = &colorBlendAttachment;
 
+    // the meshlets are set 1 for the mesh shaders
+    std::vector<VkDescriptorSetLayout> setLayouts{descriptorSetLayout};
+    if (meshShaders) {
+      setLayouts.push_back(meshletRenderer.descriptorSetLayout());
+    }
+    if (bindless) {
+      if (!meshShaders) {
+        setLayouts.push_back(emptySetLayout);
+      }
+      setLayouts.push_back(textureTable.descriptorSetLayout());
+    }
+    VkPushConstantRange pushConstantRange{.stageFlags = pushConstantStages(),
+                                          .offset = 0,
+                                          .size = sizeof(DrawConstants)};
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &descriptorSetLayout};
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = setLayouts.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange};
 
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
                                &pipelineLayout) != VK_SUCCESS) {
@@ -1584,12 +2712,12 @@ class HelloTriangleApplication {
 
     VkGraphicsPipelineCreateInfo pipelineInfo{
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = 2,
-        .pStages = shaderStages,
+        .stageCount = static_cast<uint32_t>(shaderStages.size()),
+        .pStages = shaderStages.data(),
 
         .pDynamicState = &dynamicState,
-        .pInputAssemblyState = &assemblyInfo,
-        .pVertexInputState = &vertexInputInfo,
+        .pInputAssemblyState = meshShaders ? nullptr : &assemblyInfo,
+        .pVertexInputState = meshShaders ? nullptr : &vertexInputInfo,
         .pRasterizationState = &rasterizer,
         .pViewportState = &viewportState,
         .pMultisampleState = &multisampling,
@@ -1600,15 +2728,28 @@ class HelloTriangleApplication {
         .renderPass = renderPass,
         .subpass = 0};
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                  nullptr, &graphicsPipeline) != VK_SUCCESS) {
+    auto start = std::chrono::steady_clock::now();
+    if (vkCreateGraphicsPipelines(device, pipelineCache.handle(), 1,
+                                  &pipelineInfo, nullptr,
+                                  &graphicsPipeline) != VK_SUCCESS) {
       throw std::runtime_error("failed to create graphics pipeline");
     }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // runs on a worker during startup; one write keeps the line in one piece
+    std::ostringstream message;
+    message << "created graphics pipeline ("
+            << (pipelineCache.isWarm() ? "warm" : "cold") << " cache) in "
+            << elapsed.count() << " ms\n";
+    std::cout << message.str();
 
     // Once the pipeline has been created, we don't need the shader modules
     // anymore
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
-    vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    for (auto shaderModule : shaderModules) {
+      vkDestroyShaderModule(device, shaderModule, nullptr);
+    }
+
+    commandCache.invalidate();
   }
 
   VkShaderModule createShaderModule(std::span<const char> code) {
@@ -1627,6 +2768,7 @@ class HelloTriangleApplication {
   }
 
   void createImageViews() {
+    TRACE_FUNCTION();
     swapChainImageViews.resize(swapChainImages.size());
     for (int i = 0; i < swapChainImageViews.size(); ++i) {
       swapChainImageViews[i] =
@@ -1636,6 +2778,7 @@ class HelloTriangleApplication {
   }
 
   void createSwapChain() {
+    TRACE_FUNCTION();
     auto swapChainSupport = querySwapChainSupport(physicalDevice, surface);
     auto surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
     auto presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
@@ -1690,8 +2833,70 @@ class HelloTriangleApplication {
     swapChainExtent = extent;
   }
 
+  // Headless replacement for createSwapChain(): images to render into, and
+  // buffers to read them back through
+  void createOffscreenTargets() {
+    TRACE_FUNCTION();
+    swapChainImageFormat = OFFSCREEN_FORMAT;
+    swapChainExtent = {options.width, options.height};
+
+    swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+    offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    readbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    readbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    const VkDeviceSize frameSize =
+        static_cast<VkDeviceSize>(options.width) * options.height * 4;
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+      createImage(options.width, options.height, 1, VK_SAMPLE_COUNT_1_BIT,
+                  OFFSCREEN_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i],
+                  offscreenImagesMemory[i]);
+      createBuffer(frameSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   readbackBuffers[i], readbackBuffersMemory[i]);
+    }
+  }
+
+  // Writes the last rendered frame as a binary PPM. The device must be idle.
+  void writeLastFrame(const std::string& path) const {
+    if (frameCount == 0) {
+      throw std::runtime_error("no frame was rendered");
+    }
+    const uint32_t slot =
+        (currentFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+    const auto* rgba =
+        static_cast<const uint8_t*>(readbackBuffersMemory[slot].mapped);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "P6\n"
+        << swapChainExtent.width << " " << swapChainExtent.height << "\n255\n";
+    const size_t pixels =
+        static_cast<size_t>(swapChainExtent.width) * swapChainExtent.height;
+    std::vector<uint8_t> rgb(pixels * 3);
+    for (size_t i = 0; i < pixels; ++i) {
+      std::copy_n(rgba + i * 4, 3, rgb.data() + i * 3);
+    }
+    out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    if (!out) {
+      throw std::runtime_error("failed to write " + path);
+    }
+    std::cout << "wrote frame " << frameCount << " to " << path << "\n";
+  }
+
   void cleanupSwapChain() {
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    if (options.headless) {
+      for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        vkDestroyImage(device, swapChainImages[i], nullptr);
+        allocator.free(offscreenImagesMemory[i]);
+        vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+        allocator.free(readbackBuffersMemory[i]);
+      }
+    } else {
+      vkDestroySwapchainKHR(device, swapChain, nullptr);
+    }
 
     for (auto framebuffer : swapChainFramebuffers) {
       vkDestroyFramebuffer(device, framebuffer, nullptr);
@@ -1702,11 +2907,11 @@ class HelloTriangleApplication {
 
     vkDestroyImageView(device, depthImageView, nullptr);
     vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+    allocator.free(depthImageMemory);
 
     vkDestroyImageView(device, colorImageView, nullptr);
     vkDestroyImage(device, colorImage, nullptr);
-    vkFreeMemory(device, colorImageMemory, nullptr);
+    allocator.free(colorImageMemory);
   }
 
   void recreateSwapChain() {
@@ -1728,32 +2933,126 @@ class HelloTriangleApplication {
     createColorResources();
     createDepthResources();
     createFramebuffers();
+    // the framebuffers and possibly the image count changed
+    createCommandCache();
+    if (recorderEnabled()) {
+      recorder.allocate(recorderSlotCount());
+    }
   }
 
   void mainLoop() {
-    while (!glfwWindowShouldClose(window)) {
-      glfwPollEvents();
+    const uint32_t frameLimit = options.frameLimit();
+    auto start = std::chrono::steady_clock::now();
+    // not counting frames rendered by benchmarkInstances()
+    const uint64_t firstFrame = frameCount;
+
+    while (frameLimit == 0 || frameCount - firstFrame < frameLimit) {
+      if (!options.headless) {
+        if (glfwWindowShouldClose(window)) {
+          break;
+        }
+        glfwPollEvents();
+      }
       drawFrame();
     }
 
     vkDeviceWaitIdle(device);
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    const uint64_t frames = frameCount - firstFrame;
+    std::cout << "rendered " << frames << " frames at "
+              << swapChainExtent.width << "x" << swapChainExtent.height << ", "
+              << msaaSamples << "x MSAA in " << elapsed.count() << " ms ("
+              << elapsed.count() / std::max<uint64_t>(frames, 1)
+              << " ms/frame, " << frames * 1000.0 / elapsed.count()
+              << " fps)\n";
+
+    if (!options.outputPath.empty()) {
+      writeLastFrame(options.outputPath);
+    }
+
+    if (options.cacheCommands) {
+      commandCache.printStats(std::cout);
+    }
+    gpuProfiler.collect();
+    gpuProfiler.printStats(std::cout);
+    if (meshletPath) {
+      for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        meshletRenderer.collect(frame);
+      }
+      meshletRenderer.printStats(std::cout);
+    }
+    if (options.gpuCulling) {
+      for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        drawCuller.collect(frame);
+      }
+      drawCuller.printStats(std::cout);
+    }
+    descriptors.printStats(std::cout);
+    if (!options.gpuProfilePath.empty()) {
+      writeGpuProfile(options.gpuProfilePath);
+    }
+  }
+
+  void writeTrace(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    trace::writeChromeJson(out);
+    if (!out) {
+      throw std::runtime_error("failed to write " + path);
+    }
+    std::cout << "wrote CPU trace to " << path << "\n";
+  }
+
+  void writeGpuProfile(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (path.ends_with(".csv")) {
+      gpuProfiler.writeCsv(out);
+    } else {
+      gpuProfiler.writeJson(out);
+    }
+    if (!out) {
+      throw std::runtime_error("failed to write " + path);
+    }
   }
 
   void drawFrame() {
-    // This fence ensures that we can start re-using the command buffer
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
-                    std::numeric_limits<uint64_t>::max());
+    TRACE_FUNCTION();
+    {
+      TRACE_SCOPE("wait for frame fence");
+      // This fence ensures that we can start re-using the command buffer
+      vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
+                      std::numeric_limits<uint64_t>::max());
+    }
+
+    // release staging memory of finished uploads
+    uploads.collect();
+    gpuProfiler.collect();
+    if (meshletPath) {
+      meshletRenderer.collect(currentFrame);
+    }
+    if (options.gpuCulling) {
+      drawCuller.collect(currentFrame);
+    }
+    // and the sets made for the frame the last time round
+    descriptors.beginFrame(currentFrame);
 
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(
-        device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
-        VK_NULL_HANDLE, &imageIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-      // Not possible to present to the swap chain in this state
-      recreateSwapChain();
-      return;
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-      throw std::runtime_error("failed to acquire swap chain image");
+    if (options.headless) {
+      // each frame slot has its own offscreen image
+      imageIndex = currentFrame;
+    } else {
+      TRACE_SCOPE("acquire image");
+      VkResult result = vkAcquireNextImageKHR(
+          device, swapChain, UINT64_MAX,
+          imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Not possible to present to the swap chain in this state
+        recreateSwapChain();
+        return;
+      } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("failed to acquire swap chain image");
+      }
     }
 
     // only reset the fence if we are submitting work
@@ -1761,10 +3060,15 @@ class HelloTriangleApplication {
     // inFlightFences[i] never gets signalled.
     vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-    vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
-
-    updateUniformBuffer(currentFrame);
+    VkCommandBuffer commandBuffer;
+    {
+      TRACE_SCOPE("record commands");
+      commandBuffer = prepareCommandBuffer(imageIndex);
+    }
+    {
+      TRACE_SCOPE("update uniforms");
+      updateUniformBuffer(currentFrame);
+    }
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1775,19 +3079,33 @@ class HelloTriangleApplication {
     VkSemaphore waitSemaphores[]{imageAvailableSemaphores[currentFrame]};
     VkPipelineStageFlags waitStages[] = {
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
+    // (there's nothing to wait for or signal with offscreen images)
+    submitInfo.waitSemaphoreCount = options.headless ? 0 : 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+    submitInfo.pCommandBuffers = &commandBuffer;
 
     VkSemaphore signalSemaphores[]{renderFinishedSemaphores[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = options.headless ? 0 : 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-                      inFlightFences[currentFrame]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to submit draw command buffer");
+    {
+      TRACE_SCOPE("submit");
+      // submit anything uploaded since the last frame ahead of the draw, which
+      // then executes after it on the graphics queue
+      uploads.flush();
+
+      if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+                        inFlightFences[currentFrame]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer");
+      }
+    }
+    ++frameCount;
+
+    if (options.headless) {
+      currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+      return;
     }
 
     VkPresentInfoKHR presentInfo{};
@@ -1803,7 +3121,11 @@ class HelloTriangleApplication {
     presentInfo.pResults = nullptr;
 
     // Present the results!!
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    VkResult result;
+    {
+      TRACE_SCOPE("present");
+      result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
         framebufferResized) {
       framebufferResized = false;
@@ -1822,44 +3144,68 @@ class HelloTriangleApplication {
     float time = std::chrono::duration<float, std::chrono::seconds::period>(
                      currentTime - startTime)
                      .count();
+    if (options.headless) {
+      // a fixed time step, so the same frame always looks the same
+      time = frameCount / 60.f;
+    }
 
     UniformBufferObject ubo{};
     // rotate the model around the z-axis at 90 degrees/s
-    ubo.model = glm::rotate(glm::mat4(1.f), time * glm::radians(90.f),
-                            glm::vec3(0, 0, 1.f));
-    ubo.view = glm::lookAt(glm::vec3(2.f, 2.f, 2.f), glm::vec3(0, 0, 0),
+    const glm::mat4 rotation = glm::rotate(
+        glm::mat4(1.f), time * glm::radians(90.f), glm::vec3(0, 0, 1.f));
+    // positions come out of packed vertices in [0, 1]; back to model space
+    ubo.model = glm::translate(rotation, vertexQuantization.posOffset);
+    ubo.model = glm::scale(ubo.model, vertexQuantization.posScale);
+    // backed off to fit the whole grid of instances in view
+    const glm::vec3 eye = glm::vec3(2.f, 2.f, 2.f) * sceneScale;
+    ubo.view = glm::lookAt(eye, glm::vec3(0, 0, 0),
                            glm::vec3(0, 0, 1.f));  // up is +z
     ubo.proj = glm::perspective(
         glm::radians(45.f),
-        swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.f);
+        swapChainExtent.width / (float)swapChainExtent.height,
+        0.1f * sceneScale, 10.f * sceneScale);
 
     // switch from OpenGL convention for clip coordinates (y up) to Vulkan
     // convention (y down) invert the y scaling factor in the projection matrix
     ubo.proj[1][1] *= -1;
 
-    memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+    // first in the frame's region, where recordDraws() bound it
+    uniformRing.beginFrame(currentImage);
+    uniformRing.push(ubo);
+    updateInstances(currentImage, time);
+
+    if (meshletPath) {
+      // meshlet bounds are in the model space of the unpacked vertices
+      meshletRenderer.updateCulling(
+          currentImage, ubo.proj * ubo.view * rotation,
+          glm::vec3(glm::inverse(rotation) * glm::vec4(eye, 1.f)));
+    }
+    if (options.gpuCulling) {
+      // as are the draws' bounds
+      drawCuller.updateCulling(currentImage, ubo.proj * ubo.view * rotation);
+    }
   }
 
   void cleanup() {
     cleanupSwapChain();
 
+    uniformRing.destroy();
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-      vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+      vkDestroyBuffer(device, instanceBuffers[i], nullptr);
+      allocator.free(instanceBuffersMemory[i]);
     }
 
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    textureTable.destroy();
 
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
+    allocator.free(vertexBufferMemory);
 
     vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
+    allocator.free(indexBufferMemory);
 
     vkDestroyImageView(device, textureImageView, nullptr);
     vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+    allocator.free(textureImageMemory);
 
     vkDestroySampler(device, textureSampler, nullptr);
 
@@ -1869,24 +3215,50 @@ class HelloTriangleApplication {
       vkDestroyFence(device, inFlightFences[i], nullptr);
     }
 
+    commandCache.destroy();
+    recorder.destroy();
     // This also frees all command buffers (which are owned by the pool)
     vkDestroyCommandPool(device, commandPool, nullptr);
 
+    printStagingStats();
+    uploads.destroy();
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator.free(stagingBufferMemory);
+
     vkDestroyRenderPass(device, renderPass, nullptr);
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (!pipelineCache.save()) {
+      std::cerr << "failed to save pipeline cache to " << PIPELINE_CACHE_PATH
+                << "\n";
+    }
+    pipelineCache.destroy();
+    mipGenerator.destroy();
+    meshletRenderer.destroy();
+    drawCuller.destroy();
+    descriptors.destroy();
+    gpuProfiler.destroy();
+    allocator.destroy();
     vkDestroyDevice(device, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!options.headless) {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!options.headless) {
+      glfwDestroyWindow(window);
+      glfwTerminate();
+    }
   }
 };
 
-int main() {
-  HelloTriangleApplication app;
-
+int main(int argc, char** argv) {
   try {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+      return EXIT_SUCCESS;
+    }
+
+    HelloTriangleApplication app(options);
     app.run();
   } catch (const std::exception& e) {
     std::cerr << e.what() << std::endl;
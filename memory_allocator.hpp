@@ -0,0 +1,433 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "utils.hpp"
+
+// What kind of resource lives in a range of device memory. Linear resources
+// (buffers, linear-tiled images) and optimal-tiled images must not share a
+// bufferImageGranularity-sized page, so the allocator needs to know which is
+// which.
+enum class AllocationKind : uint8_t { Free, Linear, Optimal };
+
+inline constexpr VkDeviceSize alignUp(VkDeviceSize value,
+                                      VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+inline constexpr VkDeviceSize alignDown(VkDeviceSize value,
+                                        VkDeviceSize alignment) {
+  return value / alignment * alignment;
+}
+
+struct AllocatorStats {
+  uint32_t blockCount = 0;
+  uint32_t dedicatedCount = 0;
+  uint32_t allocationCount = 0;
+  VkDeviceSize blockBytes = 0;
+  VkDeviceSize usedBytes = 0;
+  uint32_t freeRangeCount = 0;
+  VkDeviceSize largestFreeRange = 0;
+
+  VkDeviceSize freeBytes() const { return blockBytes - usedBytes; }
+
+  // 0 when all free memory is one contiguous range, approaching 1 as the free
+  // memory gets split into many small ranges
+  double fragmentation() const {
+    if (freeBytes() == 0) {
+      return 0.0;
+    }
+    return 1.0 - static_cast<double>(largestFreeRange) / freeBytes();
+  }
+};
+
+// Hands out offset ranges within a single block of memory. It doesn't touch
+// Vulkan at all, which keeps the placement logic testable without a device.
+class BlockSubAllocator {
+ public:
+  BlockSubAllocator(VkDeviceSize size, VkDeviceSize granularity)
+      : blockSize(size), granularity(std::max<VkDeviceSize>(granularity, 1)) {
+    ranges.emplace(0, Range{.size = size, .kind = AllocationKind::Free});
+  }
+
+  // First-fit search through the free ranges. Returns the offset of the
+  // allocation, or nothing if no free range can hold it.
+  std::optional<VkDeviceSize> allocate(VkDeviceSize size,
+                                       VkDeviceSize alignment,
+                                       AllocationKind kind) {
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    for (auto iter = ranges.begin(); iter != ranges.end(); ++iter) {
+      auto& [rangeOffset, range] = *iter;
+      if (range.kind != AllocationKind::Free || range.size < size) {
+        continue;
+      }
+
+      VkDeviceSize offset = alignUp(rangeOffset, alignment);
+
+      // bump to the next page if the previous resource is of a different kind
+      // and would share a page with us
+      if (iter != ranges.begin()) {
+        const auto& [prevOffset, prev] = *std::prev(iter);
+        if (conflicts(prev.kind, kind) &&
+            onSamePage(prevOffset + prev.size - 1, offset)) {
+          offset = alignUp(offset, std::max(alignment, granularity));
+        }
+      }
+
+      const VkDeviceSize rangeEnd = rangeOffset + range.size;
+      if (offset + size > rangeEnd) {
+        continue;
+      }
+
+      // same check against the resource that follows
+      if (auto next = std::next(iter); next != ranges.end()) {
+        if (conflicts(next->second.kind, kind) &&
+            onSamePage(offset + size - 1, next->first)) {
+          continue;
+        }
+      }
+
+      // split the free range into [padding][allocation][tail]
+      const VkDeviceSize padding = offset - rangeOffset;
+      const VkDeviceSize tail = rangeEnd - (offset + size);
+      if (padding > 0) {
+        range.size = padding;
+      } else {
+        ranges.erase(iter);
+      }
+      ranges.emplace(offset, Range{.size = size, .kind = kind});
+      if (tail > 0) {
+        ranges.emplace(offset + size,
+                       Range{.size = tail, .kind = AllocationKind::Free});
+      }
+
+      usedBytes += size;
+      ++allocationCount;
+      return offset;
+    }
+
+    return std::nullopt;
+  }
+
+  void free(VkDeviceSize offset) {
+    auto iter = ranges.find(offset);
+    if (iter == ranges.end() || iter->second.kind == AllocationKind::Free) {
+      throw std::runtime_error("freeing memory range that isn't allocated");
+    }
+
+    usedBytes -= iter->second.size;
+    --allocationCount;
+    iter->second.kind = AllocationKind::Free;
+
+    // merge with the free neighbours
+    if (auto next = std::next(iter);
+        next != ranges.end() && next->second.kind == AllocationKind::Free) {
+      iter->second.size += next->second.size;
+      ranges.erase(next);
+    }
+    if (iter != ranges.begin()) {
+      auto prev = std::prev(iter);
+      if (prev->second.kind == AllocationKind::Free) {
+        prev->second.size += iter->second.size;
+        ranges.erase(iter);
+      }
+    }
+  }
+
+  bool empty() const { return allocationCount == 0; }
+  VkDeviceSize size() const { return blockSize; }
+  VkDeviceSize used() const { return usedBytes; }
+  uint32_t allocations() const { return allocationCount; }
+
+  void accumulateStats(AllocatorStats& stats) const {
+    stats.blockBytes += blockSize;
+    stats.usedBytes += usedBytes;
+    stats.allocationCount += allocationCount;
+    for (const auto& [offset, range] : ranges) {
+      if (range.kind == AllocationKind::Free) {
+        ++stats.freeRangeCount;
+        stats.largestFreeRange = std::max(stats.largestFreeRange, range.size);
+      }
+    }
+  }
+
+ private:
+  struct Range {
+    VkDeviceSize size;
+    AllocationKind kind;
+  };
+
+  static bool conflicts(AllocationKind a, AllocationKind b) {
+    return a != AllocationKind::Free && b != AllocationKind::Free && a != b;
+  }
+
+  bool onSamePage(VkDeviceSize a, VkDeviceSize b) const {
+    return alignDown(a, granularity) == alignDown(b, granularity);
+  }
+
+  VkDeviceSize blockSize;
+  VkDeviceSize granularity;
+  VkDeviceSize usedBytes = 0;
+  uint32_t allocationCount = 0;
+  // keyed by offset; covers the whole block, free ranges included
+  std::map<VkDeviceSize, Range> ranges;
+};
+
+struct Allocation {
+  static constexpr uint32_t DEDICATED = ~0u;
+
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  // persistently mapped pointer to the start of the allocation, for
+  // host-visible memory types. nullptr otherwise.
+  void* mapped = nullptr;
+  uint32_t memoryType = 0;
+  uint32_t block = DEDICATED;
+};
+
+// Sub-allocates buffers and images out of large VkDeviceMemory blocks, one
+// list of blocks per memory type. Keeps us well under maxMemoryAllocationCount
+// and avoids a driver round-trip for every resource.
+class DeviceMemoryAllocator {
+ public:
+  static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE) {
+    this->device = device;
+    blockSize = preferredBlockSize;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    granularity = properties.limits.bufferImageGranularity;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    blocks.resize(memProperties.memoryTypeCount);
+  }
+
+  uint32_t findMemoryType(uint32_t typeFilter,
+                          VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+      if (hasBit(typeFilter, i) &&
+          hasFlags(memProperties.memoryTypes[i].propertyFlags, properties)) {
+        // found it
+        return i;
+      }
+    }
+
+    throw std::runtime_error("unable to find suitable memory type");
+  }
+
+  Allocation allocate(const VkMemoryRequirements& requirements,
+                      VkMemoryPropertyFlags properties,
+                      AllocationKind kind) {
+    const uint32_t memoryType =
+        findMemoryType(requirements.memoryTypeBits, properties);
+    const VkDeviceSize typeBlockSize = blockSizeFor(memoryType);
+
+    // large resources get their own allocation rather than eating most of a
+    // block
+    if (requirements.size > typeBlockSize / 2) {
+      return allocateDedicated(requirements.size, memoryType);
+    }
+
+    auto& typeBlocks = blocks[memoryType];
+    for (uint32_t i = 0; i < typeBlocks.size(); i++) {
+      if (!typeBlocks[i]) {
+        continue;
+      }
+      if (auto offset = typeBlocks[i]->ranges.allocate(
+              requirements.size, requirements.alignment, kind)) {
+        return makeAllocation(*typeBlocks[i], memoryType, i, *offset,
+                              requirements.size);
+      }
+    }
+
+    const uint32_t blockIndex = createBlock(memoryType, typeBlockSize);
+    auto& block = *typeBlocks[blockIndex];
+    auto offset =
+        block.ranges.allocate(requirements.size, requirements.alignment, kind);
+    if (!offset) {
+      throw std::runtime_error("allocation does not fit in a fresh block");
+    }
+    return makeAllocation(block, memoryType, blockIndex, *offset,
+                          requirements.size);
+  }
+
+  void free(Allocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+      return;
+    }
+
+    if (allocation.block == Allocation::DEDICATED) {
+      // unmapped implicitly by vkFreeMemory
+      vkFreeMemory(device, allocation.memory, nullptr);
+      --dedicatedCount;
+      dedicatedBytes -= allocation.size;
+    } else {
+      auto& typeBlocks = blocks[allocation.memoryType];
+      auto& block = typeBlocks[allocation.block];
+      block->ranges.free(allocation.offset);
+
+      // keep one empty block around per type so that a free/allocate pair
+      // doesn't round-trip to the driver
+      if (block->ranges.empty() && countEmptyBlocks(allocation.memoryType) > 1) {
+        vkFreeMemory(device, block->memory, nullptr);
+        block.reset();
+      }
+    }
+
+    allocation = {};
+  }
+
+  void destroy() {
+    for (auto& typeBlocks : blocks) {
+      for (auto& block : typeBlocks) {
+        if (block) {
+          vkFreeMemory(device, block->memory, nullptr);
+        }
+      }
+      typeBlocks.clear();
+    }
+  }
+
+  AllocatorStats stats() const {
+    AllocatorStats stats;
+    for (const auto& typeBlocks : blocks) {
+      for (const auto& block : typeBlocks) {
+        if (block) {
+          ++stats.blockCount;
+          block->ranges.accumulateStats(stats);
+        }
+      }
+    }
+    stats.dedicatedCount = dedicatedCount;
+    stats.allocationCount += dedicatedCount;
+    stats.blockBytes += dedicatedBytes;
+    stats.usedBytes += dedicatedBytes;
+    return stats;
+  }
+
+  void printStats(std::ostream& out) const {
+    auto s = stats();
+    out << "device memory: " << s.allocationCount << " allocations in "
+        << s.blockCount << " blocks + " << s.dedicatedCount << " dedicated, "
+        << (s.usedBytes >> 10) << "/" << (s.blockBytes >> 10)
+        << " KiB used, " << s.freeRangeCount << " free ranges (largest "
+        << (s.largestFreeRange >> 10) << " KiB), fragmentation "
+        << s.fragmentation() << "\n";
+  }
+
+ private:
+  struct Block {
+    VkDeviceMemory memory;
+    void* mapped;
+    BlockSubAllocator ranges;
+  };
+
+  // Small heaps (e.g. the 256MB host-visible device-local heap) get smaller
+  // blocks so a single block doesn't claim a big chunk of the heap.
+  VkDeviceSize blockSizeFor(uint32_t memoryType) const {
+    auto heapIndex = memProperties.memoryTypes[memoryType].heapIndex;
+    auto heapSize = memProperties.memoryHeaps[heapIndex].size;
+    return std::min(blockSize, std::max<VkDeviceSize>(heapSize / 8, 1 << 20));
+  }
+
+  bool isHostVisible(uint32_t memoryType) const {
+    return hasFlags(memProperties.memoryTypes[memoryType].propertyFlags,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  }
+
+  VkDeviceMemory allocateMemory(VkDeviceSize size,
+                                uint32_t memoryType,
+                                void** mapped) {
+    VkMemoryAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryType};
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate device memory");
+    }
+
+    *mapped = nullptr;
+    // host-visible memory stays mapped for its whole lifetime, since a memory
+    // object can only be mapped once at a time
+    if (isHostVisible(memoryType) &&
+        vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) !=
+            VK_SUCCESS) {
+      vkFreeMemory(device, memory, nullptr);
+      throw std::runtime_error("failed to map device memory");
+    }
+
+    return memory;
+  }
+
+  Allocation allocateDedicated(VkDeviceSize size, uint32_t memoryType) {
+    Allocation allocation{.size = size, .memoryType = memoryType};
+    allocation.memory = allocateMemory(size, memoryType, &allocation.mapped);
+    ++dedicatedCount;
+    dedicatedBytes += size;
+    return allocation;
+  }
+
+  uint32_t createBlock(uint32_t memoryType, VkDeviceSize size) {
+    void* mapped;
+    VkDeviceMemory memory = allocateMemory(size, memoryType, &mapped);
+    auto block = std::make_unique<Block>(
+        Block{.memory = memory,
+              .mapped = mapped,
+              .ranges = BlockSubAllocator(size, granularity)});
+
+    // reuse a slot left behind by a freed block so indices stay stable
+    auto& typeBlocks = blocks[memoryType];
+    auto slot = std::find(typeBlocks.begin(), typeBlocks.end(), nullptr);
+    if (slot != typeBlocks.end()) {
+      *slot = std::move(block);
+      return static_cast<uint32_t>(slot - typeBlocks.begin());
+    }
+    typeBlocks.push_back(std::move(block));
+    return static_cast<uint32_t>(typeBlocks.size() - 1);
+  }
+
+  uint32_t countEmptyBlocks(uint32_t memoryType) const {
+    return std::count_if(
+        blocks[memoryType].begin(), blocks[memoryType].end(),
+        [](const auto& block) { return block && block->ranges.empty(); });
+  }
+
+  static Allocation makeAllocation(const Block& block,
+                                   uint32_t memoryType,
+                                   uint32_t blockIndex,
+                                   VkDeviceSize offset,
+                                   VkDeviceSize size) {
+    return {.memory = block.memory,
+            .offset = offset,
+            .size = size,
+            .mapped = block.mapped
+                          ? static_cast<char*>(block.mapped) + offset
+                          : nullptr,
+            .memoryType = memoryType,
+            .block = blockIndex};
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+  VkDeviceSize granularity = 1;
+  VkPhysicalDeviceMemoryProperties memProperties{};
+  std::vector<std::vector<std::unique_ptr<Block>>> blocks;
+  uint32_t dedicatedCount = 0;
+  VkDeviceSize dedicatedBytes = 0;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "memory_allocator.hpp"
+#include "mesh_optimizer.hpp"
+#include "obj_loader.hpp"
+#include "types.hpp"
+#include "utils.hpp"
+
+// Mesh data ready for upload. Either memory-mapped from a cache file or, if
+// the cache couldn't be used, owned.
+struct LoadedMesh {
+  std::span<const Vertex> vertices;
+  std::span<const uint32_t> indices;
+
+  MappedFile file;
+  MeshData owned;
+};
+
+// Binary cache of a processed mesh (parsed, then reordered by
+// mesh::optimize()): the final vertex and index arrays, laid
+// out so they can be copied straight into a staging buffer. Keyed on a hash of
+// the source file, so editing the source invalidates it.
+//
+// Layout: Header, then the vertex array and the index array, each
+// starting at a DATA_ALIGNMENT boundary.
+class MeshCache {
+ public:
+  // bump whenever the layout or the processing of the data changes
+  static constexpr uint32_t VERSION = 2;
+  static constexpr uint64_t DATA_ALIGNMENT = 256;
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint32_t vertexStride;
+    uint32_t indexSize;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+  };
+
+  static constexpr char MAGIC[4]{'V', 'B', 'M', 'C'};
+
+  static std::optional<LoadedMesh> open(const std::string& cachePath,
+                                        uint64_t sourceHash,
+                                        uint64_t sourceSize) {
+    MappedFile file;
+    try {
+      file = MappedFile(cachePath);
+    } catch (const std::exception&) {
+      return std::nullopt;
+    }
+
+    auto bytes = file.bytes();
+    if (bytes.size() < sizeof(Header)) {
+      return std::nullopt;
+    }
+
+    Header header;
+    memcpy(&header, bytes.data(), sizeof(Header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.version != VERSION || header.sourceHash != sourceHash ||
+        header.sourceSize != sourceSize ||
+        header.vertexStride != sizeof(Vertex) ||
+        header.indexSize != sizeof(uint32_t)) {
+      return std::nullopt;
+    }
+
+    const uint64_t vertexBytes = header.vertexCount * sizeof(Vertex);
+    const uint64_t indexBytes = header.indexCount * sizeof(uint32_t);
+    if (header.vertexOffset % DATA_ALIGNMENT != 0 ||
+        header.indexOffset % DATA_ALIGNMENT != 0 ||
+        header.vertexOffset + vertexBytes > bytes.size() ||
+        header.indexOffset + indexBytes > bytes.size()) {
+      return std::nullopt;
+    }
+
+    LoadedMesh mesh;
+    // mmap'd memory is page aligned, so the arrays are suitably aligned
+    mesh.vertices = {
+        reinterpret_cast<const Vertex*>(bytes.data() + header.vertexOffset),
+        header.vertexCount};
+    mesh.indices = {
+        reinterpret_cast<const uint32_t*>(bytes.data() + header.indexOffset),
+        header.indexCount};
+    mesh.file = std::move(file);
+    return mesh;
+  }
+
+  // Writes atomically, so a crash never leaves a truncated cache behind.
+  // Returns false if the cache couldn't be written.
+  static bool write(const std::string& cachePath,
+                    uint64_t sourceHash,
+                    uint64_t sourceSize,
+                    std::span<const Vertex> vertices,
+                    std::span<const uint32_t> indices) {
+    Header header{.version = VERSION,
+                  .sourceHash = sourceHash,
+                  .sourceSize = sourceSize,
+                  .vertexStride = sizeof(Vertex),
+                  .indexSize = sizeof(uint32_t),
+                  .vertexCount = vertices.size(),
+                  .indexCount = indices.size()};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.vertexOffset = alignUp(sizeof(Header), DATA_ALIGNMENT);
+    header.indexOffset = alignUp(
+        header.vertexOffset + vertices.size_bytes(), DATA_ALIGNMENT);
+
+    return writeFileAtomically(cachePath, [&](std::ofstream& out) {
+      auto writeAt = [&out](uint64_t offset, const void* data, size_t size) {
+        out.seekp(static_cast<std::streamoff>(offset));
+        out.write(static_cast<const char*>(data), size);
+      };
+      writeAt(0, &header, sizeof(header));
+      writeAt(header.vertexOffset, vertices.data(), vertices.size_bytes());
+      writeAt(header.indexOffset, indices.data(), indices.size_bytes());
+    });
+  }
+
+  // Loads `sourcePath` through the cache next to it, parsing and optimizing
+  // the OBJ and refreshing the cache if it's missing or stale. `optimization`
+  // is only filled in when the mesh was optimized, i.e. not from the cache.
+  static LoadedMesh load(const std::string& sourcePath,
+                         bool& fromCache,
+                         mesh::OptimizationStats* optimization = nullptr) {
+    MappedFile source(sourcePath);
+    const uint64_t sourceHash = hashBytes(source.bytes());
+    const uint64_t sourceSize = source.bytes().size();
+    const std::string cachePath = sourcePath + ".meshcache";
+
+    if (auto cached = open(cachePath, sourceHash, sourceSize)) {
+      fromCache = true;
+      return std::move(*cached);
+    }
+    fromCache = false;
+
+    ObjLoader loader;
+    MeshData data = loader.parse(source.text());
+    const mesh::OptimizationStats stats = mesh::optimize(data);
+    if (optimization) {
+      *optimization = stats;
+    }
+
+    if (write(cachePath, sourceHash, sourceSize, data.vertices,
+              data.indices)) {
+      if (auto cached = open(cachePath, sourceHash, sourceSize)) {
+        return std::move(*cached);
+      }
+    }
+
+    LoadedMesh mesh;
+    mesh.owned = std::move(data);
+    mesh.vertices = mesh.owned.vertices;
+    mesh.indices = mesh.owned.indices;
+    return mesh;
+  }
+};
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "cpu_trace.hpp"
+#include "obj_loader.hpp"
+#include "types.hpp"
+
+// Reorders an indexed triangle list for the GPU, in three passes that each
+// keep what the previous one gained:
+//
+// 1. optimizeVertexCache(): Forsyth's linear-speed vertex cache optimization,
+//    so consecutive triangles share vertices that are still in the
+//    post-transform cache.
+// 2. optimizeOverdraw(): splits that order into clusters at points where the
+//    cache would be cold anyway, and sorts the clusters so the ones facing
+//    out of the mesh are drawn first and occlude the rest (Sander et al.,
+//    "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+// 3. optimizeVertexFetch(): renumbers the vertices in the order the indices
+//    first use them, so fetches walk the vertex buffer forwards, and drops
+//    any that aren't used.
+namespace mesh {
+
+// Post-transform cache efficiency of an index buffer, simulated with a FIFO
+// cache of `cacheSize` vertices
+struct VertexCacheStats {
+  // average cache miss ratio: vertices transformed per triangle, 0.5 to 3
+  double acmr = 0;
+  // average transform to vertex ratio: vertices transformed per vertex
+  // referenced, 1 at best
+  double atvr = 0;
+};
+
+inline constexpr uint32_t DEFAULT_CACHE_SIZE = 16;
+
+// Misses of a FIFO cache, triangle by triangle. The last use of each vertex
+// is tracked by the miss count at the time, so there's no queue to shift.
+class FifoCacheSimulator {
+ public:
+  FifoCacheSimulator(size_t vertexCount, uint32_t cacheSize)
+      : insertedAt(vertexCount, NEVER), cacheSize(cacheSize) {}
+
+  // Returns how many of the triangle's vertices missed
+  uint32_t triangle(const uint32_t* corners) {
+    uint32_t triangleMisses = 0;
+    for (int c = 0; c < 3; ++c) {
+      uint64_t& inserted = insertedAt[corners[c]];
+      if (inserted == NEVER || misses - inserted >= cacheSize) {
+        inserted = misses++;
+        ++triangleMisses;
+      }
+    }
+    return triangleMisses;
+  }
+
+  uint64_t totalMisses() const { return misses; }
+
+ private:
+  static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+  std::vector<uint64_t> insertedAt;
+  uint64_t misses = 0;
+  uint32_t cacheSize;
+};
+
+inline VertexCacheStats analyzeVertexCache(
+    std::span<const uint32_t> indices,
+    size_t vertexCount,
+    uint32_t cacheSize = DEFAULT_CACHE_SIZE) {
+  VertexCacheStats stats;
+  if (indices.size() < 3) {
+    return stats;
+  }
+  FifoCacheSimulator cache(vertexCount, cacheSize);
+  std::vector<bool> referenced(vertexCount);
+  size_t referencedCount = 0;
+  for (size_t i = 0; i + 3 <= indices.size(); i += 3) {
+    cache.triangle(&indices[i]);
+    for (int c = 0; c < 3; ++c) {
+      if (!referenced[indices[i + c]]) {
+        referenced[indices[i + c]] = true;
+        ++referencedCount;
+      }
+    }
+  }
+  stats.acmr = static_cast<double>(cache.totalMisses()) / (indices.size() / 3);
+  stats.atvr = static_cast<double>(cache.totalMisses()) / referencedCount;
+  return stats;
+}
+
+namespace detail {
+
+// Forsyth's scoring, for an LRU cache of CACHE_SIZE vertices
+inline constexpr int CACHE_SIZE = 32;
+inline constexpr float CACHE_DECAY_POWER = 1.5f;
+inline constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+inline constexpr float VALENCE_BOOST_SCALE = 2.0f;
+inline constexpr float VALENCE_BOOST_POWER = 0.5f;
+// past this many remaining triangles, a vertex's valence boost stays the same
+inline constexpr uint32_t MAX_VALENCE = 32;
+
+struct ForsythTables {
+  float cache[CACHE_SIZE];
+  float valence[MAX_VALENCE + 1];
+};
+
+inline const ForsythTables& forsythTables() {
+  static const ForsythTables tables = [] {
+    ForsythTables t;
+    for (int position = 0; position < CACHE_SIZE; ++position) {
+      if (position < 3) {
+        // used by the triangle just emitted: deliberately lower, so the
+        // next triangle doesn't just sweep back over the same edge
+        t.cache[position] = LAST_TRIANGLE_SCORE;
+      } else {
+        const float scale = 1.f / (CACHE_SIZE - 3);
+        t.cache[position] = std::pow(1.f - (position - 3) * scale,
+                                     CACHE_DECAY_POWER);
+      }
+    }
+    t.valence[0] = 0;
+    for (uint32_t remaining = 1; remaining <= MAX_VALENCE; ++remaining) {
+      t.valence[remaining] =
+          VALENCE_BOOST_SCALE *
+          std::pow(static_cast<float>(remaining), -VALENCE_BOOST_POWER);
+    }
+    return t;
+  }();
+  return tables;
+}
+
+inline float vertexScore(int cachePosition, uint32_t remaining) {
+  if (remaining == 0) {
+    // no triangles left to use it
+    return -1;
+  }
+  const auto& tables = forsythTables();
+  const float cache = cachePosition >= 0 ? tables.cache[cachePosition] : 0;
+  return cache + tables.valence[std::min(remaining, MAX_VALENCE)];
+}
+
+}  // namespace detail
+
+// Reorders the triangles of `indices` in place for the post-transform cache
+inline void optimizeVertexCache(std::span<uint32_t> indices,
+                                size_t vertexCount) {
+  using namespace detail;
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0) {
+    return;
+  }
+
+  // triangles using each vertex, as offsets into one array
+  std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+  for (size_t i = 0; i < triangleCount * 3; ++i) {
+    ++firstTriangle[indices[i] + 1];
+  }
+  std::partial_sum(firstTriangle.begin(), firstTriangle.end(),
+                   firstTriangle.begin());
+  std::vector<uint32_t> adjacency(triangleCount * 3);
+  {
+    std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  // remaining[v] counts v's triangles not yet emitted; the first `remaining`
+  // entries of its adjacency are those triangles
+  std::vector<uint32_t> remaining(vertexCount);
+  std::vector<float> score(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    remaining[v] = firstTriangle[v + 1] - firstTriangle[v];
+    score[v] = vertexScore(-1, remaining[v]);
+  }
+
+  std::vector<float> triangleScore(triangleCount);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] +
+                       score[indices[t * 3 + 2]];
+  }
+  std::vector<bool> emitted(triangleCount);
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+
+  // with room for the three vertices pushed in before the oldest drop out
+  std::vector<uint32_t> cache, nextCache;
+  cache.reserve(CACHE_SIZE + 3);
+  nextCache.reserve(CACHE_SIZE + 3);
+
+  size_t scanCursor = 0;
+  int64_t best = -1;
+  while (output.size() < triangleCount * 3) {
+    if (best < 0) {
+      // nothing adjacent to the cache is left: take the next unemitted
+      // triangle, in input order
+      while (emitted[scanCursor]) {
+        ++scanCursor;
+      }
+      best = static_cast<int64_t>(scanCursor);
+    }
+
+    const uint32_t* corners = &indices[best * 3];
+    emitted[best] = true;
+    output.insert(output.end(), corners, corners + 3);
+
+    // detach the triangle from its vertices
+    for (int c = 0; c < 3; ++c) {
+      const uint32_t v = corners[c];
+      uint32_t* triangles = &adjacency[firstTriangle[v]];
+      auto it = std::find(triangles, triangles + remaining[v],
+                          static_cast<uint32_t>(best));
+      std::swap(*it, triangles[remaining[v] - 1]);
+      --remaining[v];
+    }
+
+    // the triangle's vertices move to the front of the LRU cache
+    nextCache.clear();
+    for (int c = 0; c < 3; ++c) {
+      // degenerate triangles repeat a vertex
+      if (std::find(nextCache.begin(), nextCache.end(), corners[c]) ==
+          nextCache.end()) {
+        nextCache.push_back(corners[c]);
+      }
+    }
+    for (uint32_t v : cache) {
+      if (v != corners[0] && v != corners[1] && v != corners[2]) {
+        nextCache.push_back(v);
+      }
+    }
+    std::swap(cache, nextCache);
+
+    // rescore the vertices in the cache and those that just fell out, along
+    // with their triangles, picking the best of those as the next one
+    for (size_t i = 0; i < cache.size(); ++i) {
+      const uint32_t v = cache[i];
+      const int position = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+      const float newScore = vertexScore(position, remaining[v]);
+      const float delta = newScore - score[v];
+      score[v] = newScore;
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        triangleScore[adjacency[firstTriangle[v] + k]] += delta;
+      }
+    }
+    cache.resize(std::min<size_t>(cache.size(), CACHE_SIZE));
+
+    best = -1;
+    float bestScore = -std::numeric_limits<float>::infinity();
+    for (uint32_t v : cache) {
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        const uint32_t t = adjacency[firstTriangle[v] + k];
+        if (triangleScore[t] > bestScore) {
+          bestScore = triangleScore[t];
+          best = t;
+        }
+      }
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices.begin());
+}
+
+// Reorders clusters of triangles in `indices` (already optimized for the
+// vertex cache) so outward-facing ones come first. A cluster boundary goes
+// wherever the cache was cold, and, within those, where the miss rate of the
+// cluster so far is no worse than `threshold` times the rate of the whole
+// run, so splitting costs at most that much in cache efficiency.
+inline void optimizeOverdraw(std::span<uint32_t> indices,
+                             std::span<const Vertex> vertices,
+                             float threshold = 1.05f,
+                             uint32_t cacheSize = DEFAULT_CACHE_SIZE) {
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  std::vector<uint32_t> misses(triangleCount);
+  {
+    FifoCacheSimulator cache(vertices.size(), cacheSize);
+    for (size_t t = 0; t < triangleCount; ++t) {
+      misses[t] = cache.triangle(&indices[t * 3]);
+    }
+  }
+
+  // hard boundaries: all three vertices missed, so the cache starts over
+  std::vector<size_t> hard;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    if (t == 0 || misses[t] == 3) {
+      hard.push_back(t);
+    }
+  }
+  hard.push_back(triangleCount);
+
+  std::vector<size_t> clusters;
+  for (size_t h = 0; h + 1 < hard.size(); ++h) {
+    const size_t begin = hard[h], end = hard[h + 1];
+    uint32_t runMisses = 0;
+    for (size_t t = begin; t < end; ++t) {
+      runMisses += misses[t];
+    }
+    const double limit =
+        threshold * static_cast<double>(runMisses) / (end - begin);
+
+    clusters.push_back(begin);
+    uint32_t clusterMisses = 0;
+    for (size_t t = begin; t < end; ++t) {
+      clusterMisses += misses[t];
+      const size_t clusterSize = t + 1 - clusters.back();
+      // no tiny clusters: a few triangles say little about the direction
+      // they face
+      if (t + 1 < end && clusterSize >= cacheSize &&
+          clusterMisses <= limit * clusterSize) {
+        clusters.push_back(t + 1);
+        clusterMisses = 0;
+      }
+    }
+  }
+  clusters.push_back(triangleCount);
+
+  // area-weighted centroid and normal of each cluster, and of the mesh
+  struct Cluster {
+    size_t begin, end;
+    glm::vec3 centroid;
+    glm::vec3 normal;
+    float sortKey;
+  };
+  std::vector<Cluster> sorted;
+  glm::vec3 meshCentroid(0.f);
+  float meshArea = 0;
+  for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+    Cluster cluster{.begin = clusters[c],
+                    .end = clusters[c + 1],
+                    .centroid = glm::vec3(0.f),
+                    .normal = glm::vec3(0.f)};
+    float area = 0;
+    for (size_t t = cluster.begin; t < cluster.end; ++t) {
+      const glm::vec3& a = vertices[indices[t * 3]].pos;
+      const glm::vec3& b = vertices[indices[t * 3 + 1]].pos;
+      const glm::vec3& p = vertices[indices[t * 3 + 2]].pos;
+      // twice the area, pointing along the normal
+      const glm::vec3 n = glm::cross(b - a, p - a);
+      const float triangleArea = glm::length(n);
+      cluster.normal += n;
+      cluster.centroid += (a + b + p) * (triangleArea / 3);
+      area += triangleArea;
+    }
+    meshCentroid += cluster.centroid;
+    meshArea += area;
+    if (area > 0) {
+      cluster.centroid /= area;
+    }
+    sorted.push_back(cluster);
+  }
+  if (meshArea > 0) {
+    meshCentroid /= meshArea;
+  }
+
+  for (Cluster& cluster : sorted) {
+    const float length = glm::length(cluster.normal);
+    cluster.sortKey =
+        length > 0 ? glm::dot(cluster.centroid - meshCentroid,
+                              cluster.normal / length)
+                   : 0;
+  }
+  // most outward first; stable so ties keep their cache-friendly order
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Cluster& a, const Cluster& b) {
+                     return a.sortKey > b.sortKey;
+                   });
+
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+  for (const Cluster& cluster : sorted) {
+    output.insert(output.end(), indices.begin() + cluster.begin * 3,
+                  indices.begin() + cluster.end * 3);
+  }
+  std::copy(output.begin(), output.end(), indices.begin());
+}
+
+// Renumbers vertices in order of first use by `indices` and drops unused
+// ones, updating both arrays
+inline void optimizeVertexFetch(std::vector<Vertex>& vertices,
+                                std::span<uint32_t> indices) {
+  static constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> remap(vertices.size(), UNUSED);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+  for (uint32_t& index : indices) {
+    if (remap[index] == UNUSED) {
+      remap[index] = static_cast<uint32_t>(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices = std::move(reordered);
+}
+
+struct OptimizationStats {
+  VertexCacheStats before;
+  VertexCacheStats after;
+  double milliseconds = 0;
+};
+
+// All three passes on `mesh`
+inline OptimizationStats optimize(MeshData& mesh) {
+  TRACE_FUNCTION();
+  auto start = std::chrono::steady_clock::now();
+  OptimizationStats stats;
+  stats.before = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+  optimizeVertexCache(mesh.indices, mesh.vertices.size());
+  optimizeOverdraw(mesh.indices, mesh.vertices);
+  optimizeVertexFetch(mesh.vertices, mesh.indices);
+
+  stats.after = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.milliseconds = elapsed.count();
+  return stats;
+}
+
+}  // namespace mesh
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "types.hpp"
+
+// Splits an indexed triangle list into meshlets: clusters of up to
+// MAX_MESHLET_VERTICES vertices and MAX_MESHLET_TRIANGLES triangles, each
+// with a bounding sphere and a cone bounding its triangles' normals, so
+// whole clusters can be culled against the frustum and for facing away from
+// the camera before any of their vertices are transformed.
+namespace mesh {
+
+// The limits of the mesh shader in shaders/meshlet.mesh. With 124 triangles
+// the 8-bit primitive indices and a count fit in 384 bytes, a multiple of
+// the 128-byte granularity some hardware allocates mesh output in.
+inline constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+inline constexpr uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+// One cluster, laid out as the std430 struct in the meshlet shaders
+struct Meshlet {
+  // bounding sphere, in model space
+  glm::vec3 center;
+  float radius;
+  // All the triangles face away from the camera when, with d = center -
+  // camera, dot(d, coneAxis) >= coneCutoff * length(d) + radius.
+  // A cone that can't be culled has a zero axis and a cutoff of 1.
+  glm::vec3 coneAxis;
+  float coneCutoff;
+  // into MeshletMesh::vertices
+  uint32_t vertexOffset;
+  // into MeshletMesh::triangles
+  uint32_t triangleOffset;
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+};
+static_assert(sizeof(Meshlet) == 48, "must match the std430 layout");
+
+struct MeshletMesh {
+  std::vector<Meshlet> meshlets;
+  // the vertex buffer index of each meshlet vertex
+  std::vector<uint32_t> vertices;
+  // three 8-bit indices into the meshlet's vertices per triangle, in bits
+  // 0-7, 8-15 and 16-23
+  std::vector<uint32_t> triangles;
+
+  // The triangles again as an index buffer into the vertex buffer, in
+  // meshlet order: meshlet m's run starts at index 3 * triangleOffset.
+  std::vector<uint32_t> indices() const {
+    std::vector<uint32_t> result;
+    result.reserve(triangles.size() * 3);
+    for (const Meshlet& meshlet : meshlets) {
+      for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+        const uint32_t packed = triangles[meshlet.triangleOffset + t];
+        for (int c = 0; c < 3; ++c) {
+          const uint32_t local = (packed >> (8 * c)) & 0xff;
+          result.push_back(vertices[meshlet.vertexOffset + local]);
+        }
+      }
+    }
+    return result;
+  }
+};
+
+namespace detail {
+
+inline glm::vec3 triangleNormal(const glm::vec3& a,
+                                const glm::vec3& b,
+                                const glm::vec3& c) {
+  const glm::vec3 n = glm::cross(b - a, c - a);
+  const float length = glm::length(n);
+  return length > 0.f ? n / length : glm::vec3(0.f);
+}
+
+// Ritter's bounding sphere: grows a sphere through the two furthest apart of
+// the axis extremes until it holds every point. Within a few percent of the
+// smallest sphere, in two passes.
+inline void boundingSphere(std::span<const glm::vec3> points,
+                           glm::vec3& center,
+                           float& radius) {
+  size_t lo[3]{}, hi[3]{};
+  for (size_t i = 1; i < points.size(); ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      if (points[i][axis] < points[lo[axis]][axis]) {
+        lo[axis] = i;
+      }
+      if (points[i][axis] > points[hi[axis]][axis]) {
+        hi[axis] = i;
+      }
+    }
+  }
+  int widest = 0;
+  float widestSpan = -1.f;
+  for (int axis = 0; axis < 3; ++axis) {
+    const glm::vec3 d = points[hi[axis]] - points[lo[axis]];
+    if (glm::dot(d, d) > widestSpan) {
+      widestSpan = glm::dot(d, d);
+      widest = axis;
+    }
+  }
+
+  center = (points[lo[widest]] + points[hi[widest]]) * 0.5f;
+  radius = std::sqrt(widestSpan) * 0.5f;
+  for (const glm::vec3& p : points) {
+    const float distance = glm::length(p - center);
+    if (distance > radius) {
+      // move the far side of the sphere out to p
+      const float grown = (radius + distance) * 0.5f;
+      center += (p - center) * ((grown - radius) / distance);
+      radius = grown;
+    }
+  }
+}
+
+inline void normalCone(std::span<const glm::vec3> normals,
+                       glm::vec3& axis,
+                       float& cutoff) {
+  glm::vec3 sum(0.f);
+  for (const glm::vec3& n : normals) {
+    sum += n;
+  }
+  const float length = glm::length(sum);
+  float minDot = 1.f;
+  if (length > 0.f) {
+    axis = sum / length;
+    for (const glm::vec3& n : normals) {
+      // degenerate triangles face nowhere, so they don't widen the cone
+      if (n != glm::vec3(0.f)) {
+        minDot = std::min(minDot, glm::dot(n, axis));
+      }
+    }
+  }
+  // a cone wider than a hemisphere (or with no axis) always has a triangle
+  // facing the camera; a tiny margin keeps near-hemispheres out too
+  if (length == 0.f || minDot <= 0.1f) {
+    axis = glm::vec3(0.f);
+    cutoff = 1.f;
+    return;
+  }
+  // the sine of the cone's half angle: the test is against the tangent
+  // plane of the cone, not its axis
+  cutoff = std::sqrt(1.f - minDot * minDot);
+}
+
+}  // namespace detail
+
+// Greedy clustering: a meshlet grows by the adjacent triangle that adds the
+// fewest new vertices, preferring on a tie the one whose normal is closest
+// to the meshlet's average so far, which keeps cones narrow. When nothing
+// adjacent is left, it continues with the next unused triangle in index
+// order; after optimize(), that's still nearby.
+inline MeshletMesh buildMeshlets(
+    std::span<const uint32_t> indices,
+    std::span<const Vertex> vertices,
+    uint32_t maxVertices = MAX_MESHLET_VERTICES,
+    uint32_t maxTriangles = MAX_MESHLET_TRIANGLES) {
+  MeshletMesh result;
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0) {
+    return result;
+  }
+
+  // triangles around each vertex, as offsets into one array
+  std::vector<uint32_t> adjacencyOffsets(vertices.size() + 1, 0);
+  for (uint32_t index : indices.first(triangleCount * 3)) {
+    ++adjacencyOffsets[index + 1];
+  }
+  for (size_t v = 0; v < vertices.size(); ++v) {
+    adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+  }
+  std::vector<uint32_t> adjacency(triangleCount * 3);
+  {
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                               adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<glm::vec3> normals(triangleCount);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    normals[t] = detail::triangleNormal(vertices[indices[t * 3]].pos,
+                                        vertices[indices[t * 3 + 1]].pos,
+                                        vertices[indices[t * 3 + 2]].pos);
+  }
+
+  static constexpr uint32_t NOT_IN_MESHLET =
+      std::numeric_limits<uint32_t>::max();
+  // index of each vertex within the current meshlet
+  std::vector<uint32_t> localIndex(vertices.size(), NOT_IN_MESHLET);
+  std::vector<bool> used(triangleCount, false);
+  std::vector<uint32_t> candidates;
+  std::vector<glm::vec3> points, meshletNormals;
+  size_t nextSeed = 0;
+
+  Meshlet meshlet{};
+  glm::vec3 normalSum(0.f);
+
+  auto finish = [&] {
+    points.clear();
+    meshletNormals.clear();
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+      const uint32_t v = result.vertices[meshlet.vertexOffset + i];
+      points.push_back(vertices[v].pos);
+      localIndex[v] = NOT_IN_MESHLET;
+    }
+    detail::boundingSphere(points, meshlet.center, meshlet.radius);
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+      const uint32_t packed = result.triangles[meshlet.triangleOffset + t];
+      glm::vec3 corners[3];
+      for (int c = 0; c < 3; ++c) {
+        corners[c] = points[(packed >> (8 * c)) & 0xff];
+      }
+      meshletNormals.push_back(
+          detail::triangleNormal(corners[0], corners[1], corners[2]));
+    }
+    detail::normalCone(meshletNormals, meshlet.coneAxis, meshlet.coneCutoff);
+    result.meshlets.push_back(meshlet);
+
+    meshlet = {.vertexOffset = static_cast<uint32_t>(result.vertices.size()),
+               .triangleOffset =
+                   static_cast<uint32_t>(result.triangles.size())};
+    normalSum = glm::vec3(0.f);
+    candidates.clear();
+  };
+
+  auto newVertices = [&](uint32_t triangle) {
+    uint32_t count = 0;
+    for (int c = 0; c < 3; ++c) {
+      count += localIndex[indices[triangle * 3 + c]] == NOT_IN_MESHLET;
+    }
+    return count;
+  };
+
+  auto add = [&](uint32_t triangle) {
+    used[triangle] = true;
+    uint32_t packed = 0;
+    for (int c = 0; c < 3; ++c) {
+      const uint32_t v = indices[triangle * 3 + c];
+      if (localIndex[v] == NOT_IN_MESHLET) {
+        localIndex[v] = meshlet.vertexCount++;
+        result.vertices.push_back(v);
+        for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1];
+             ++a) {
+          if (!used[adjacency[a]]) {
+            candidates.push_back(adjacency[a]);
+          }
+        }
+      }
+      packed |= localIndex[v] << (8 * c);
+    }
+    result.triangles.push_back(packed);
+    ++meshlet.triangleCount;
+    normalSum += normals[triangle];
+  };
+
+  for (size_t added = 0; added < triangleCount; ++added) {
+    // the best adjacent triangle that still fits
+    uint32_t best = NOT_IN_MESHLET;
+    uint32_t bestNew = 4;
+    float bestDot = 0.f;
+    const float sumLength = glm::length(normalSum);
+    const glm::vec3 averageNormal =
+        sumLength > 0.f ? normalSum / sumLength : glm::vec3(0.f);
+    size_t kept = 0;
+    for (uint32_t triangle : candidates) {
+      if (used[triangle]) {
+        continue;
+      }
+      candidates[kept++] = triangle;
+      const uint32_t extra = newVertices(triangle);
+      if (meshlet.vertexCount + extra > maxVertices) {
+        continue;
+      }
+      const float dot = glm::dot(normals[triangle], averageNormal);
+      if (extra < bestNew || (extra == bestNew && dot > bestDot)) {
+        best = triangle;
+        bestNew = extra;
+        bestDot = dot;
+      }
+    }
+    candidates.resize(kept);
+
+    if (best == NOT_IN_MESHLET) {
+      while (used[nextSeed]) {
+        ++nextSeed;
+      }
+      best = static_cast<uint32_t>(nextSeed);
+      // neighbours that didn't fit mean the meshlet is full; a triangle from
+      // elsewhere would only make its bounds looser
+      if (!candidates.empty() ||
+          meshlet.vertexCount + newVertices(best) > maxVertices) {
+        finish();
+      }
+    }
+    add(best);
+    if (meshlet.triangleCount == maxTriangles) {
+      finish();
+    }
+  }
+  if (meshlet.triangleCount > 0) {
+    finish();
+  }
+  return result;
+}
+
+}  // namespace mesh
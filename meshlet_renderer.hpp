@@ -0,0 +1,425 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "descriptor_allocator.hpp"
+#include "frustum.hpp"
+#include "gpu_resources.hpp"
+#include "memory_allocator.hpp"
+#include "meshlet_builder.hpp"
+#include "upload_service.hpp"
+#include "utils.hpp"
+
+// Draws a mesh as meshlets (see meshlet_builder.hpp), culling each against
+// the frustum and by its normal cone on the GPU first. Two paths:
+//
+// - MESH_SHADER, with VK_EXT_mesh_shader: a task shader (shaders/meshlet.task)
+//   culls 32 meshlets per workgroup and launches a mesh shader workgroup
+//   (shaders/meshlet.mesh) for each survivor, which reads the vertices
+//   straight out of the vertex buffer.
+// - INDIRECT, everywhere else: a compute shader (shaders/meshlet_cull.comp)
+//   writes one indexed indirect draw per meshlet, with no instances if it was
+//   culled, over an index buffer holding the triangles in meshlet order. The
+//   normal graphics pipeline draws them.
+//
+// Meshlet data is in descriptor set 1; set 0 is the frame's usual set in the
+// mesh shader pipeline, and empty in the culling pipeline. The culling
+// parameters, draws and counters are per frame in flight.
+class MeshletRenderer {
+ public:
+  enum class Path { MESH_SHADER, INDIRECT };
+
+  // the meshlets in each frame, by what happened to them
+  struct Stats {
+    uint64_t frames = 0;
+    uint64_t drawn = 0;
+    uint64_t frustumCulled = 0;
+    uint64_t backfaceCulled = 0;
+  };
+
+  // meshlets culled by each workgroup of the culling shaders
+  static constexpr uint32_t CULL_GROUP_SIZE = 64;
+  static constexpr uint32_t TASK_GROUP_SIZE = 32;
+
+  // Whether the device can run the mesh shader path. The shaders are SPIR-V
+  // 1.4, so it also needs Vulkan 1.2, which an instance of `instanceVersion`
+  // has to be able to use.
+  static bool meshShadersSupported(VkPhysicalDevice physicalDevice,
+                                   uint32_t instanceVersion) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    if (instanceVersion < VK_API_VERSION_1_2 ||
+        properties.apiVersion < VK_API_VERSION_1_2) {
+      return false;
+    }
+
+    if (!hasDeviceExtension(physicalDevice,
+                            VK_EXT_MESH_SHADER_EXTENSION_NAME)) {
+      return false;
+    }
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT};
+    VkPhysicalDeviceFeatures2 features{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &meshShaderFeatures};
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+    return meshShaderFeatures.taskShader && meshShaderFeatures.meshShader;
+  }
+
+  // Creates the set layout, which the mesh shader pipeline needs, and with
+  // the INDIRECT path, the culling pipeline. The device is expected to have
+  // multiDrawIndirect enabled if it supports it, and for the MESH_SHADER
+  // path, VK_EXT_mesh_shader with its taskShader and meshShader features.
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            DeviceMemoryAllocator& allocator,
+            DescriptorAllocator& descriptors,
+            VkPipelineCache pipelineCache,
+            Path path,
+            uint32_t frameCount,
+            const std::string& cullShaderPath) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->descriptors = &descriptors;
+    this->path = path;
+
+    maxDrawIndirectCount = maxIndirectDrawCount(physicalDevice);
+
+    if (path == Path::MESH_SHADER) {
+      drawMeshTasks = reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(
+          vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksEXT"));
+      if (!drawMeshTasks) {
+        throw std::runtime_error("failed to load vkCmdDrawMeshTasksEXT");
+      }
+    }
+
+    const VkShaderStageFlags stages =
+        path == Path::MESH_SHADER
+            ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT
+            : VK_SHADER_STAGE_COMPUTE_BIT;
+    std::array<VkDescriptorSetLayoutBinding, BINDING_COUNT> bindings;
+    for (uint32_t binding = 0; binding < BINDING_COUNT; ++binding) {
+      bindings[binding] = {.binding = binding,
+                           .descriptorType =
+                               binding == CULLING_BINDING
+                                   ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                   : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                           .descriptorCount = 1,
+                           .stageFlags = stages};
+    }
+    setLayout = descriptors.layout(bindings);
+
+    frames.resize(frameCount);
+    for (auto& frame : frames) {
+      createBuffer(device, *allocator, sizeof(Culling),
+                   VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   frame.cullingBuffer, frame.cullingMemory);
+      // written by the shaders and read back by collect()
+      createBuffer(device, *allocator, sizeof(uint32_t) * COUNTER_COUNT,
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   frame.statsBuffer, frame.statsMemory);
+      std::memset(frame.statsMemory.mapped, 0,
+                  sizeof(uint32_t) * COUNTER_COUNT);
+    }
+
+    if (path == Path::INDIRECT) {
+      createCullPipeline(pipelineCache, cullShaderPath);
+    }
+  }
+
+  VkDescriptorSetLayout descriptorSetLayout() const { return setLayout; }
+
+  // Uploads the meshlets and fills in the descriptor sets. `vertexBuffer`
+  // holds the mesh's Vertex array, and needs STORAGE usage for the
+  // MESH_SHADER path; the INDIRECT path doesn't read it.
+  void upload(UploadService& uploads,
+              const mesh::MeshletMesh& mesh,
+              VkBuffer vertexBuffer) {
+    meshletCount = static_cast<uint32_t>(mesh.meshlets.size());
+    if (meshletCount == 0) {
+      throw std::runtime_error("there are no meshlets to draw");
+    }
+
+    auto deviceBuffer = [&](std::span<const std::byte> data, VkBuffer& buffer,
+                            Allocation& memory) {
+      createBuffer(device, *allocator, data.size(),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+      uploads.uploadBuffer(buffer, 0, data);
+    };
+    deviceBuffer(std::as_bytes(std::span(mesh.meshlets)), meshletBuffer,
+                 meshletMemory);
+    if (path == Path::MESH_SHADER) {
+      deviceBuffer(std::as_bytes(std::span(mesh.vertices)),
+                   meshletVertexBuffer, meshletVertexMemory);
+      deviceBuffer(std::as_bytes(std::span(mesh.triangles)),
+                   meshletTriangleBuffer, meshletTriangleMemory);
+    } else {
+      for (auto& frame : frames) {
+        createBuffer(device, *allocator,
+                     sizeof(VkDrawIndexedIndirectCommand) * meshletCount,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.drawBuffer,
+                     frame.drawMemory);
+      }
+    }
+
+    for (Frame& frame : frames) {
+      // only the buffers the path's shaders use; the rest stay unwritten
+      std::vector<std::pair<uint32_t, VkDescriptorBufferInfo>> buffers{
+          {MESHLETS_BINDING, {meshletBuffer, 0, VK_WHOLE_SIZE}},
+          {CULLING_BINDING, {frame.cullingBuffer, 0, VK_WHOLE_SIZE}},
+          {STATS_BINDING, {frame.statsBuffer, 0, VK_WHOLE_SIZE}}};
+      if (path == Path::MESH_SHADER) {
+        buffers.push_back({MESHLET_VERTICES_BINDING,
+                           {meshletVertexBuffer, 0, VK_WHOLE_SIZE}});
+        buffers.push_back({MESHLET_TRIANGLES_BINDING,
+                           {meshletTriangleBuffer, 0, VK_WHOLE_SIZE}});
+        buffers.push_back({VERTICES_BINDING, {vertexBuffer, 0, VK_WHOLE_SIZE}});
+      } else {
+        buffers.push_back(
+            {DRAWS_BINDING, {frame.drawBuffer, 0, VK_WHOLE_SIZE}});
+      }
+
+      std::vector<DescriptorAllocator::Descriptor> contents;
+      for (const auto& [binding, info] : buffers) {
+        contents.push_back({.binding = binding,
+                            .type = binding == CULLING_BINDING
+                                        ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                        : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                            .buffer = info});
+      }
+      frame.descriptorSet = descriptors->set(setLayout, contents);
+    }
+  }
+
+  // Sets the frame's culling parameters from the matrix taking model space
+  // to clip space, and the camera position in model space. Call before
+  // submitting the frame.
+  void updateCulling(uint32_t frame,
+                     const glm::mat4& modelViewProj,
+                     const glm::vec3& camera) {
+    Culling culling{.cameraPosition = glm::vec4(camera, 1.f),
+                    .meshletCount = meshletCount};
+    const auto planes = frustumPlanes(modelViewProj);
+    std::copy(planes.begin(), planes.end(), culling.frustumPlanes);
+    std::memcpy(frames[frame].cullingMemory.mapped, &culling, sizeof(culling));
+  }
+
+  // Records the culling dispatch of the INDIRECT path, outside the render
+  // pass. Nothing to do for the MESH_SHADER path, which culls as it draws.
+  void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame) {
+    if (path != Path::INDIRECT) {
+      return;
+    }
+    // the previous use of the draws is over before they're rewritten
+    VkMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            cullPipelineLayout, 1, 1,
+                            &frames[frame].descriptorSet, 0, nullptr);
+    vkCmdDispatch(commandBuffer,
+                  (meshletCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+  }
+
+  // Records the draws, inside the render pass. The caller has bound the
+  // graphics pipeline, with `pipelineLayout`, and its set 0, and for the
+  // INDIRECT path the vertex buffer and the meshlet-ordered index buffer.
+  void recordDraw(VkCommandBuffer commandBuffer,
+                  uint32_t frame,
+                  VkPipelineLayout pipelineLayout) {
+    if (path == Path::MESH_SHADER) {
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              pipelineLayout, 1, 1,
+                              &frames[frame].descriptorSet, 0, nullptr);
+      drawMeshTasks(commandBuffer,
+                    (meshletCount + TASK_GROUP_SIZE - 1) / TASK_GROUP_SIZE, 1,
+                    1);
+      return;
+    }
+    drawIndexedIndirectBatched(commandBuffer, frames[frame].drawBuffer,
+                               meshletCount, maxDrawIndirectCount);
+  }
+
+  // Makes the frame's counters readable by collect() once the frame's fence
+  // has signalled. Recorded after the render pass.
+  void recordStatsReadback(VkCommandBuffer commandBuffer, uint32_t frame) {
+    VkBufferMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = frames[frame].statsBuffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(commandBuffer,
+                         path == Path::MESH_SHADER
+                             ? VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT
+                             : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier,
+                         0, nullptr);
+  }
+
+  // Adds up the counters of the frame's last submission, and clears them
+  // for its next one. Call once its fence has signalled, before it's
+  // submitted again.
+  void collect(uint32_t frame) {
+    auto* counters = static_cast<uint32_t*>(frames[frame].statsMemory.mapped);
+    if (counters[VISIBLE] + counters[FRUSTUM_CULLED] +
+            counters[BACKFACE_CULLED] ==
+        0) {
+      // not submitted since the last collect()
+      return;
+    }
+    ++stats.frames;
+    stats.drawn += counters[VISIBLE];
+    stats.frustumCulled += counters[FRUSTUM_CULLED];
+    stats.backfaceCulled += counters[BACKFACE_CULLED];
+    std::memset(counters, 0, sizeof(uint32_t) * COUNTER_COUNT);
+  }
+
+  void printStats(std::ostream& out) const {
+    const double frameCount =
+        static_cast<double>(std::max<uint64_t>(stats.frames, 1));
+    out << "meshlets ("
+        << (path == Path::MESH_SHADER ? "mesh shaders" : "compute culling")
+        << "): " << meshletCount << " per frame, on average "
+        << stats.drawn / frameCount << " drawn, "
+        << stats.frustumCulled / frameCount << " outside the frustum, "
+        << stats.backfaceCulled / frameCount << " facing away\n";
+  }
+
+  void destroy() {
+    if (device == VK_NULL_HANDLE) {
+      return;
+    }
+    for (auto& frame : frames) {
+      destroyBuffer(device, *allocator, frame.cullingBuffer,
+                    frame.cullingMemory);
+      destroyBuffer(device, *allocator, frame.statsBuffer, frame.statsMemory);
+      destroyBuffer(device, *allocator, frame.drawBuffer, frame.drawMemory);
+    }
+    frames.clear();
+    destroyBuffer(device, *allocator, meshletBuffer, meshletMemory);
+    destroyBuffer(device, *allocator, meshletVertexBuffer, meshletVertexMemory);
+    destroyBuffer(device, *allocator, meshletTriangleBuffer,
+                  meshletTriangleMemory);
+    vkDestroyPipeline(device, cullPipeline, nullptr);
+    vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+    device = VK_NULL_HANDLE;
+  }
+
+ private:
+  // the bindings of set 1, see shaders/meshlet_common.glsl
+  enum Binding : uint32_t {
+    MESHLETS_BINDING,
+    MESHLET_VERTICES_BINDING,
+    MESHLET_TRIANGLES_BINDING,
+    VERTICES_BINDING,
+    CULLING_BINDING,
+    STATS_BINDING,
+    DRAWS_BINDING,
+    BINDING_COUNT
+  };
+
+  // the counters in the stats buffer, indexed by the culling result
+  enum Counter : uint32_t {
+    VISIBLE,
+    FRUSTUM_CULLED,
+    BACKFACE_CULLED,
+    COUNTER_COUNT
+  };
+
+  // matches the Culling block in shaders/meshlet_common.glsl (std140)
+  struct Culling {
+    glm::vec4 frustumPlanes[6];
+    glm::vec4 cameraPosition;
+    uint32_t meshletCount;
+  };
+
+  struct Frame {
+    VkBuffer cullingBuffer = VK_NULL_HANDLE;
+    Allocation cullingMemory;
+    VkBuffer statsBuffer = VK_NULL_HANDLE;
+    Allocation statsMemory;
+    // INDIRECT only
+    VkBuffer drawBuffer = VK_NULL_HANDLE;
+    Allocation drawMemory;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  };
+
+  void createCullPipeline(VkPipelineCache pipelineCache,
+                          const std::string& shaderPath) {
+    // so the meshlet set is set 1 here too, and the shaders share one
+    // declaration of it
+    std::array setLayouts{descriptors->layout({}), setLayout};
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = setLayouts.data()};
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
+                               &cullPipelineLayout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create meshlet culling layout");
+    }
+
+    cullPipeline = createComputePipeline(device, pipelineCache,
+                                         cullPipelineLayout, shaderPath);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceMemoryAllocator* allocator = nullptr;
+  DescriptorAllocator* descriptors = nullptr;
+  Path path = Path::INDIRECT;
+  uint32_t maxDrawIndirectCount = 1;
+  PFN_vkCmdDrawMeshTasksEXT drawMeshTasks = nullptr;
+
+  // owned by the descriptor allocator
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  // INDIRECT only
+  VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+  VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+  uint32_t meshletCount = 0;
+  VkBuffer meshletBuffer = VK_NULL_HANDLE;
+  Allocation meshletMemory;
+  // MESH_SHADER only
+  VkBuffer meshletVertexBuffer = VK_NULL_HANDLE;
+  Allocation meshletVertexMemory;
+  VkBuffer meshletTriangleBuffer = VK_NULL_HANDLE;
+  Allocation meshletTriangleMemory;
+
+  std::vector<Frame> frames;
+  Stats stats;
+};
@@ -0,0 +1,740 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MIPCHAIN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets any function use any intrinsic; GCC and Clang need the AVX2
+// kernels marked so they can be built without -mavx2 and picked at runtime
+#if defined(MIPCHAIN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define MIPCHAIN_AVX2 __attribute__((target("avx2,fma,f16c")))
+#else
+#define MIPCHAIN_AVX2
+#endif
+
+#include "job_system.hpp"
+
+// Builds mip chains on the CPU, for the texture cooker and for devices that
+// can neither blit nor write storage images in the texture's format.
+//
+// Levels are filtered in linear light, in 32-bit float: the base level is
+// decoded once (sRGB to linear and premultiplied by alpha, as asked for), and
+// each level is downsampled from the float copy of the one above, so there's
+// no rounding between levels. The filters are separable and run row by row,
+// split across the job system, with SSE2 and AVX2 kernels picked at runtime
+// and a scalar fallback everywhere else.
+namespace mipchain {
+
+enum class Format {
+  RGBA8,  // 4 bytes per texel
+  RGBA16F,  // 4 halfs per texel, linear
+};
+
+enum class Filter {
+  // 2x2 average, as the GPU paths do
+  BOX,
+  // Kaiser-windowed sinc over 12x12 texels: sharper, with less aliasing
+  KAISER,
+};
+
+// Same meaning and values as MipGenerator::Flags
+enum Flags : uint32_t {
+  // RGBA8 texels hold sRGB colour; filtered as linear
+  SRGB = 1,
+  // weight colour by alpha so transparent texels don't bleed into opaque ones
+  ALPHA_WEIGHTED = 2,
+};
+
+enum class Isa { SCALAR, SSE2, AVX2 };
+
+struct Level {
+  uint32_t width;
+  uint32_t height;
+  std::vector<std::byte> data;
+};
+
+inline const char* isaName(Isa isa) {
+  switch (isa) {
+    case Isa::SCALAR:
+      return "scalar";
+    case Isa::SSE2:
+      return "SSE2";
+    case Isa::AVX2:
+      return "AVX2";
+  }
+  return "?";
+}
+
+// The widest kernels the CPU can run
+inline Isa bestIsa() {
+#if defined(MIPCHAIN_X86) && (defined(__GNUC__) || defined(__clang__))
+  static const bool avx2 = __builtin_cpu_supports("avx2") &&
+                           __builtin_cpu_supports("fma") &&
+                           __builtin_cpu_supports("f16c");
+  return avx2 ? Isa::AVX2 : Isa::SSE2;
+#elif defined(MIPCHAIN_X86)
+  static const bool avx2 = [] {
+    int info[4];
+    __cpuid(info, 1);
+    const bool fma = info[2] & (1 << 12), osxsave = info[2] & (1 << 27),
+               f16c = info[2] & (1 << 29);
+    if (!fma || !osxsave || !f16c || (_xgetbv(0) & 6) != 6) {
+      return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+  }();
+  return avx2 ? Isa::AVX2 : Isa::SSE2;
+#else
+  return Isa::SCALAR;
+#endif
+}
+
+inline uint32_t texelBytes(Format format) {
+  return format == Format::RGBA8 ? 4 : 8;
+}
+
+namespace detail {
+
+// Each level is a w*h*4 float image
+using Image = std::vector<float>;
+
+// Taps of the Kaiser filter: 2 * the radius in destination texels, times 2
+// source texels per destination texel
+inline constexpr int KAISER_TAPS = 12;
+inline constexpr double KAISER_RADIUS = KAISER_TAPS / 4.0;
+inline constexpr double KAISER_ALPHA = 4.0;
+
+// The same for every destination texel, as the scale is always 2:1. Tap k
+// reads source texel 2x - KAISER_TAPS / 2 + 1 + k.
+inline const std::array<float, KAISER_TAPS>& kaiserWeights() {
+  static const auto weights = [] {
+    // modified Bessel function of the first kind, order 0
+    auto bessel0 = [](double x) {
+      double sum = 1, term = 1;
+      for (int k = 1; k < 32; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+      }
+      return sum;
+    };
+    const double pi = 3.14159265358979323846;
+    std::array<double, KAISER_TAPS> w;
+    double total = 0;
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      // distance from the destination texel's centre, in destination texels
+      const double d = (k - KAISER_TAPS / 2 + 0.5) / 2;
+      const double sinc = std::sin(pi * d) / (pi * d);
+      const double t = d / KAISER_RADIUS;
+      const double window = bessel0(KAISER_ALPHA * std::sqrt(1 - t * t)) /
+                            bessel0(KAISER_ALPHA);
+      w[k] = sinc * window;
+      total += w[k];
+    }
+    std::array<float, KAISER_TAPS> normalized;
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      normalized[k] = static_cast<float>(w[k] / total);
+    }
+    return normalized;
+  }();
+  return weights;
+}
+
+inline float srgbToLinear(float c) {
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linearToSrgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f
+                         : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+}
+
+// byte -> [0, 1]
+inline const std::array<float, 256>& unormDecodeTable() {
+  static const auto table = [] {
+    std::array<float, 256> t;
+    for (int i = 0; i < 256; ++i) {
+      t[i] = i / 255.f;
+    }
+    return t;
+  }();
+  return table;
+}
+
+// sRGB byte -> linear
+inline const std::array<float, 256>& srgbDecodeTable() {
+  static const auto table = [] {
+    std::array<float, 256> t;
+    for (int i = 0; i < 256; ++i) {
+      t[i] = srgbToLinear(i / 255.f);
+    }
+    return t;
+  }();
+  return table;
+}
+
+// Linear -> nearest sRGB byte without a pow() per channel: a coarse table
+// gives the first candidate, then the thresholds between neighbouring bytes
+// settle it in a step or two
+class SrgbEncoder {
+ public:
+  SrgbEncoder() {
+    for (int i = 1; i < 256; ++i) {
+      thresholds[i] = srgbToLinear((i - 0.5f) / 255.f);
+    }
+    thresholds[0] = -std::numeric_limits<float>::infinity();
+    uint8_t code = 0;
+    for (int i = 0; i < COARSE; ++i) {
+      const float v = static_cast<float>(i) / (COARSE - 1);
+      while (code < 255 && v >= thresholds[code + 1]) {
+        ++code;
+      }
+      coarse[i] = code;
+    }
+  }
+
+  uint8_t operator()(float v) const {
+    v = std::clamp(v, 0.f, 1.f);
+    uint32_t code = coarse[static_cast<int>(v * (COARSE - 1))];
+    while (code < 255 && v >= thresholds[code + 1]) {
+      ++code;
+    }
+    return static_cast<uint8_t>(code);
+  }
+
+ private:
+  static constexpr int COARSE = 4096;
+  std::array<float, 256> thresholds;
+  std::array<uint8_t, COARSE> coarse;
+};
+
+inline const SrgbEncoder& srgbEncoder() {
+  static const SrgbEncoder encoder;
+  return encoder;
+}
+
+// IEEE half <-> float, rounding to nearest even
+inline float halfToFloat(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    // zero or subnormal
+    const float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  }
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | mantissa << 13;
+  } else {
+    bits = sign | (exponent + 112) << 23 | mantissa << 13;
+  }
+  return std::bit_cast<float>(bits);
+}
+
+inline uint16_t floatToHalf(float f) {
+  const uint32_t bits = std::bit_cast<uint32_t>(f);
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  const uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) {
+    // infinity stays infinity, NaN stays NaN
+    return static_cast<uint16_t>(sign | 0x7c00 |
+                                 (magnitude > 0x7f800000 ? 0x200 : 0));
+  }
+  if (magnitude >= 0x477ff000) {
+    // rounds past the largest half
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+  if (magnitude < 0x38800000) {
+    // subnormal half: let the FPU round the scaled value
+    const float scaled = std::bit_cast<float>(magnitude) * 16777216.f;
+    return static_cast<uint16_t>(sign |
+                                 static_cast<int>(std::nearbyint(scaled)));
+  }
+  const uint32_t rounded =
+      magnitude + 0xfff + ((magnitude >> 13) & 1) - (112u << 23);
+  return static_cast<uint16_t>(sign | rounded >> 13);
+}
+
+// Row kernels, one set per instruction set. Pointers are to RGBA float
+// texels; widths are in texels.
+struct Kernels {
+  // dst[x] = average of the 2x2 texels at (2x, 2x + 1) of rows r0 and r1
+  void (*boxRow)(const float* r0, const float* r1, float* dst,
+                 uint32_t srcWidth, uint32_t dstWidth);
+  // dst[x] = sum over k of weights[k] * src[2x - 5 + k], clamped to the row
+  void (*kaiserRow)(const float* src, float* dst, uint32_t srcWidth,
+                    uint32_t dstWidth);
+  // dst[i] = clamp(sum over k of weights[k] * rows[k][i], 0, maxValue),
+  // over `floats` floats
+  void (*kaiserColumn)(const float* const* rows, float* dst, size_t floats,
+                       float maxValue);
+  // float <-> half, `count` values
+  void (*toHalf)(const float* src, uint16_t* dst, size_t count);
+  void (*fromHalf)(const uint16_t* src, float* dst, size_t count);
+};
+
+inline int kaiserFirstTap(uint32_t x) {
+  return static_cast<int>(2 * x) - KAISER_TAPS / 2 + 1;
+}
+
+// Destination texels [begin, end) whose taps all land inside the row
+inline void kaiserInterior(uint32_t srcWidth, uint32_t dstWidth,
+                           uint32_t& begin, uint32_t& end) {
+  begin = std::min<uint32_t>(KAISER_TAPS / 4, dstWidth);
+  // the last tap, 2x + KAISER_TAPS / 2, must be below srcWidth
+  const int last = (static_cast<int>(srcWidth) - KAISER_TAPS / 2 - 1) / 2;
+  end = std::clamp<int>(last + 1, begin, dstWidth);
+}
+
+inline void kaiserTexelScalar(const float* src, float* dst, uint32_t srcWidth,
+                              uint32_t x) {
+  const auto& w = kaiserWeights();
+  float acc[4]{};
+  const int first = kaiserFirstTap(x);
+  for (int k = 0; k < KAISER_TAPS; ++k) {
+    const int sx = std::clamp(first + k, 0, static_cast<int>(srcWidth) - 1);
+    for (int c = 0; c < 4; ++c) {
+      acc[c] += w[k] * src[sx * 4 + c];
+    }
+  }
+  std::memcpy(dst + x * 4, acc, sizeof(acc));
+}
+
+inline void boxRowScalar(const float* r0, const float* r1, float* dst,
+                         uint32_t srcWidth, uint32_t dstWidth) {
+  for (uint32_t x = 0; x < dstWidth; ++x) {
+    const uint32_t x0 = std::min(2 * x, srcWidth - 1) * 4;
+    const uint32_t x1 = std::min(2 * x + 1, srcWidth - 1) * 4;
+    for (int c = 0; c < 4; ++c) {
+      dst[x * 4 + c] = 0.25f * (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] +
+                                r1[x1 + c]);
+    }
+  }
+}
+
+inline void kaiserRowScalar(const float* src, float* dst, uint32_t srcWidth,
+                            uint32_t dstWidth) {
+  for (uint32_t x = 0; x < dstWidth; ++x) {
+    kaiserTexelScalar(src, dst, srcWidth, x);
+  }
+}
+
+inline void kaiserColumnScalar(const float* const* rows, float* dst,
+                               size_t floats, float maxValue) {
+  const auto& w = kaiserWeights();
+  for (size_t i = 0; i < floats; ++i) {
+    float acc = 0;
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      acc += w[k] * rows[k][i];
+    }
+    dst[i] = std::clamp(acc, 0.f, maxValue);
+  }
+}
+
+inline void toHalfScalar(const float* src, uint16_t* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = floatToHalf(src[i]);
+  }
+}
+
+inline void fromHalfScalar(const uint16_t* src, float* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = halfToFloat(src[i]);
+  }
+}
+
+#ifdef MIPCHAIN_X86
+
+inline void boxRowSse2(const float* r0, const float* r1, float* dst,
+                       uint32_t srcWidth, uint32_t dstWidth) {
+  // with a single source column both taps are the same texel
+  const uint32_t simdEnd = srcWidth >= 2 ? dstWidth : 0;
+  const __m128 quarter = _mm_set1_ps(0.25f);
+  for (uint32_t x = 0; x < simdEnd; ++x) {
+    const __m128 top =
+        _mm_add_ps(_mm_loadu_ps(r0 + x * 8), _mm_loadu_ps(r0 + x * 8 + 4));
+    const __m128 bottom =
+        _mm_add_ps(_mm_loadu_ps(r1 + x * 8), _mm_loadu_ps(r1 + x * 8 + 4));
+    _mm_storeu_ps(dst + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+  }
+  if (simdEnd < dstWidth) {
+    boxRowScalar(r0, r1, dst, srcWidth, dstWidth);
+  }
+}
+
+inline void kaiserRowSse2(const float* src, float* dst, uint32_t srcWidth,
+                          uint32_t dstWidth) {
+  const auto& w = kaiserWeights();
+  uint32_t begin, end;
+  kaiserInterior(srcWidth, dstWidth, begin, end);
+  for (uint32_t x = 0; x < begin; ++x) {
+    kaiserTexelScalar(src, dst, srcWidth, x);
+  }
+  for (uint32_t x = begin; x < end; ++x) {
+    const float* taps = src + kaiserFirstTap(x) * 4;
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      acc = _mm_add_ps(
+          acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(taps + k * 4)));
+    }
+    _mm_storeu_ps(dst + x * 4, acc);
+  }
+  for (uint32_t x = end; x < dstWidth; ++x) {
+    kaiserTexelScalar(src, dst, srcWidth, x);
+  }
+}
+
+inline void kaiserColumnSse2(const float* const* rows, float* dst,
+                             size_t floats, float maxValue) {
+  const auto& w = kaiserWeights();
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max = _mm_set1_ps(maxValue);
+  // rows are whole texels, so always a multiple of 4 floats
+  for (size_t i = 0; i < floats; i += 4) {
+    __m128 acc = zero;
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      acc = _mm_add_ps(
+          acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(rows[k] + i)));
+    }
+    _mm_storeu_ps(dst + i, _mm_min_ps(_mm_max_ps(acc, zero), max));
+  }
+}
+
+MIPCHAIN_AVX2 inline void boxRowAvx2(const float* r0, const float* r1,
+                                     float* dst, uint32_t srcWidth,
+                                     uint32_t dstWidth) {
+  // two destination texels per iteration, from four source texels per row
+  const uint32_t simdEnd = srcWidth >= 2 ? dstWidth & ~1u : 0;
+  const __m256 quarter = _mm256_set1_ps(0.25f);
+  for (uint32_t x = 0; x < simdEnd; x += 2) {
+    // texels 0 and 1, then 2 and 3, of both rows summed
+    const __m256 a = _mm256_add_ps(_mm256_loadu_ps(r0 + x * 8),
+                                   _mm256_loadu_ps(r1 + x * 8));
+    const __m256 b = _mm256_add_ps(_mm256_loadu_ps(r0 + x * 8 + 8),
+                                   _mm256_loadu_ps(r1 + x * 8 + 8));
+    // (0, 2) + (1, 3)
+    const __m256 even = _mm256_permute2f128_ps(a, b, 0x20);
+    const __m256 odd = _mm256_permute2f128_ps(a, b, 0x31);
+    _mm256_storeu_ps(dst + x * 4,
+                     _mm256_mul_ps(_mm256_add_ps(even, odd), quarter));
+  }
+  if (simdEnd < dstWidth) {
+    boxRowSse2(r0 + simdEnd * 8, r1 + simdEnd * 8, dst + simdEnd * 4,
+               srcWidth - simdEnd * 2, dstWidth - simdEnd);
+  }
+}
+
+MIPCHAIN_AVX2 inline void kaiserRowAvx2(const float* src, float* dst,
+                                        uint32_t srcWidth, uint32_t dstWidth) {
+  const auto& w = kaiserWeights();
+  uint32_t begin, end;
+  kaiserInterior(srcWidth, dstWidth, begin, end);
+  for (uint32_t x = 0; x < begin; ++x) {
+    kaiserTexelScalar(src, dst, srcWidth, x);
+  }
+  // two destination texels per iteration: their taps are two source texels
+  // apart, so each load pairs tap k of one with tap k of the other
+  uint32_t x = begin;
+  for (; x + 2 <= end; x += 2) {
+    const float* taps = src + kaiserFirstTap(x) * 4;
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      const __m256 pair = _mm256_insertf128_ps(
+          _mm256_castps128_ps256(_mm_loadu_ps(taps + k * 4)),
+          _mm_loadu_ps(taps + k * 4 + 8), 1);
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(w[k]), pair, acc);
+    }
+    _mm256_storeu_ps(dst + x * 4, acc);
+  }
+  for (; x < dstWidth; ++x) {
+    kaiserTexelScalar(src, dst, srcWidth, x);
+  }
+}
+
+MIPCHAIN_AVX2 inline void kaiserColumnAvx2(const float* const* rows,
+                                           float* dst, size_t floats,
+                                           float maxValue) {
+  const auto& w = kaiserWeights();
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max = _mm256_set1_ps(maxValue);
+  size_t i = 0;
+  for (; i + 8 <= floats; i += 8) {
+    __m256 acc = zero;
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(w[k]), _mm256_loadu_ps(rows[k] + i),
+                            acc);
+    }
+    _mm256_storeu_ps(dst + i, _mm256_min_ps(_mm256_max_ps(acc, zero), max));
+  }
+  if (i < floats) {
+    // one texel left over
+    const float* tail[KAISER_TAPS];
+    for (int k = 0; k < KAISER_TAPS; ++k) {
+      tail[k] = rows[k] + i;
+    }
+    kaiserColumnSse2(tail, dst + i, floats - i, maxValue);
+  }
+}
+
+MIPCHAIN_AVX2 inline void toHalfAvx2(const float* src, uint16_t* dst,
+                                     size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + i),
+        _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+  toHalfScalar(src + i, dst + i, count - i);
+}
+
+MIPCHAIN_AVX2 inline void fromHalfAvx2(const uint16_t* src, float* dst,
+                                       size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                                  reinterpret_cast<const __m128i*>(src + i))));
+  }
+  fromHalfScalar(src + i, dst + i, count - i);
+}
+
+#endif  // MIPCHAIN_X86
+
+inline Kernels kernels(Isa isa) {
+  switch (isa) {
+#ifdef MIPCHAIN_X86
+    case Isa::AVX2:
+      return {boxRowAvx2, kaiserRowAvx2, kaiserColumnAvx2, toHalfAvx2,
+              fromHalfAvx2};
+    case Isa::SSE2:
+      return {boxRowSse2, kaiserRowSse2, kaiserColumnSse2, toHalfScalar,
+              fromHalfScalar};
+#endif
+    case Isa::SCALAR:
+      return {boxRowScalar, kaiserRowScalar, kaiserColumnScalar, toHalfScalar,
+              fromHalfScalar};
+    default:
+      throw std::runtime_error(std::string("mip chain: no ") + isaName(isa) +
+                               " kernels on this CPU");
+  }
+}
+
+// Runs fn(begin, end) over `rows` rows, on the job system if there's one,
+// in chunks of roughly `texelsPerChunk` texels
+template <typename Fn>
+void forRows(JobSystem* jobs, uint32_t rows, uint32_t width, Fn&& fn) {
+  static constexpr size_t TEXELS_PER_CHUNK = 16384;
+  if (!jobs) {
+    fn(size_t{0}, size_t{rows});
+    return;
+  }
+  const size_t grain = std::max<size_t>(1, TEXELS_PER_CHUNK / width);
+  jobs->parallelFor(rows, grain, fn);
+}
+
+struct Context {
+  Format format;
+  uint32_t flags;
+  Kernels kernels;
+  JobSystem* jobs;
+};
+
+inline Image decode(const Context& ctx, const std::byte* data, uint32_t width,
+                    uint32_t height) {
+  Image image(static_cast<size_t>(width) * height * 4);
+  const bool premultiply = ctx.flags & ALPHA_WEIGHTED;
+  const auto& colourTable =
+      ctx.flags & SRGB ? srgbDecodeTable() : unormDecodeTable();
+  const auto& alphaTable = unormDecodeTable();
+  forRows(ctx.jobs, height, width, [&](size_t begin, size_t end) {
+    for (size_t y = begin; y < end; ++y) {
+      const size_t offset = y * width * 4;
+      float* row = image.data() + offset;
+      if (ctx.format == Format::RGBA8) {
+        const auto* bytes = reinterpret_cast<const uint8_t*>(data) + offset;
+        for (uint32_t x = 0; x < width; ++x) {
+          const uint8_t* texel = bytes + x * 4;
+          const float a = alphaTable[texel[3]];
+          const float scale = premultiply ? a : 1;
+          for (int c = 0; c < 3; ++c) {
+            row[x * 4 + c] = colourTable[texel[c]] * scale;
+          }
+          row[x * 4 + 3] = a;
+        }
+        continue;
+      }
+      ctx.kernels.fromHalf(reinterpret_cast<const uint16_t*>(data) + offset,
+                           row, size_t{width} * 4);
+      if (premultiply) {
+        for (uint32_t x = 0; x < width; ++x) {
+          for (int c = 0; c < 3; ++c) {
+            row[x * 4 + c] *= row[x * 4 + 3];
+          }
+        }
+      }
+    }
+  });
+  return image;
+}
+
+inline std::vector<std::byte> encode(const Context& ctx, const Image& image,
+                                     uint32_t width, uint32_t height) {
+  const size_t texels = static_cast<size_t>(width) * height;
+  std::vector<std::byte> data(texels * texelBytes(ctx.format));
+  const bool srgb = ctx.flags & SRGB;
+  const bool premultiplied = ctx.flags & ALPHA_WEIGHTED;
+  const auto& srgbEncode = srgbEncoder();
+  auto unorm = [](float v) {
+    return static_cast<uint8_t>(std::clamp(v, 0.f, 1.f) * 255 + 0.5f);
+  };
+  forRows(ctx.jobs, height, width, [&](size_t begin, size_t end) {
+    // RGBA16F goes through a row of straight colour
+    std::vector<float> straight;
+    for (size_t y = begin; y < end; ++y) {
+      const size_t offset = y * width * 4;
+      const float* row = image.data() + offset;
+      if (ctx.format == Format::RGBA8) {
+        auto* bytes = reinterpret_cast<uint8_t*>(data.data()) + offset;
+        for (uint32_t x = 0; x < width; ++x) {
+          const float* texel = row + x * 4;
+          const float a = texel[3];
+          const float scale = !premultiplied ? 1 : a > 0 ? 1 / a : 0;
+          for (int c = 0; c < 3; ++c) {
+            bytes[x * 4 + c] =
+                srgb ? srgbEncode(texel[c] * scale) : unorm(texel[c] * scale);
+          }
+          bytes[x * 4 + 3] = unorm(a);
+        }
+        continue;
+      }
+      straight.assign(row, row + size_t{width} * 4);
+      if (premultiplied) {
+        for (uint32_t x = 0; x < width; ++x) {
+          const float a = straight[x * 4 + 3];
+          for (int c = 0; c < 3; ++c) {
+            straight[x * 4 + c] = a > 0 ? straight[x * 4 + c] / a : 0;
+          }
+        }
+      }
+      ctx.kernels.toHalf(straight.data(),
+                         reinterpret_cast<uint16_t*>(data.data()) + offset,
+                         straight.size());
+    }
+  });
+  return data;
+}
+
+inline Image downsample(const Context& ctx, Filter filter, const Image& src,
+                        uint32_t srcWidth, uint32_t srcHeight,
+                        uint32_t dstWidth, uint32_t dstHeight) {
+  Image dst(static_cast<size_t>(dstWidth) * dstHeight * 4);
+  auto srcRow = [&](int y) {
+    y = std::clamp(y, 0, static_cast<int>(srcHeight) - 1);
+    return src.data() + static_cast<size_t>(y) * srcWidth * 4;
+  };
+
+  if (filter == Filter::BOX) {
+    forRows(ctx.jobs, dstHeight, srcWidth * 2, [&](size_t begin, size_t end) {
+      for (size_t y = begin; y < end; ++y) {
+        ctx.kernels.boxRow(srcRow(static_cast<int>(y * 2)),
+                           srcRow(static_cast<int>(y * 2 + 1)),
+                           dst.data() + y * dstWidth * 4, srcWidth, dstWidth);
+      }
+    });
+    return dst;
+  }
+
+  // horizontally into every source row, then vertically
+  Image rows(static_cast<size_t>(dstWidth) * srcHeight * 4);
+  forRows(ctx.jobs, srcHeight, srcWidth, [&](size_t begin, size_t end) {
+    for (size_t y = begin; y < end; ++y) {
+      ctx.kernels.kaiserRow(src.data() + y * srcWidth * 4,
+                            rows.data() + y * dstWidth * 4, srcWidth,
+                            dstWidth);
+    }
+  });
+  // sharpening overshoots; HDR colour may legitimately go past 1
+  const float maxValue = ctx.format == Format::RGBA8
+                             ? 1.f
+                             : std::numeric_limits<float>::infinity();
+  forRows(ctx.jobs, dstHeight, dstWidth * KAISER_TAPS,
+          [&](size_t begin, size_t end) {
+            const float* taps[KAISER_TAPS];
+            for (size_t y = begin; y < end; ++y) {
+              const int first = kaiserFirstTap(static_cast<uint32_t>(y));
+              for (int k = 0; k < KAISER_TAPS; ++k) {
+                const int sy =
+                    std::clamp(first + k, 0, static_cast<int>(srcHeight) - 1);
+                taps[k] = rows.data() + static_cast<size_t>(sy) * dstWidth * 4;
+              }
+              ctx.kernels.kaiserColumn(taps, dst.data() + y * dstWidth * 4,
+                                       size_t{dstWidth} * 4, maxValue);
+            }
+          });
+  return dst;
+}
+
+}  // namespace detail
+
+// Builds levels 1 to levelCount - 1 (the whole chain if 0) of a `width` x
+// `height` image in `format`, tightly packed. Rows are split across `jobs`;
+// nullptr runs everything on the calling thread.
+inline std::vector<Level> generate(std::span<const std::byte> base,
+                                   Format format,
+                                   uint32_t width,
+                                   uint32_t height,
+                                   Filter filter,
+                                   uint32_t flags,
+                                   uint32_t levelCount = 0,
+                                   Isa isa = bestIsa(),
+                                   JobSystem* jobs = &JobSystem::shared()) {
+  if (width == 0 || height == 0) {
+    throw std::runtime_error("mip chain: empty image");
+  }
+  if (base.size() <
+      static_cast<size_t>(width) * height * texelBytes(format)) {
+    throw std::runtime_error("mip chain: base level is too small");
+  }
+  const uint32_t fullChain = std::bit_width(std::max(width, height));
+  if (levelCount == 0 || levelCount > fullChain) {
+    levelCount = fullChain;
+  }
+
+  const detail::Context ctx{.format = format,
+                            .flags = flags,
+                            .kernels = detail::kernels(isa),
+                            .jobs = jobs};
+  std::vector<Level> levels;
+  detail::Image image = detail::decode(ctx, base.data(), width, height);
+  for (uint32_t level = 1; level < levelCount; ++level) {
+    const uint32_t dstWidth = std::max(width / 2, 1u);
+    const uint32_t dstHeight = std::max(height / 2, 1u);
+    image = detail::downsample(ctx, filter, image, width, height, dstWidth,
+                               dstHeight);
+    width = dstWidth;
+    height = dstHeight;
+    levels.push_back({.width = width,
+                      .height = height,
+                      .data = detail::encode(ctx, image, width, height)});
+  }
+  return levels;
+}
+
+}  // namespace mipchain
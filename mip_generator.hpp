@@ -0,0 +1,278 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "descriptor_allocator.hpp"
+#include "gpu_resources.hpp"
+#include "memory_allocator.hpp"
+#include "utils.hpp"
+
+// Generates a mip chain with one compute dispatch (shaders/downsample.comp),
+// instead of a blit and two barriers per level.
+//
+// Works on R8G8B8A8_UNORM images created with STORAGE usage, up to 4096x4096
+// (13 levels). Filtering can treat the texels as sRGB encoded, averaging
+// them in linear space, and weight colours by alpha.
+class MipGenerator {
+ public:
+  static constexpr uint32_t MAX_LEVELS = 13;
+  static constexpr uint32_t MAX_SIZE = 1u << (MAX_LEVELS - 1);
+  // level 0 texels reduced by each workgroup, along each axis
+  static constexpr uint32_t TILE_SIZE = 64;
+  static constexpr VkFormat FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+  enum Flags : uint32_t {
+    // texels are sRGB encoded: average them in linear space
+    SRGB = 1,
+    // weight colours by alpha, so transparent texels don't bleed into
+    // opaque ones
+    ALPHA_WEIGHTED = 2,
+  };
+
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            DeviceMemoryAllocator& allocator,
+            DescriptorAllocator& descriptors,
+            VkPipelineCache pipelineCache,
+            const std::string& shaderPath) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->descriptors = &descriptors;
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, FORMAT,
+                                        &formatProperties);
+    storageSupported = hasFlags(formatProperties.optimalTilingFeatures,
+                                VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+    if (!storageSupported) {
+      return;
+    }
+
+    std::array bindings{
+        VkDescriptorSetLayoutBinding{
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = MAX_LEVELS,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+        VkDescriptorSetLayoutBinding{
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+        VkDescriptorSetLayoutBinding{
+            .binding = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT}};
+    setLayout = descriptors.layout(bindings);
+
+    VkPushConstantRange pushConstants{.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                                      .offset = 0,
+                                      .size = sizeof(Params)};
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &setLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstants};
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
+                               &pipelineLayout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create mip generator layout");
+    }
+
+    pipeline = createComputePipeline(device, pipelineCache, pipelineLayout,
+                                     shaderPath);
+
+    // the workgroup counter; one is enough, as dispatches are serialized on
+    // it by barriers
+    createBuffer(device, allocator, sizeof(uint32_t),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, counterBuffer,
+                 counterMemory);
+  }
+
+  // Whether record() can handle an image of this format and size. If not,
+  // fall back to blits.
+  bool supports(VkFormat format,
+                uint32_t width,
+                uint32_t height,
+                uint32_t levelCount) const {
+    return storageSupported && format == FORMAT && width <= MAX_SIZE &&
+           height <= MAX_SIZE && levelCount <= MAX_LEVELS;
+  }
+
+  // Records generating levels 1 and up from level 0. Like the blit chain, it
+  // expects every level in TRANSFER_DST_OPTIMAL, as left by an upload, and
+  // leaves them in SHADER_READ_ONLY_OPTIMAL. A single level has nothing to
+  // generate: that records nothing and leaves the image as it is.
+  //
+  // Returns a function that frees the image views and releases the
+  // transient descriptor set used, to be called once the commands have
+  // finished executing.
+  [[nodiscard]] std::function<void()> record(VkCommandBuffer commandBuffer,
+                                             VkImage image,
+                                             uint32_t width,
+                                             uint32_t height,
+                                             uint32_t levelCount,
+                                             uint32_t flags) {
+    if (!supports(FORMAT, width, height, levelCount)) {
+      throw std::runtime_error("mip generator doesn't support this image");
+    }
+    if (levelCount <= 1) {
+      return [] {};
+    }
+
+    std::array<VkImageView, MAX_LEVELS> views{};
+    for (uint32_t level = 0; level < levelCount; ++level) {
+      VkImageViewCreateInfo viewInfo{
+          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+          .image = image,
+          .viewType = VK_IMAGE_VIEW_TYPE_2D,
+          .format = FORMAT,
+          .subresourceRange{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                            .baseMipLevel = level,
+                            .levelCount = 1,
+                            .baseArrayLayer = 0,
+                            .layerCount = 1}};
+      if (vkCreateImageView(device, &viewInfo, nullptr, &views[level]) !=
+          VK_SUCCESS) {
+        for (uint32_t created = 0; created < level; ++created) {
+          vkDestroyImageView(device, views[created], nullptr);
+        }
+        throw std::runtime_error("failed to create mip level view");
+      }
+    }
+    auto destroyViews = [this, views, levelCount] {
+      for (uint32_t level = 0; level < levelCount; ++level) {
+        vkDestroyImageView(device, views[level], nullptr);
+      }
+    };
+
+    // The shader indexes every element of binding 0, so the levels the image
+    // doesn't have repeat its last one; they're never written. Binding 1 is
+    // level 6 again, for the coherent accesses of the last workgroup.
+    std::array<DescriptorAllocator::Descriptor, MAX_LEVELS + 2> contents;
+    for (uint32_t level = 0; level < MAX_LEVELS; ++level) {
+      contents[level] = {
+          .binding = 0,
+          .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+          .image{.imageView = views[std::min(level, levelCount - 1)],
+                 .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+          .arrayElement = level};
+    }
+    contents[MAX_LEVELS] = contents[6];
+    contents[MAX_LEVELS].binding = 1;
+    contents[MAX_LEVELS].arrayElement = 0;
+    contents[MAX_LEVELS + 1] = {
+        .binding = 2,
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .buffer{.buffer = counterBuffer,
+                .offset = 0,
+                .range = sizeof(uint32_t)}};
+    VkDescriptorSet set;
+    try {
+      set = descriptors->transientSet(setLayout, contents);
+    } catch (...) {
+      destroyViews();
+      throw;
+    }
+
+    // earlier dispatches are done with the counter before it's cleared
+    VkMemoryBarrier counterBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &counterBarrier,
+                         0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(commandBuffer, counterBuffer, 0, sizeof(uint32_t), 0);
+
+    counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    counterBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    VkImageMemoryBarrier imageBarrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                          .baseMipLevel = 0,
+                          .levelCount = levelCount,
+                          .baseArrayLayer = 0,
+                          .layerCount = 1}};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &counterBarrier, 0, nullptr, 1, &imageBarrier);
+
+    const uint32_t groupsX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const uint32_t groupsY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    Params params{.width = static_cast<int32_t>(width),
+                  .height = static_cast<int32_t>(height),
+                  .levelCount = static_cast<int32_t>(levelCount),
+                  .groupCount = groupsX * groupsY,
+                  .flags = flags};
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipelineLayout, 0, 1, &set, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, pipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+    imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &imageBarrier);
+
+    return [this, destroyViews] {
+      destroyViews();
+      descriptors->releaseTransientSet();
+    };
+  }
+
+  void destroy() {
+    if (!storageSupported) {
+      return;
+    }
+    destroyBuffer(device, *allocator, counterBuffer, counterMemory);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    storageSupported = false;
+  }
+
+ private:
+  // matches the push constants in downsample.comp
+  struct Params {
+    int32_t width;
+    int32_t height;
+    int32_t levelCount;
+    uint32_t groupCount;
+    uint32_t flags;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceMemoryAllocator* allocator = nullptr;
+  DescriptorAllocator* descriptors = nullptr;
+  bool storageSupported = false;
+
+  // owned by the descriptor allocator
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkBuffer counterBuffer = VK_NULL_HANDLE;
+  Allocation counterMemory;
+};
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu_trace.hpp"
+#include "job_system.hpp"
+#include "types.hpp"
+#include "utils.hpp"
+
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+struct ObjLoadStats {
+  double seconds = 0;
+  size_t corners = 0;  // face corners, i.e. vertices before deduplication
+  unsigned threads = 0;
+
+  double verticesPerSecond() const { return corners / seconds; }
+};
+
+// Splits [0, count) into `threads` contiguous ranges and runs
+// fn(begin, end, rangeIndex) on each of them, as jobs on the shared job
+// system. The ranges only depend on `count` and `threads`, so callers can
+// keep per-range results.
+template <typename Fn>
+void parallelRanges(size_t count, unsigned threads, Fn&& fn) {
+  threads = std::max(1u, static_cast<unsigned>(std::min<size_t>(threads, count)));
+  auto& jobs = JobSystem::shared();
+  std::vector<JobSystem::Handle> spawned;
+  for (unsigned t = 1; t < threads; t++) {
+    spawned.push_back(jobs.spawn([&fn, count, threads, t] {
+      fn(count * t / threads, count * (t + 1) / threads, t);
+    }));
+  }
+  std::exception_ptr error;
+  try {
+    fn(0, count / threads, 0u);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  // the jobs reference fn, so they must finish either way
+  jobs.wait(spawned);
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Open-addressing hash set of vertices that can be filled from many threads
+// at once. Vertices are compared by their bit pattern, and each slot holds
+// (index + 1) of the lowest-indexed vertex with that pattern, so the result
+// is the same no matter how the threads interleave.
+class ConcurrentVertexTable {
+ public:
+  ConcurrentVertexTable(const Vertex* vertices, size_t count)
+      : vertices(vertices),
+        slots(std::bit_ceil(std::max<size_t>(count * 2, 16))),
+        mask(slots.size() - 1) {}
+
+  void insert(uint32_t index) {
+    const uint32_t value = index + 1;
+    for (size_t slot = hash(vertices[index]) & mask;; slot = (slot + 1) & mask) {
+      uint32_t current = slots[slot].load(std::memory_order_relaxed);
+      if (current == 0) {
+        if (slots[slot].compare_exchange_strong(current, value,
+                                                std::memory_order_relaxed)) {
+          return;
+        }
+        // somebody else claimed it; current now holds their value
+      }
+
+      if (sameBits(vertices[current - 1], vertices[index])) {
+        // keep the lowest index. The slot can only ever be replaced by a
+        // vertex with the same bits, so just retry until we win or lose.
+        while (value < current &&
+               !slots[slot].compare_exchange_weak(current, value,
+                                                  std::memory_order_relaxed)) {
+        }
+        return;
+      }
+    }
+  }
+
+  // Index of the first vertex with the same bits. Only valid once all
+  // inserts are done.
+  uint32_t find(uint32_t index) const {
+    for (size_t slot = hash(vertices[index]) & mask;; slot = (slot + 1) & mask) {
+      uint32_t current = slots[slot].load(std::memory_order_relaxed);
+      if (current == 0) {
+        throw std::logic_error("vertex was never inserted");
+      }
+      if (sameBits(vertices[current - 1], vertices[index])) {
+        return current - 1;
+      }
+    }
+  }
+
+ private:
+  static bool sameBits(const Vertex& a, const Vertex& b) {
+    return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+  }
+
+  static uint64_t hash(const Vertex& v) {
+    static_assert(sizeof(Vertex) % sizeof(uint64_t) == 0);
+    uint64_t words[sizeof(Vertex) / sizeof(uint64_t)];
+    std::memcpy(words, &v, sizeof(Vertex));
+
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    for (auto word : words) {
+      h = (h ^ word) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+    }
+    return h;
+  }
+
+  const Vertex* vertices;
+  std::vector<std::atomic<uint32_t>> slots;
+  size_t mask;
+};
+
+// Wavefront OBJ loader that parses the file in chunks on all cores and merges
+// duplicate vertices in parallel. Only positions and texture coordinates are
+// read; the output is the same as a sequential "first occurrence wins"
+// deduplication.
+class ObjLoader {
+ public:
+  explicit ObjLoader(unsigned threads = JobSystem::shared().concurrency())
+      : threadCount(std::max(threads, 1u)) {}
+
+  MeshData load(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<char> text = readFile(path);
+    MeshData mesh = parse(std::string_view(text.data(), text.size()));
+
+    stats.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    return mesh;
+  }
+
+  MeshData parse(std::string_view text) {
+    auto chunks = splitChunks(text);
+    std::vector<Chunk> parsed(chunks.size());
+
+    // 1. parse every chunk on its own
+    parallelRanges(chunks.size(), threadCount,
+                   [&](size_t begin, size_t end, unsigned) {
+                     TRACE_SCOPE("parse OBJ chunks");
+                     for (size_t i = begin; i < end; i++) {
+                       parseChunk(chunks[i], parsed[i]);
+                     }
+                   });
+
+    // 2. work out where each chunk's data goes in the combined arrays
+    size_t positionCount = 0, texCoordCount = 0, cornerCount = 0;
+    for (auto& chunk : parsed) {
+      chunk.positionBase = positionCount;
+      chunk.texCoordBase = texCoordCount;
+      chunk.cornerBase = cornerCount;
+      positionCount += chunk.positions.size() / 3;
+      texCoordCount += chunk.texCoords.size() / 2;
+      cornerCount += chunk.corners.size();
+    }
+
+    std::vector<float> positions(positionCount * 3);
+    std::vector<float> texCoords(texCoordCount * 2);
+    parallelRanges(parsed.size(), threadCount,
+                   [&](size_t begin, size_t end, unsigned) {
+                     for (size_t i = begin; i < end; i++) {
+                       std::ranges::copy(
+                           parsed[i].positions,
+                           positions.begin() + parsed[i].positionBase * 3);
+                       std::ranges::copy(
+                           parsed[i].texCoords,
+                           texCoords.begin() + parsed[i].texCoordBase * 2);
+                     }
+                   });
+
+    // 3. build a vertex for every face corner
+    std::vector<Vertex> corners(cornerCount);
+    parallelRanges(parsed.size(), threadCount,
+                   [&](size_t begin, size_t end, unsigned) {
+                     TRACE_SCOPE("build OBJ corners");
+                     for (size_t i = begin; i < end; i++) {
+                       buildCorners(parsed[i], positions, texCoords,
+                                    corners.data() + parsed[i].cornerBase);
+                     }
+                   });
+    parsed.clear();
+    stats.corners = cornerCount;
+    stats.threads = threadCount;
+
+    return deduplicate(corners);
+  }
+
+  const ObjLoadStats& statistics() const { return stats; }
+
+ private:
+  // A face corner's position and texcoord index. Non-negative values are
+  // absolute, zero-based indices. Negative OBJ indices count back from the
+  // latest element, which we only know relative to the start of the chunk:
+  // those are stored as RELATIVE + chunk-local index, and resolved once the
+  // chunk's base offset is known.
+  struct Corner {
+    int64_t position;
+    int64_t texCoord;
+  };
+
+  static constexpr int64_t RELATIVE = -(int64_t{1} << 62);
+  static constexpr int64_t NO_INDEX = std::numeric_limits<int64_t>::min();
+
+  struct Chunk {
+    std::vector<float> positions;
+    std::vector<float> texCoords;
+    std::vector<Corner> corners;
+    size_t positionBase = 0;
+    size_t texCoordBase = 0;
+    size_t cornerBase = 0;
+  };
+
+  std::vector<std::string_view> splitChunks(std::string_view text) const {
+    // a few chunks per thread smooths out uneven chunks
+    const size_t target = std::max<size_t>(text.size() / (threadCount * 4),
+                                           64 * 1024);
+    std::vector<std::string_view> chunks;
+    size_t begin = 0;
+    while (begin < text.size()) {
+      size_t end = std::min(begin + target, text.size());
+      end = text.find('\n', end);
+      end = end == std::string_view::npos ? text.size() : end + 1;
+      chunks.push_back(text.substr(begin, end - begin));
+      begin = end;
+    }
+    return chunks;
+  }
+
+  static void skipSpaces(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+  }
+
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+  static float parseFloat(const char*& p, const char* end) {
+    skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative = *p++ == '-';
+    }
+
+    double value = 0;
+    while (p < end && isDigit(*p)) {
+      value = value * 10 + (*p++ - '0');
+    }
+    if (p < end && *p == '.') {
+      ++p;
+      double scale = 0.1;
+      while (p < end && isDigit(*p)) {
+        value += (*p++ - '0') * scale;
+        scale *= 0.1;
+      }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      ++p;
+      bool negativeExponent = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        negativeExponent = *p++ == '-';
+      }
+      int exponent = 0;
+      while (p < end && isDigit(*p)) {
+        exponent = exponent * 10 + (*p++ - '0');
+      }
+      value *= std::pow(10.0, negativeExponent ? -exponent : exponent);
+    }
+    return static_cast<float>(negative ? -value : value);
+  }
+
+  static int64_t parseInt(const char*& p, const char* end) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative = *p++ == '-';
+    }
+    int64_t value = 0;
+    while (p < end && isDigit(*p)) {
+      value = value * 10 + (*p++ - '0');
+    }
+    return negative ? -value : value;
+  }
+
+  // OBJ indices are 1-based, or negative to count back from the latest
+  // element
+  static int64_t toCornerIndex(int64_t objIndex, size_t chunkCount) {
+    if (objIndex > 0) {
+      return objIndex - 1;
+    }
+    if (objIndex < 0) {
+      return RELATIVE + static_cast<int64_t>(chunkCount) + objIndex;
+    }
+    return NO_INDEX;
+  }
+
+  static void parseChunk(std::string_view text, Chunk& chunk) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    std::vector<Corner> face;
+
+    while (p < end) {
+      const char* lineEnd =
+          static_cast<const char*>(memchr(p, '\n', end - p));
+      lineEnd = lineEnd ? lineEnd : end;
+      skipSpaces(p, lineEnd);
+
+      if (lineEnd - p > 2 && p[0] == 'v' && p[1] == ' ') {
+        p += 2;
+        for (int i = 0; i < 3; i++) {
+          chunk.positions.push_back(parseFloat(p, lineEnd));
+        }
+      } else if (lineEnd - p > 3 && p[0] == 'v' && p[1] == 't' &&
+                 p[2] == ' ') {
+        p += 3;
+        for (int i = 0; i < 2; i++) {
+          chunk.texCoords.push_back(parseFloat(p, lineEnd));
+        }
+      } else if (lineEnd - p > 2 && p[0] == 'f' && p[1] == ' ') {
+        p += 2;
+        face.clear();
+        while (true) {
+          skipSpaces(p, lineEnd);
+          if (p >= lineEnd || !(isDigit(*p) || *p == '-' || *p == '+')) {
+            break;
+          }
+          Corner corner{.position = toCornerIndex(parseInt(p, lineEnd),
+                                                  chunk.positions.size() / 3),
+                        .texCoord = NO_INDEX};
+          if (p < lineEnd && *p == '/') {
+            ++p;
+            if (p < lineEnd && *p != '/') {
+              corner.texCoord = toCornerIndex(parseInt(p, lineEnd),
+                                              chunk.texCoords.size() / 2);
+            }
+            // skip the normal index, we don't use it
+            while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+              ++p;
+            }
+          }
+          face.push_back(corner);
+        }
+
+        // triangulate as a fan, like tinyobjloader does
+        for (size_t i = 2; i < face.size(); i++) {
+          chunk.corners.push_back(face[0]);
+          chunk.corners.push_back(face[i - 1]);
+          chunk.corners.push_back(face[i]);
+        }
+      }
+
+      p = lineEnd + 1;
+    }
+  }
+
+  static size_t resolve(int64_t index, size_t base) {
+    if (index >= 0) {
+      return static_cast<size_t>(index);
+    }
+    int64_t resolved = static_cast<int64_t>(base) + (index - RELATIVE);
+    if (resolved < 0) {
+      throw std::runtime_error("relative index points before the file start");
+    }
+    return static_cast<size_t>(resolved);
+  }
+
+  static void buildCorners(const Chunk& chunk,
+                           const std::vector<float>& positions,
+                           const std::vector<float>& texCoords,
+                           Vertex* out) {
+    for (const auto& corner : chunk.corners) {
+      const size_t pos = resolve(corner.position, chunk.positionBase);
+      if ((pos + 1) * 3 > positions.size()) {
+        throw std::runtime_error("face references a missing vertex");
+      }
+
+      Vertex vert{.pos{positions[3 * pos + 0], positions[3 * pos + 1],
+                       positions[3 * pos + 2]},
+                  .color{1.f, 1.f, 1.f},
+                  .texCoord{0.f, 0.f}};
+
+      if (corner.texCoord != NO_INDEX) {
+        const size_t tex = resolve(corner.texCoord, chunk.texCoordBase);
+        if ((tex + 1) * 2 > texCoords.size()) {
+          throw std::runtime_error("face references a missing texcoord");
+        }
+        // obj format has 0 at the bottom of the image, but our image was
+        // loaded top-to-bottom
+        vert.texCoord = {texCoords[2 * tex + 0], 1.f - texCoords[2 * tex + 1]};
+      }
+      *out++ = vert;
+    }
+  }
+
+  MeshData deduplicate(const std::vector<Vertex>& corners) const {
+    const size_t count = corners.size();
+    ConcurrentVertexTable table(corners.data(), count);
+
+    parallelRanges(count, threadCount, [&](size_t begin, size_t end, unsigned) {
+      TRACE_SCOPE("deduplicate vertices");
+      for (size_t i = begin; i < end; i++) {
+        table.insert(static_cast<uint32_t>(i));
+      }
+    });
+
+    // every corner now maps to the first corner with the same vertex
+    std::vector<uint32_t> first(count);
+    std::vector<uint32_t> uniqueCount(threadCount + 1, 0);
+    parallelRanges(count, threadCount,
+                   [&](size_t begin, size_t end, unsigned range) {
+                     uint32_t unique = 0;
+                     for (size_t i = begin; i < end; i++) {
+                       first[i] = table.find(static_cast<uint32_t>(i));
+                       unique += first[i] == i;
+                     }
+                     uniqueCount[range + 1] = unique;
+                   });
+
+    // number the unique vertices in order of first occurrence
+    std::partial_sum(uniqueCount.begin(), uniqueCount.end(),
+                     uniqueCount.begin());
+    MeshData mesh;
+    mesh.vertices.resize(uniqueCount.back());
+    mesh.indices.resize(count);
+
+    std::vector<uint32_t> vertexIds(count);
+    parallelRanges(count, threadCount,
+                   [&](size_t begin, size_t end, unsigned range) {
+                     uint32_t next = uniqueCount[range];
+                     for (size_t i = begin; i < end; i++) {
+                       if (first[i] == i) {
+                         vertexIds[i] = next;
+                         mesh.vertices[next++] = corners[i];
+                       }
+                     }
+                   });
+    // an earlier range may own the first occurrence, so this is a separate
+    // pass
+    parallelRanges(count, threadCount,
+                   [&](size_t begin, size_t end, unsigned) {
+                     for (size_t i = begin; i < end; i++) {
+                       mesh.indices[i] = vertexIds[first[i]];
+                     }
+                   });
+
+    return mesh;
+  }
+
+  unsigned threadCount;
+  ObjLoadStats stats;
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Command line options
+struct Options {
+  // render into offscreen images instead of a window; no surface or swap
+  // chain is created, so this works without a display
+  bool headless = false;
+  // number of frames to render before exiting; 0 runs until the window is
+  // closed (or DEFAULT_HEADLESS_FRAMES when headless)
+  uint32_t frames = 0;
+  uint32_t width = 800;
+  uint32_t height = 600;
+  // sample count; 0 picks the highest the device supports
+  uint32_t msaa = 0;
+  // where to write the last rendered frame as a binary PPM (headless only)
+  std::string outputPath;
+  // record one command buffer per frame slot and swap chain image, and
+  // replay them until something they reference changes
+  bool cacheCommands = false;
+  // record the draws into secondary command buffers on this many threads;
+  // 0 records them straight into the primary command buffer
+  uint32_t recordThreads = 0;
+  // number of draw calls the model is split into
+  uint32_t draws = 1;
+  // time recording the draw list on 1 to all hardware threads before running
+  bool recordBenchmark = false;
+  // wait for each startup job as soon as it's started, to compare against
+  // the default of overlapping the independent steps
+  bool serialStartup = false;
+  // time generating a mip chain with compute against blits at startup
+  bool mipBenchmark = false;
+  // build the source texture's mips on the CPU even if the GPU could
+  bool cpuMips = false;
+  // store vertices as PackedVertex: quantized, half the size of Vertex
+  bool packedVertices = false;
+  // keep 32-bit indices even for meshes that 16-bit ones could address
+  bool uint32Indices = false;
+  // draw the model as meshlets culled on the GPU: with mesh shaders if the
+  // device has them, otherwise with a culling dispatch and indirect draws
+  bool meshlets = false;
+  // with --meshlets, take the indirect path even if mesh shaders would work
+  bool noMeshShaders = false;
+  // frustum cull the draw list in a compute pass and draw the survivors with
+  // indirect draws
+  bool gpuCulling = false;
+  // number of copies of the model, drawn with one instanced draw on a square
+  // grid
+  uint32_t instances = 1;
+  // time frames with 1, 4, 16, ... up to `instances` instances before
+  // running; vsync caps the frame rate in a window, so best run headless
+  bool instanceBenchmark = false;
+  // read textures out of a descriptor indexing texture table by index
+  bool bindless = false;
+  // where to write GPU scope timings on exit; .csv for CSV, JSON otherwise
+  std::string gpuProfilePath;
+  // where to write a Chrome trace of CPU markers on exit
+  std::string tracePath;
+
+  static constexpr uint32_t DEFAULT_HEADLESS_FRAMES = 100;
+
+  uint32_t frameLimit() const {
+    return frames == 0 && headless ? DEFAULT_HEADLESS_FRAMES : frames;
+  }
+};
+
+inline void printUsage(std::ostream& out, const char* program) {
+  out << "usage: " << program << " [options]\n"
+      << "  --headless          render offscreen, without a window\n"
+      << "  --frames N          exit after rendering N frames\n"
+      << "  --width N           framebuffer width (default 800)\n"
+      << "  --height N          framebuffer height (default 600)\n"
+      << "  --msaa N            MSAA sample count: 1, 2, 4, 8, ...\n"
+      << "  --output PATH       write the last frame to PATH as PPM "
+         "(headless)\n"
+      << "  --cache-commands    replay pre-recorded command buffers\n"
+      << "  --record-threads N  record draws on N threads into secondary "
+         "command buffers\n"
+      << "  --draws N           split the model into N draw calls (default 1)\n"
+      << "  --record-benchmark  time recording the draws on 1 to all threads\n"
+      << "  --serial-startup    run the startup steps one at a time\n"
+      << "  --mip-benchmark     compare compute and blit mip generation\n"
+      << "  --cpu-mips          build the source texture's mips on the CPU\n"
+      << "  --packed-vertices   quantize vertices to 16 bytes each\n"
+      << "  --uint32-indices    always use 32-bit indices\n"
+      << "  --meshlets          draw meshlets, culled on the GPU\n"
+      << "  --no-mesh-shaders   cull meshlets in compute, even with mesh "
+         "shaders\n"
+      << "  --gpu-culling       cull the draws on the GPU, draw indirect\n"
+      << "  --instances N       draw N copies of the model on a grid\n"
+      << "  --instance-benchmark\n"
+      << "                      time frames with 1 to N instances\n"
+      << "  --bindless          index textures in a bindless table\n"
+      << "  --gpu-profile PATH  write GPU timings to PATH (.json or .csv)\n"
+      << "  --trace PATH        write a Chrome trace of CPU markers to PATH\n"
+      << "  --help              show this message\n";
+}
+
+// Returns false if the program should exit without running, e.g. for --help
+inline bool parseOptions(int argc, char** argv, Options& options) {
+  auto number = [&](int& i) {
+    if (i + 1 >= argc) {
+      throw std::runtime_error(std::string(argv[i]) + " expects a value");
+    }
+    std::string_view arg = argv[++i];
+    uint32_t value;
+    auto [end, error] = std::from_chars(arg.data(), arg.data() + arg.size(),
+                                        value);
+    if (error != std::errc() || end != arg.data() + arg.size()) {
+      throw std::runtime_error(std::string(argv[i - 1]) +
+                               " expects a number, got " + std::string(arg));
+    }
+    return value;
+  };
+  auto path = [&](int& i) {
+    if (i + 1 >= argc) {
+      throw std::runtime_error(std::string(argv[i]) + " expects a path");
+    }
+    return std::string(argv[++i]);
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--frames") {
+      options.frames = number(i);
+    } else if (arg == "--width") {
+      options.width = number(i);
+    } else if (arg == "--height") {
+      options.height = number(i);
+    } else if (arg == "--msaa") {
+      options.msaa = number(i);
+      // must be a power of two
+      if (options.msaa == 0 || (options.msaa & (options.msaa - 1)) != 0) {
+        throw std::runtime_error("--msaa expects a power of two");
+      }
+    } else if (arg == "--output") {
+      options.outputPath = path(i);
+    } else if (arg == "--cache-commands") {
+      options.cacheCommands = true;
+    } else if (arg == "--record-threads") {
+      options.recordThreads = number(i);
+    } else if (arg == "--draws") {
+      options.draws = number(i);
+    } else if (arg == "--record-benchmark") {
+      options.recordBenchmark = true;
+    } else if (arg == "--serial-startup") {
+      options.serialStartup = true;
+    } else if (arg == "--mip-benchmark") {
+      options.mipBenchmark = true;
+    } else if (arg == "--cpu-mips") {
+      options.cpuMips = true;
+    } else if (arg == "--packed-vertices") {
+      options.packedVertices = true;
+    } else if (arg == "--uint32-indices") {
+      options.uint32Indices = true;
+    } else if (arg == "--meshlets") {
+      options.meshlets = true;
+    } else if (arg == "--no-mesh-shaders") {
+      options.noMeshShaders = true;
+    } else if (arg == "--gpu-culling") {
+      options.gpuCulling = true;
+    } else if (arg == "--instances") {
+      options.instances = number(i);
+    } else if (arg == "--instance-benchmark") {
+      options.instanceBenchmark = true;
+    } else if (arg == "--bindless") {
+      options.bindless = true;
+    } else if (arg == "--gpu-profile") {
+      options.gpuProfilePath = path(i);
+    } else if (arg == "--trace") {
+      options.tracePath = path(i);
+    } else if (arg == "--help" || arg == "-h") {
+      printUsage(std::cout, argv[0]);
+      return false;
+    } else {
+      printUsage(std::cerr, argv[0]);
+      throw std::runtime_error("unknown option " + std::string(arg));
+    }
+  }
+
+  if (options.width == 0 || options.height == 0) {
+    throw std::runtime_error("the framebuffer size must be non-zero");
+  }
+  if (options.draws == 0) {
+    throw std::runtime_error("--draws must be at least 1");
+  }
+  if (options.noMeshShaders && !options.meshlets) {
+    throw std::runtime_error("--no-mesh-shaders requires --meshlets");
+  }
+  // the meshlets make up one draw of their own
+  if (options.meshlets && options.draws > 1) {
+    throw std::runtime_error("--draws can't be used with --meshlets");
+  }
+  // the meshlets are culled on the GPU already
+  if (options.gpuCulling && options.meshlets) {
+    throw std::runtime_error("--gpu-culling can't be used with --meshlets");
+  }
+  if (options.instances == 0) {
+    throw std::runtime_error("--instances must be at least 1");
+  }
+  // both cull against the bounds of the one model at the origin
+  if (options.instances > 1 && (options.meshlets || options.gpuCulling)) {
+    throw std::runtime_error(
+        "--instances can't be used with --meshlets or --gpu-culling");
+  }
+  if (!options.outputPath.empty() && !options.headless) {
+    throw std::runtime_error("--output requires --headless");
+  }
+  return true;
+}
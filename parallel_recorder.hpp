@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu_trace.hpp"
+#include "job_system.hpp"
+
+// One indexed draw out of the frame's draw list
+struct DrawCommand {
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+};
+
+// Records a draw list into secondary command buffers on several threads, to
+// be run from the primary command buffer with vkCmdExecuteCommands.
+//
+// The draw list is split into one contiguous range per thread, so the
+// secondaries execute in draw order. Each range has its own command pool per
+// slot, as pools can't be used from two threads at once. A slot's pools are
+// reset every time it's recorded, so the caller must make sure the GPU is
+// done with the slot's previous recording: use a slot per frame in flight
+// (and per swap chain image, if primaries are reused across frames).
+//
+// The calling thread records the first range itself; the others are jobs on
+// the shared job system.
+class ParallelRecorder {
+ public:
+  // Records draws [begin, end) into a secondary command buffer that has
+  // already begun, inheriting the render pass.
+  using RecordFn =
+      std::function<void(VkCommandBuffer commandBuffer, size_t begin, size_t end)>;
+
+  void init(VkDevice device, uint32_t queueFamily, unsigned maxThreads) {
+    this->device = device;
+    this->queueFamily = queueFamily;
+    this->maxThreads = std::max(1u, maxThreads);
+  }
+
+  unsigned threadCount() const { return maxThreads; }
+
+  // (Re)creates the command pools for `slotCount` slots, each with one
+  // secondary command buffer per thread
+  void allocate(uint32_t slotCount) {
+    destroy();
+    pools.resize(static_cast<size_t>(slotCount) * maxThreads);
+    commandBuffers.resize(pools.size());
+    for (size_t i = 0; i < pools.size(); ++i) {
+      VkCommandPoolCreateInfo poolInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+          .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+          .queueFamilyIndex = queueFamily};
+      if (vkCreateCommandPool(device, &poolInfo, nullptr, &pools[i]) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create recorder command pool");
+      }
+
+      VkCommandBufferAllocateInfo allocInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+          .commandPool = pools[i],
+          .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+          .commandBufferCount = 1};
+      if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffers[i]) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate secondary command buffer");
+      }
+    }
+  }
+
+  // Records `drawCount` draws on up to `threads` threads (all of them if 0).
+  // Returns the secondary command buffers to execute, in order.
+  std::span<const VkCommandBuffer> record(
+      uint32_t slot,
+      const VkCommandBufferInheritanceInfo& inheritance,
+      size_t drawCount,
+      unsigned threads,
+      const RecordFn& recordDraws) {
+    if (threads == 0 || threads > maxThreads) {
+      threads = maxThreads;
+    }
+    threads = std::max(
+        1u, static_cast<unsigned>(std::min<size_t>(threads, drawCount)));
+
+    auto recordRange = [&, slot, threads](unsigned range) {
+      TRACE_SCOPE("record secondary");
+      const size_t index = static_cast<size_t>(slot) * maxThreads + range;
+      // the slot's previous recording has finished executing, see the class
+      // comment; resetting the whole pool is cheaper than each buffer
+      vkResetCommandPool(device, pools[index], 0);
+
+      VkCommandBufferBeginInfo beginInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+          .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+          .pInheritanceInfo = &inheritance};
+      if (vkBeginCommandBuffer(commandBuffers[index], &beginInfo) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to begin secondary command buffer");
+      }
+      recordDraws(commandBuffers[index], drawCount * range / threads,
+                  drawCount * (range + 1) / threads);
+      if (vkEndCommandBuffer(commandBuffers[index]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record secondary command buffer");
+      }
+    };
+
+    auto& jobs = JobSystem::shared();
+    std::vector<JobSystem::Handle> spawned;
+    for (unsigned range = 1; range < threads; ++range) {
+      spawned.push_back(jobs.spawn([&, range] { recordRange(range); }));
+    }
+    std::exception_ptr error;
+    try {
+      recordRange(0);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // the jobs reference this frame, so they must finish either way
+    jobs.wait(spawned);
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    return {commandBuffers.data() + static_cast<size_t>(slot) * maxThreads,
+            threads};
+  }
+
+  // Destroys the pools, freeing their command buffers
+  void destroy() {
+    for (VkCommandPool pool : pools) {
+      vkDestroyCommandPool(device, pool, nullptr);
+    }
+    pools.clear();
+    commandBuffers.clear();
+  }
+
+ private:
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t queueFamily = 0;
+  unsigned maxThreads = 1;
+  // indexed by slot * maxThreads + range
+  std::vector<VkCommandPool> pools;
+  std::vector<VkCommandBuffer> commandBuffers;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstring>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+// VkPipelineCache persisted to a file between runs. The saved data is only
+// handed back to the driver if its header matches the current device, since
+// drivers aren't required to reject data from another device or driver
+// version gracefully.
+class PipelineCache {
+ public:
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            const std::string& path) {
+    this->device = device;
+    this->path = path;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<char> initialData;
+    try {
+      initialData = readFile(path);
+    } catch (const std::runtime_error&) {
+      // no cache yet
+    }
+    if (!initialData.empty() && !isCompatible(initialData, properties)) {
+      std::cout << "discarding pipeline cache " << path
+                << " written by a different device or driver\n";
+      initialData.clear();
+    }
+    warm = !initialData.empty();
+
+    VkPipelineCacheCreateInfo createInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = initialData.size(),
+        .pInitialData = initialData.data()};
+    if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create pipeline cache");
+    }
+  }
+
+  VkPipelineCache handle() const { return cache; }
+
+  // Whether the cache was seeded from a previous run
+  bool isWarm() const { return warm; }
+
+  // Returns false if the cache couldn't be written, which isn't fatal
+  bool save() const {
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS) {
+      return false;
+    }
+    std::vector<std::byte> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) !=
+        VK_SUCCESS) {
+      return false;
+    }
+    data.resize(size);
+    return writeFileAtomically(path, data);
+  }
+
+  void destroy() {
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+  }
+
+ private:
+  static bool isCompatible(std::span<const char> data,
+                           const VkPhysicalDeviceProperties& properties) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header) &&
+           header.headerSize <= data.size() &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                  VK_UUID_SIZE) == 0;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  std::string path;
+  bool warm = false;
+};
@@ -0,0 +1,25 @@
+#version 450
+// for the runtime-sized texture array
+#extension GL_EXT_nonuniform_qualifier : require
+
+// triangle_app.frag, with the texture looked up in the bindless texture
+// table by the draw's index instead of bound on its own. See TextureTable.
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(set = 2, binding = 0) uniform sampler textureSampler;
+layout(set = 2, binding = 1) uniform texture2D textures[];
+
+layout(push_constant) uniform DrawConstants {
+    vec4 texCoordTransform;
+    // the same for the whole draw, so it needs no nonuniformEXT
+    uint textureIndex;
+} draw;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(sampler2D(textures[draw.textureIndex], textureSampler),
+                       fragTexCoord);
+}
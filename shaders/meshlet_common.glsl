@@ -0,0 +1,58 @@
+// Shared by the meshlet shaders: the meshlet data in set 1, and the culling
+// test run once per meshlet
+
+// matches mesh::Meshlet in meshlet_builder.hpp
+struct Meshlet {
+    vec3 center;
+    float radius;
+    vec3 coneAxis;
+    float coneCutoff;
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+layout(set = 1, binding = 0) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
+
+// updated every frame, in model space
+layout(set = 1, binding = 4) uniform Culling {
+    // inside is dot(plane.xyz, p) + plane.w >= 0; xyz is unit length
+    vec4 frustumPlanes[6];
+    vec4 cameraPosition;
+    uint meshletCount;
+} culling;
+
+// indexed by the result of cullMeshlet(); cleared before each frame
+layout(set = 1, binding = 5) buffer Stats {
+    uint counts[3];
+} stats;
+
+const uint VISIBLE = 0u;
+const uint FRUSTUM_CULLED = 1u;
+const uint BACKFACE_CULLED = 2u;
+
+// meshlets culled by a task workgroup, and handed to its mesh workgroups
+const uint TASK_GROUP_SIZE = 32u;
+struct TaskPayload {
+    uint meshletIndices[TASK_GROUP_SIZE];
+};
+
+uint cullMeshlet(Meshlet meshlet) {
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = culling.frustumPlanes[i];
+        if (dot(plane.xyz, meshlet.center) + plane.w < -meshlet.radius) {
+            return FRUSTUM_CULLED;
+        }
+    }
+    // every triangle faces away when the camera is behind the plane of the
+    // normal cone's tangent, pushed back by the bounding sphere
+    vec3 d = meshlet.center - culling.cameraPosition.xyz;
+    if (dot(d, meshlet.coneAxis) >=
+        meshlet.coneCutoff * length(d) + meshlet.radius) {
+        return BACKFACE_CULLED;
+    }
+    return VISIBLE;
+}
@@ -6,17 +6,25 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
+layout(push_constant) uniform DrawConstants {
+    // undoes the quantization of packed vertices: scale in xy, offset in zw
+    vec4 texCoordTransform;
+} draw;
+
 // blah blah
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+// per instance: where this copy of the model goes (locations 3 to 6)
+layout(location = 3) in mat4 inInstanceTransform;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    gl_Position = ubo.proj * ubo.view * inInstanceTransform * ubo.model *
+                  vec4(inPosition, 1.0);
     fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    fragTexCoord = inTexCoord * draw.texCoordTransform.xy + draw.texCoordTransform.zw;
 }
\ No newline at end of file
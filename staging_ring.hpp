@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <optional>
+
+#include "memory_allocator.hpp"
+
+struct StagingStats {
+  VkDeviceSize capacity = 0;
+  VkDeviceSize used = 0;
+  VkDeviceSize peakUsed = 0;
+  VkDeviceSize bytesStaged = 0;
+  uint64_t allocations = 0;
+  // number of times an upload had to wait for the GPU to free up space
+  uint64_t stalls = 0;
+};
+
+// Ring of persistently mapped staging memory. Space is handed out in order;
+// everything allocated between two commit() calls forms a region tagged with
+// the ticket of the upload batch that reads it, and comes back once that
+// ticket has completed. Tickets must increase monotonically.
+//
+// Only does the bookkeeping: the buffer and its memory belong to the caller.
+class StagingRing {
+ public:
+  using Ticket = uint64_t;
+
+  struct Region {
+    VkDeviceSize offset;
+    std::byte* data;
+  };
+
+  void init(VkBuffer buffer, void* mapped, VkDeviceSize capacity) {
+    this->buffer = buffer;
+    this->mapped = static_cast<std::byte*>(mapped);
+    stats.capacity = capacity;
+  }
+
+  VkBuffer handle() const { return buffer; }
+  VkDeviceSize capacity() const { return stats.capacity; }
+
+  // Returns nothing when there's currently no room, in which case the caller
+  // should commit, wait for the oldest ticket and retire() before retrying.
+  std::optional<Region> tryAllocate(VkDeviceSize size, VkDeviceSize alignment) {
+    const VkDeviceSize capacity = stats.capacity;
+    if (size > capacity) {
+      return std::nullopt;
+    }
+
+    VkDeviceSize offset = alignUp(head, alignment);
+    VkDeviceSize consumed;
+    if (stats.used == 0 || head > tail) {
+      // free space is [head, capacity) followed by [0, tail)
+      if (offset + size <= capacity) {
+        consumed = offset + size - head;
+      } else if (stats.used == 0 || size <= tail) {
+        // wrap around, giving up the end of the ring
+        consumed = capacity - head + size;
+        offset = 0;
+      } else {
+        return std::nullopt;
+      }
+    } else {
+      // wrapped: free space is [head, tail)
+      if (offset + size > tail || stats.used == capacity) {
+        return std::nullopt;
+      }
+      consumed = offset + size - head;
+    }
+
+    head = offset + size;
+    stats.used += consumed;
+    pendingBytes += consumed;
+    stats.peakUsed = std::max(stats.peakUsed, stats.used);
+    stats.bytesStaged += size;
+    ++stats.allocations;
+
+    return Region{.offset = offset, .data = mapped + offset};
+  }
+
+  bool hasPending() const { return pendingBytes > 0; }
+
+  // Everything allocated since the previous commit is in use until `ticket`
+  // completes.
+  void commit(Ticket ticket) {
+    if (pendingBytes == 0) {
+      return;
+    }
+    spans.push_back({.ticket = ticket, .end = head, .bytes = pendingBytes});
+    pendingBytes = 0;
+  }
+
+  void retire(Ticket completed) {
+    while (!spans.empty() && spans.front().ticket <= completed) {
+      stats.used -= spans.front().bytes;
+      tail = spans.front().end;
+      spans.pop_front();
+    }
+    if (stats.used == 0) {
+      head = tail = 0;
+    }
+  }
+
+  // Ticket of the oldest region still in use, if any
+  std::optional<Ticket> oldestTicket() const {
+    if (spans.empty()) {
+      return std::nullopt;
+    }
+    return spans.front().ticket;
+  }
+
+  void recordStall() { ++stats.stalls; }
+
+  const StagingStats& statistics() const { return stats; }
+
+ private:
+  struct Span {
+    Ticket ticket;
+    VkDeviceSize end;
+    VkDeviceSize bytes;
+  };
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  std::byte* mapped = nullptr;
+  VkDeviceSize head = 0;
+  VkDeviceSize tail = 0;
+  VkDeviceSize pendingBytes = 0;
+  std::deque<Span> spans;
+  StagingStats stats;
+};
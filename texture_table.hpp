@@ -0,0 +1,210 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "gpu_resources.hpp"
+
+// A bindless texture table: one descriptor set holding a sampler and a large
+// array of sampled images, which shaders index by a per-draw texture index
+// (see shaders/bindless.frag). The array is partially bound and
+// update-after-bind, so textures are added to the set that's already bound,
+// even while command buffers using it are pending, instead of needing new
+// sets and rebinding for each.
+//
+// Needs VK_EXT_descriptor_indexing, and vkGetPhysicalDeviceFeatures2 to
+// check for it, so an instance and device of at least Vulkan 1.1.
+class TextureTable {
+ public:
+  // at most this many textures, fewer if the device's limits are lower
+  static constexpr uint32_t MAX_TEXTURES = 4096;
+
+  static bool supported(VkPhysicalDevice physicalDevice,
+                        uint32_t instanceVersion) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    if (instanceVersion < VK_API_VERSION_1_1 ||
+        properties.apiVersion < VK_API_VERSION_1_1) {
+      return false;
+    }
+
+    if (!hasDeviceExtension(physicalDevice,
+                            VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+      return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT};
+    VkPhysicalDeviceFeatures2 features{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &indexingFeatures};
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+    return indexingFeatures.runtimeDescriptorArray &&
+           indexingFeatures.descriptorBindingPartiallyBound &&
+           indexingFeatures.descriptorBindingSampledImageUpdateAfterBind;
+  }
+
+  // The features to chain into VkDeviceCreateInfo, along with enabling
+  // VK_EXT_descriptor_indexing
+  static VkPhysicalDeviceDescriptorIndexingFeaturesEXT requiredFeatures() {
+    return {.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+            .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+            .descriptorBindingPartiallyBound = VK_TRUE,
+            .runtimeDescriptorArray = VK_TRUE};
+  }
+
+  // Creates the set layout, which pipelines using the table need, and the
+  // set itself, with no textures in it yet
+  void init(VkPhysicalDevice physicalDevice, VkDevice device) {
+    this->device = device;
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT};
+    VkPhysicalDeviceProperties2 properties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &indexingProperties};
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+    capacity = std::min(
+        {MAX_TEXTURES,
+         indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+         indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages});
+
+    std::array bindings{
+        VkDescriptorSetLayoutBinding{
+            .binding = SAMPLER_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT},
+        VkDescriptorSetLayoutBinding{
+            .binding = TEXTURES_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            .descriptorCount = capacity,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT}};
+    // only the slots shaders actually index need a texture in them, and they
+    // can be filled in while the set is bound
+    std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags{
+        0, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+               VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT};
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo{
+        .sType =
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+        .bindingCount = static_cast<uint32_t>(bindingFlags.size()),
+        .pBindingFlags = bindingFlags.data()};
+    VkDescriptorSetLayoutCreateInfo layoutInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.data()};
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                    &setLayout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture table set layout");
+    }
+
+    std::array poolSizes{
+        VkDescriptorPoolSize{.type = VK_DESCRIPTOR_TYPE_SAMPLER,
+                             .descriptorCount = 1},
+        VkDescriptorPoolSize{.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                             .descriptorCount = capacity}};
+    VkDescriptorPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+        .maxSets = 1,
+        .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+        .pPoolSizes = poolSizes.data()};
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture table pool");
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &setLayout};
+    if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate the texture table");
+    }
+  }
+
+  VkDescriptorSetLayout descriptorSetLayout() const { return setLayout; }
+  VkDescriptorSet descriptorSet() const { return set; }
+
+  // The sampler every texture is read with. Set it before drawing with the
+  // table; the sampler binding isn't update-after-bind.
+  void setSampler(VkSampler sampler) {
+    VkDescriptorImageInfo imageInfo{.sampler = sampler};
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = SAMPLER_BINDING,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .pImageInfo = &imageInfo};
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  // Puts a view in SHADER_READ_ONLY_OPTIMAL layout in the table and returns
+  // the index shaders read it by
+  uint32_t add(VkImageView imageView) {
+    uint32_t index;
+    if (!freeSlots.empty()) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    } else if (count < capacity) {
+      index = count++;
+    } else {
+      throw std::runtime_error("the texture table is full");
+    }
+
+    VkDescriptorImageInfo imageInfo{
+        .imageView = imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = TEXTURES_BINDING,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .pImageInfo = &imageInfo};
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    return index;
+  }
+
+  // Makes `index` available to add() again. No pending draw may still read
+  // it; the descriptor itself is left as it is, as nothing indexes it.
+  void remove(uint32_t index) { freeSlots.push_back(index); }
+
+  void destroy() {
+    if (device == VK_NULL_HANDLE) {
+      return;
+    }
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    device = VK_NULL_HANDLE;
+  }
+
+ private:
+  // see shaders/bindless.frag
+  static constexpr uint32_t SAMPLER_BINDING = 0;
+  static constexpr uint32_t TEXTURES_BINDING = 1;
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  uint32_t capacity = 0;
+  // slots handed out so far, some of which may have been removed since
+  uint32_t count = 0;
+  std::vector<uint32_t> freeSlots;
+};
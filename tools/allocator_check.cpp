@@ -0,0 +1,115 @@
+// Checks of BlockSubAllocator in memory_allocator.hpp, which places
+// resources without touching Vulkan: alignment, keeping linear and optimal
+// resources off shared granularity pages, free-list coalescing and running
+// out of space. Exits non-zero if any fails.
+//
+// usage: AllocatorCheck
+
+#include <optional>
+#include <stdexcept>
+
+#include "memory_allocator.hpp"
+#include "tools/check.hpp"
+
+namespace {
+
+bool disjoint(std::optional<VkDeviceSize> a,
+              VkDeviceSize aSize,
+              std::optional<VkDeviceSize> b,
+              VkDeviceSize bSize) {
+  return a && b && (*a + aSize <= *b || *b + bSize <= *a);
+}
+
+AllocatorStats statsOf(const BlockSubAllocator& block) {
+  AllocatorStats stats;
+  block.accumulateStats(stats);
+  return stats;
+}
+
+void checkAlignment() {
+  BlockSubAllocator block(4096, 1);
+  auto a = block.allocate(100, 1, AllocationKind::Linear);
+  auto b = block.allocate(64, 256, AllocationKind::Linear);
+  auto c = block.allocate(10, 16, AllocationKind::Linear);
+  check(a == 0, "the first allocation starts the block");
+  check(b == 256, "offsets honour the alignment");
+  // first fit puts c in the padding in front of b
+  check(c == 112, "alignment padding is reusable");
+  auto d = block.allocate(100, 4, AllocationKind::Linear);
+  check(d && *d % 4 == 0, "offsets honour a smaller alignment");
+  check(disjoint(a, 100, b, 64) && disjoint(a, 100, c, 10) &&
+            disjoint(b, 64, c, 10) && disjoint(a, 100, d, 100) &&
+            disjoint(b, 64, d, 100) && disjoint(c, 10, d, 100),
+        "allocations don't overlap");
+  check(block.used() == 274, "used bytes exclude the padding");
+}
+
+void checkGranularity() {
+  BlockSubAllocator block(8192, 1024);
+  auto buffer = block.allocate(1000, 16, AllocationKind::Linear);
+  auto image = block.allocate(100, 16, AllocationKind::Optimal);
+  auto buffer2 = block.allocate(100, 16, AllocationKind::Linear);
+  check(buffer == 0, "the buffer starts the block");
+  check(image == 1024, "an image after a buffer starts on the next page");
+  check(buffer2 == 2048, "a buffer after an image starts on the next page");
+  // the rest of the first page only borders the first buffer
+  auto buffer3 = block.allocate(16, 4, AllocationKind::Linear);
+  check(buffer3 == 1000, "same-kind resources share a page");
+}
+
+void checkCoalescing() {
+  BlockSubAllocator block(3000, 1);
+  auto a = block.allocate(1000, 1, AllocationKind::Linear);
+  auto b = block.allocate(1000, 1, AllocationKind::Linear);
+  auto c = block.allocate(1000, 1, AllocationKind::Linear);
+  check(a && b && c, "three ranges fill the block");
+
+  block.free(*a);
+  block.free(*c);
+  check(statsOf(block).freeRangeCount == 2, "separate holes stay separate");
+  check(!block.allocate(2000, 1, AllocationKind::Linear),
+        "two separate holes don't make one big enough range");
+
+  block.free(*b);
+  const AllocatorStats stats = statsOf(block);
+  check(block.empty(), "nothing is allocated after freeing everything");
+  check(stats.freeRangeCount == 1 && stats.largestFreeRange == 3000,
+        "freeing the middle range merges both neighbours");
+  check(block.allocate(3000, 1, AllocationKind::Linear) == 0,
+        "the merged range holds the whole block again");
+}
+
+void checkOutOfSpace() {
+  BlockSubAllocator block(1024, 1);
+  check(!block.allocate(1025, 1, AllocationKind::Linear),
+        "nothing bigger than the block fits");
+  check(block.allocate(1024, 1, AllocationKind::Linear) == 0,
+        "exactly the block fits");
+  check(!block.allocate(1, 1, AllocationKind::Linear),
+        "nothing fits in a full block");
+  check(block.used() == 1024 && block.allocations() == 1,
+        "failed allocations change nothing");
+
+  BlockSubAllocator aligned(1024, 1);
+  aligned.allocate(1, 1, AllocationKind::Linear);
+  check(!aligned.allocate(1000, 512, AllocationKind::Linear),
+        "alignment padding counts against the space left");
+
+  bool threw = false;
+  try {
+    block.free(512);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  check(threw, "freeing an offset that isn't allocated throws");
+}
+
+}  // namespace
+
+int main() {
+  checkAlignment();
+  checkGranularity();
+  checkCoalescing();
+  checkOutOfSpace();
+  return checkResult("allocator");
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// The harness shared by the standalone checks in tools/: call check() for
+// each expectation, and return checkResult() from main().
+
+inline int checkFailures = 0;
+
+inline void check(bool condition, const char* what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << "\n";
+    ++checkFailures;
+  }
+}
+
+// EXIT_SUCCESS if every check passed. `name` says what was checked.
+inline int checkResult(const char* name) {
+  if (checkFailures > 0) {
+    std::cerr << checkFailures << " " << name << " checks failed\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << name << " checks passed\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+// Checks of packIndices() in index_packing.hpp: 16-bit indices in one chunk
+// or several, and the fall back to 32-bit indices when 16 bits can't hold a
+// triangle or the chunks would be too short. Every packed index has to
+// decode back to the original one. Exits non-zero if any check fails.
+//
+// usage: IndexPackingCheck
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "index_packing.hpp"
+#include "tools/check.hpp"
+
+namespace {
+
+// Whether `packed` reads back as `indices`, chunk by chunk, with the chunks
+// covering every index in order
+bool decodes(const PackedIndices& packed,
+             const std::vector<uint32_t>& indices) {
+  if (packed.data.size() != indices.size() * packed.indexSize()) {
+    return false;
+  }
+  uint32_t next = 0;
+  for (const IndexChunk& chunk : packed.chunks) {
+    if (chunk.firstIndex != next || chunk.indexCount == 0 ||
+        chunk.vertexOffset < 0) {
+      return false;
+    }
+    for (uint32_t i = chunk.firstIndex;
+         i < chunk.firstIndex + chunk.indexCount; ++i) {
+      uint32_t stored;
+      if (packed.type == VK_INDEX_TYPE_UINT16) {
+        uint16_t narrow;
+        std::memcpy(&narrow, packed.data.data() + i * sizeof(uint16_t),
+                    sizeof(narrow));
+        stored = narrow;
+      } else {
+        std::memcpy(&stored, packed.data.data() + i * sizeof(uint32_t),
+                    sizeof(stored));
+      }
+      if (stored + chunk.vertexOffset != indices[i]) {
+        return false;
+      }
+    }
+    next = chunk.firstIndex + chunk.indexCount;
+  }
+  return next == indices.size();
+}
+
+// `count` triangles over consecutive vertices, from `first` on
+void appendStrip(std::vector<uint32_t>& indices,
+                 uint32_t first,
+                 uint32_t count) {
+  for (uint32_t t = first; t < first + count; ++t) {
+    indices.insert(indices.end(), {t, t + 1, t + 2});
+  }
+}
+
+void checkOneChunk() {
+  std::vector<uint32_t> indices;
+  appendStrip(indices, 0, 60000);
+  const PackedIndices packed = packIndices(indices, 60002);
+  check(packed.type == VK_INDEX_TYPE_UINT16 && packed.chunks.size() == 1,
+        "a mesh of up to 65536 vertices gets one 16-bit chunk");
+  check(decodes(packed, indices), "one 16-bit chunk decodes");
+
+  const PackedIndices wide = packIndices(indices, 60002, false);
+  check(wide.type == VK_INDEX_TYPE_UINT32 && decodes(wide, indices),
+        "16-bit indices can be ruled out");
+}
+
+void checkChunks() {
+  std::vector<uint32_t> indices;
+  appendStrip(indices, 0, 200000);
+  const PackedIndices packed = packIndices(indices, 200002);
+  check(packed.type == VK_INDEX_TYPE_UINT16 && packed.chunks.size() == 4,
+        "vertices used in order split into long 16-bit chunks");
+  check(decodes(packed, indices), "16-bit chunks decode");
+}
+
+void checkWideTriangle() {
+  std::vector<uint32_t> indices;
+  appendStrip(indices, 0, 100000);
+  // reuses a vertex from much earlier, as after optimizeVertexFetch()
+  indices.insert(indices.end(), {0, 99999, 100000});
+  appendStrip(indices, 100000, 100000);
+  check(!splitInto16BitChunks(indices),
+        "a triangle wider than 16 bits can't be split off");
+  const PackedIndices packed = packIndices(indices, 200002);
+  check(packed.type == VK_INDEX_TYPE_UINT32 && decodes(packed, indices),
+        "a triangle wider than 16 bits falls back to 32-bit indices");
+
+  const std::vector<uint32_t> first{0, 1, 70000, 1, 2, 3};
+  check(!splitInto16BitChunks(first),
+        "a wide first triangle doesn't make an empty chunk");
+}
+
+void checkShortChunks() {
+  // every other triangle at the far end of the vertices
+  std::vector<uint32_t> indices;
+  for (uint32_t t = 0; t < 1000; ++t) {
+    indices.insert(indices.end(), {t, t + 1, t + 2});
+    indices.insert(indices.end(), {t + 200000, t + 200001, t + 200002});
+  }
+  const auto chunks = splitInto16BitChunks(indices);
+  check(chunks && chunks->size() == 2000,
+        "alternating ranges split at every triangle");
+  const PackedIndices packed = packIndices(indices, 201002);
+  check(packed.type == VK_INDEX_TYPE_UINT32 && decodes(packed, indices),
+        "too many short chunks fall back to 32-bit indices");
+}
+
+}  // namespace
+
+int main() {
+  checkOneChunk();
+  checkChunks();
+  checkWideTriangle();
+  checkShortChunks();
+  return checkResult("index packing");
+}
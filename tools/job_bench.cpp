@@ -0,0 +1,177 @@
+// Microbenchmarks for job_system.hpp: the cost of spawning and running
+// jobs, and how well uneven work balances across the workers.
+//
+// usage: JobBench [workers]
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "job_system.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  return elapsed.count();
+}
+
+// Something for the optimizer to keep: about `iterations` * 4 ns of work
+double spin(uint32_t iterations, double seed) {
+  double x = seed;
+  for (uint32_t i = 0; i < iterations; ++i) {
+    x = x * 0.999999 + 1e-7;
+  }
+  return x;
+}
+
+void benchmarkSpawn(JobSystem& jobs) {
+  static constexpr int JOBS = 100000;
+
+  // empty jobs spawned from this thread, then waited on
+  {
+    std::vector<JobSystem::Handle> handles;
+    handles.reserve(JOBS);
+    auto start = Clock::now();
+    for (int i = 0; i < JOBS; ++i) {
+      handles.push_back(jobs.spawn([] {}));
+    }
+    jobs.wait(handles);
+    const double ms = elapsedMs(start);
+    std::cout << "spawn + wait, " << JOBS << " empty jobs: " << ms * 1e6 / JOBS
+              << " ns/job\n";
+  }
+
+  // the same, spawned from inside a job so they go to a worker's own deque
+  {
+    auto start = Clock::now();
+    auto root = jobs.spawn([&] {
+      std::vector<JobSystem::Handle> handles;
+      handles.reserve(JOBS);
+      for (int i = 0; i < JOBS; ++i) {
+        handles.push_back(jobs.spawn([] {}));
+      }
+      jobs.wait(handles);
+    });
+    jobs.wait(root);
+    const double ms = elapsedMs(start);
+    std::cout << "spawn + wait from a worker: " << ms * 1e6 / JOBS
+              << " ns/job\n";
+  }
+
+  // a chain of dependent jobs: the latency of handing one to the next
+  {
+    static constexpr int CHAIN = 10000;
+    auto start = Clock::now();
+    JobSystem::Handle previous = jobs.spawn([] {});
+    for (int i = 1; i < CHAIN; ++i) {
+      previous = jobs.spawn([] {}, {previous});
+    }
+    jobs.wait(previous);
+    const double ms = elapsedMs(start);
+    std::cout << "dependency chain of " << CHAIN
+              << " jobs: " << ms * 1e6 / CHAIN << " ns/job\n";
+  }
+
+  // parallelFor with trivial bodies: the fixed cost of fanning out
+  {
+    static constexpr int LOOPS = 10000;
+    auto start = Clock::now();
+    for (int i = 0; i < LOOPS; ++i) {
+      jobs.parallelFor(jobs.concurrency(), 1, [](size_t, size_t) {});
+    }
+    const double ms = elapsedMs(start);
+    std::cout << "empty parallelFor over " << jobs.concurrency()
+              << " items: " << ms * 1e3 / LOOPS << " us/call\n";
+  }
+}
+
+// Work whose cost grows with the index, so an even split is badly balanced
+void benchmarkBalance(JobSystem& jobs) {
+  static constexpr size_t ITEMS = 4096;
+  static constexpr uint32_t MAX_ITERATIONS = 20000;
+  auto cost = [](size_t i) {
+    return static_cast<uint32_t>(MAX_ITERATIONS * i * i / (ITEMS * ITEMS));
+  };
+  std::vector<double> results(ITEMS);
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < ITEMS; ++i) {
+    results[i] = spin(cost(i), static_cast<double>(i));
+  }
+  const double serialMs = elapsedMs(start);
+
+  // one contiguous range per thread, as a static split would do
+  start = Clock::now();
+  const size_t threads = jobs.concurrency();
+  jobs.parallelFor(ITEMS, (ITEMS + threads - 1) / threads,
+                   [&](size_t begin, size_t end) {
+                     for (size_t i = begin; i < end; ++i) {
+                       results[i] = spin(cost(i), static_cast<double>(i));
+                     }
+                   });
+  const double staticMs = elapsedMs(start);
+
+  start = Clock::now();
+  jobs.parallelFor(ITEMS, 16, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      results[i] = spin(cost(i), static_cast<double>(i));
+    }
+  });
+  const double dynamicMs = elapsedMs(start);
+
+  // recursive splitting: every job spawns its halves, so the work spreads by
+  // stealing alone
+  start = Clock::now();
+  std::function<void(size_t, size_t)> split = [&](size_t begin, size_t end) {
+    if (end - begin <= 16) {
+      for (size_t i = begin; i < end; ++i) {
+        results[i] = spin(cost(i), static_cast<double>(i));
+      }
+      return;
+    }
+    const size_t middle = begin + (end - begin) / 2;
+    auto left = jobs.spawn([&, begin, middle] { split(begin, middle); });
+    split(middle, end);
+    jobs.wait(left);
+  };
+  split(0, ITEMS);
+  const double stealingMs = elapsedMs(start);
+
+  std::cout << "uneven work on " << threads << " threads (speedup over "
+            << serialMs << " ms serial):\n"
+            << "  one range per thread: " << staticMs << " ms ("
+            << serialMs / staticMs << "x)\n"
+            << "  chunks of 16:         " << dynamicMs << " ms ("
+            << serialMs / dynamicMs << "x)\n"
+            << "  recursive split:      " << stealingMs << " ms ("
+            << serialMs / stealingMs << "x)\n";
+
+  double sum = 0;
+  for (double result : results) {
+    sum += result;
+  }
+  if (!std::isfinite(sum)) {
+    std::cout << sum << "\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  unsigned workers = JobSystem::defaultWorkerCount();
+  if (argc > 1) {
+    workers = static_cast<unsigned>(std::stoul(argv[1]));
+  }
+
+  JobSystem jobs(workers);
+  std::cout << jobs.workerCount() << " workers\n";
+  benchmarkSpawn(jobs);
+  benchmarkBalance(jobs);
+  return EXIT_SUCCESS;
+}
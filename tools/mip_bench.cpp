@@ -0,0 +1,102 @@
+// Throughput of the CPU mip chain generator in mip_chain.hpp, for each
+// format, filter and instruction set, on one thread and on the job system.
+// Reported in megapixels of the base level per second, for the whole chain.
+//
+// usage: MipBench [size]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "mip_chain.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Best of a few runs, in ms
+double timeChain(std::span<const std::byte> base,
+                 mipchain::Format format,
+                 uint32_t size,
+                 mipchain::Filter filter,
+                 mipchain::Isa isa,
+                 JobSystem* jobs) {
+  static constexpr int RUNS = 3;
+  double best = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    auto start = Clock::now();
+    auto levels = mipchain::generate(base, format, size, size, filter,
+                                     mipchain::SRGB | mipchain::ALPHA_WEIGHTED,
+                                     0, isa, jobs);
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (run == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t size = 2048;
+  if (argc > 1) {
+    size = static_cast<uint32_t>(std::stoul(argv[1]));
+  }
+
+  // noise, with some translucency so alpha weighting has work to do
+  std::mt19937 random(1);
+  std::vector<std::byte> rgba8(static_cast<size_t>(size) * size * 4);
+  for (auto& byte : rgba8) {
+    byte = static_cast<std::byte>(random());
+  }
+  std::vector<uint16_t> rgba16f(rgba8.size());
+  for (size_t i = 0; i < rgba16f.size(); ++i) {
+    rgba16f[i] =
+        mipchain::detail::floatToHalf(static_cast<float>(rgba8[i]) / 64.f);
+  }
+
+  std::vector<mipchain::Isa> isas{mipchain::Isa::SCALAR};
+  if (mipchain::bestIsa() != mipchain::Isa::SCALAR) {
+    isas.push_back(mipchain::Isa::SSE2);
+  }
+  if (mipchain::bestIsa() == mipchain::Isa::AVX2) {
+    isas.push_back(mipchain::Isa::AVX2);
+  }
+
+  auto& jobs = JobSystem::shared();
+  const double megapixels = static_cast<double>(size) * size / 1e6;
+  std::cout << "mip chain of a " << size << "x" << size
+            << " image, MPix/s (1 thread / " << jobs.concurrency()
+            << " threads):\n";
+
+  struct Case {
+    const char* name;
+    mipchain::Format format;
+    std::span<const std::byte> base;
+  };
+  const Case cases[]{
+      {"RGBA8", mipchain::Format::RGBA8, rgba8},
+      {"RGBA16F", mipchain::Format::RGBA16F, std::as_bytes(std::span(rgba16f))},
+  };
+  for (const auto& c : cases) {
+    for (auto filter : {mipchain::Filter::BOX, mipchain::Filter::KAISER}) {
+      for (auto isa : isas) {
+        const double serialMs =
+            timeChain(c.base, c.format, size, filter, isa, nullptr);
+        const double parallelMs =
+            timeChain(c.base, c.format, size, filter, isa, &jobs);
+        std::cout << "  " << c.name << " "
+                  << (filter == mipchain::Filter::BOX ? "box   " : "Kaiser")
+                  << " " << mipchain::isaName(isa) << ": "
+                  << megapixels / serialMs * 1e3 << " / "
+                  << megapixels / parallelMs * 1e3 << "\n";
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
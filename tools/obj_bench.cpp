@@ -0,0 +1,103 @@
+// Throughput of the OBJ loader in obj_loader.hpp, on one thread and on the
+// job system, parsing a synthetic grid mesh generated in memory. Reported in
+// face corners (vertices before deduplication) per second, best of a few
+// runs.
+//
+// usage: ObjBench [million triangles]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "obj_loader.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A square grid of at least `triangles` triangles, two per cell, with a
+// position and a texture coordinate per grid point shared by the cells
+// around it, so deduplication has work to do
+std::string gridObj(size_t triangles) {
+  size_t cells = 1;
+  while (2 * cells * cells < triangles) {
+    ++cells;
+  }
+  const size_t points = cells + 1;
+
+  std::string text;
+  text.reserve(points * points * 60 + 2 * cells * cells * 40);
+  for (size_t y = 0; y < points; ++y) {
+    for (size_t x = 0; x < points; ++x) {
+      const float u = static_cast<float>(x) / cells;
+      const float v = static_cast<float>(y) / cells;
+      text += "v " + std::to_string(u) + " " + std::to_string(v) + " " +
+              std::to_string(u * v) + "\n";
+      text += "vt " + std::to_string(u) + " " + std::to_string(v) + "\n";
+    }
+  }
+  // OBJ indices are one-based
+  auto corner = [&](size_t x, size_t y) {
+    const std::string index = std::to_string(y * points + x + 1);
+    return index + "/" + index;
+  };
+  for (size_t y = 0; y < cells; ++y) {
+    for (size_t x = 0; x < cells; ++x) {
+      text += "f " + corner(x, y) + " " + corner(x + 1, y) + " " +
+              corner(x + 1, y + 1) + "\n";
+      text += "f " + corner(x, y) + " " + corner(x + 1, y + 1) + " " +
+              corner(x, y + 1) + "\n";
+    }
+  }
+  return text;
+}
+
+// Best of a few runs, in seconds
+double timeParse(std::string_view text,
+                 unsigned threads,
+                 size_t& corners,
+                 size_t& vertices) {
+  static constexpr int RUNS = 3;
+  double best = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    ObjLoader loader(threads);
+    auto start = Clock::now();
+    MeshData mesh = loader.parse(text);
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    if (run == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+    corners = loader.statistics().corners;
+    vertices = mesh.vertices.size();
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double millionTriangles = 4;
+  if (argc > 1) {
+    millionTriangles = std::stod(argv[1]);
+  }
+
+  const std::string text =
+      gridObj(static_cast<size_t>(millionTriangles * 1e6));
+  const unsigned threads = JobSystem::shared().concurrency();
+  std::cout << "parsing a " << (text.size() >> 20) << " MiB OBJ grid:\n";
+
+  size_t corners = 0;
+  size_t vertices = 0;
+  const double serial = timeParse(text, 1, corners, vertices);
+  const double parallel = timeParse(text, threads, corners, vertices);
+  std::cout << "  " << corners << " corners, " << vertices
+            << " vertices after deduplication\n"
+            << "  1 thread: " << serial * 1e3 << " ms, "
+            << corners / serial / 1e6 << " M vertices/s\n"
+            << "  " << threads << " threads: " << parallel * 1e3 << " ms, "
+            << corners / parallel / 1e6 << " M vertices/s ("
+            << serial / parallel << "x)\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+// Offline texture converter: decodes an image once, builds its full mip chain
+// and writes it out as KTX2 files the application can upload as-is.
+//
+//   TextureCooker <input image> <output base>
+//
+// writes <output base>.bc7.ktx2 and <output base>.rgba8.ktx2 (the fallback for
+// devices without BC support).
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bc7_encoder.hpp"
+#include "ktx2.hpp"
+#include "mip_chain.hpp"
+
+namespace {
+
+void report(const std::string& path,
+            const std::vector<std::vector<std::byte>>& levels) {
+  size_t bytes = 0;
+  for (const auto& level : levels) {
+    bytes += level.size();
+  }
+  std::cout << "wrote " << path << ": " << levels.size() << " levels, "
+            << bytes / 1024 << " KiB\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <input image> <output base>\n";
+    return EXIT_FAILURE;
+  }
+  const std::string outputBase = argv[2];
+
+  try {
+    auto start = std::chrono::steady_clock::now();
+
+    int width, height, channels;
+    stbi_uc* pixels =
+        stbi_load(argv[1], &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+      throw std::runtime_error(std::string("failed to load ") + argv[1]);
+    }
+
+    std::vector<mipchain::Level> mips(1);
+    mips[0] = {.width = static_cast<uint32_t>(width),
+               .height = static_cast<uint32_t>(height)};
+    auto base = std::as_bytes(
+        std::span(pixels, static_cast<size_t>(width) * height * 4));
+    mips[0].data.assign(base.begin(), base.end());
+    stbi_image_free(pixels);
+
+    // the texels are sRGB encoded, though the formats are UNORM
+    uint32_t flags = mipchain::SRGB;
+    for (size_t i = 3; i < mips[0].data.size(); i += 4) {
+      if (mips[0].data[i] != std::byte{255}) {
+        flags |= mipchain::ALPHA_WEIGHTED;
+        break;
+      }
+    }
+    // offline, so the sharper filter is worth its cost
+    auto chain = mipchain::generate(mips[0].data, mipchain::Format::RGBA8,
+                                    mips[0].width, mips[0].height,
+                                    mipchain::Filter::KAISER, flags);
+    std::move(chain.begin(), chain.end(), std::back_inserter(mips));
+
+    std::vector<std::vector<std::byte>> rgba8, compressed;
+    for (auto& mip : mips) {
+      compressed.push_back(bc7::encodeImage(
+          reinterpret_cast<const uint8_t*>(mip.data.data()), mip.width,
+          mip.height));
+      rgba8.push_back(std::move(mip.data));
+    }
+
+    const std::string rgba8Path = outputBase + ".rgba8.ktx2";
+    ktx2::write(rgba8Path, VK_FORMAT_R8G8B8A8_UNORM, width, height, rgba8);
+    report(rgba8Path, rgba8);
+
+    const std::string bc7Path = outputBase + ".bc7.ktx2";
+    ktx2::write(bc7Path, VK_FORMAT_BC7_UNORM_BLOCK, width, height, compressed);
+    report(bc7Path, compressed);
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "cooked " << argv[1] << " in " << elapsed.count() << " ms\n";
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
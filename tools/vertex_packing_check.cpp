@@ -0,0 +1,83 @@
+// Round trip of packVertices() in vertex_packing.hpp: quantizes a few
+// vertices, reads them back the way the UNORM vertex attributes do and maps
+// them through the exported VertexQuantization, as the vertex shader and
+// model matrix do. Every value has to come back within one quantization
+// step. Exits non-zero if any doesn't.
+//
+// usage: VertexPackingCheck
+
+#include <cmath>
+#include <vector>
+
+#include "tools/check.hpp"
+#include "vertex_packing.hpp"
+
+namespace {
+
+// what a UNORM attribute gives the shader for a stored value
+float unorm16(uint16_t stored) {
+  return stored / 65535.f;
+}
+
+// one step of 16 bit quantization over `range`, with some slack for float
+// rounding
+bool withinStep(float decoded, float original, float range) {
+  const float step = range / 65535.f;
+  return std::abs(decoded - original) <= step + 1e-6f * std::abs(original);
+}
+
+void checkRoundTrip() {
+  const std::vector<Vertex> vertices{
+      {.pos = {-2.5f, 0.f, 1.f}, .texCoord = {0.f, 1.f}},
+      {.pos = {4.f, 0.f, 1.f}, .texCoord = {0.25f, 0.5f}},
+      {.pos = {0.123f, 0.f, 1.f}, .texCoord = {0.999f, -3.f}},
+      {.pos = {1.f / 3.f, 0.f, 1.f}, .texCoord = {2.f, 0.1f}},
+  };
+  const PackedMesh mesh = packVertices(vertices);
+  const VertexQuantization& q = mesh.quantization;
+  check(mesh.vertices.size() == vertices.size(), "every vertex is packed");
+
+  bool posOk = true;
+  bool texCoordOk = true;
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const Vertex& v = vertices[i];
+    const PackedVertex& packed = mesh.vertices[i];
+    for (int c = 0; c < 3; ++c) {
+      const float decoded =
+          q.posOffset[c] + q.posScale[c] * unorm16(packed.pos[c]);
+      posOk = posOk && withinStep(decoded, v.pos[c], q.posScale[c]);
+    }
+    for (int c = 0; c < 2; ++c) {
+      const float decoded = q.texCoordOffset[c] +
+                            q.texCoordScale[c] * unorm16(packed.texCoord[c]);
+      texCoordOk =
+          texCoordOk && withinStep(decoded, v.texCoord[c], q.texCoordScale[c]);
+    }
+  }
+  check(posOk, "positions come back within one step");
+  check(texCoordOk, "texture coordinates come back within one step");
+
+  // the bounding box ends are exact
+  check(mesh.vertices[0].pos[0] == 0 && mesh.vertices[1].pos[0] == 65535,
+        "the box's ends map onto the ends of the range");
+  // an axis every vertex shares has no range to scale
+  check(q.posScale[1] == 0.f && q.posOffset[1] == 0.f &&
+            q.posScale[2] == 0.f && q.posOffset[2] == 1.f,
+        "a flat axis decodes to its one value");
+}
+
+void checkEmpty() {
+  const PackedMesh mesh = packVertices({});
+  check(mesh.vertices.empty(), "no vertices pack to nothing");
+  check(mesh.quantization.posScale == glm::vec3(1.f) &&
+            mesh.quantization.posOffset == glm::vec3(0.f),
+        "no vertices leave the identity quantization");
+}
+
+}  // namespace
+
+int main() {
+  checkRoundTrip();
+  checkEmpty();
+  return checkResult("vertex packing");
+}
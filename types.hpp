@@ -6,6 +6,10 @@
 
 #include <vulkan/vulkan.h>
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
 struct Vertex {
     glm::vec3 pos;
     glm::vec3 color;
@@ -65,8 +69,99 @@ namespace std {
     };
 }
 
+// Half the size of Vertex: positions as 16-bit fractions of the mesh's
+// bounding box, colour as RGBA8 and texture coordinates as 16-bit fractions
+// of their own bounding box. See VertexQuantization for getting the original
+// values back; the shaders read both layouts as floats.
+struct PackedVertex {
+    uint16_t pos[4];  // w is padding
+    uint8_t color[4];
+    uint16_t texCoord[2];
+
+    static constexpr auto getBindingDescription() {
+        return VkVertexInputBindingDescription {
+            .binding = 0,
+            .stride = sizeof(PackedVertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        };
+    }
+
+    // Same locations as Vertex, so the same vertex shader reads either
+    static constexpr auto getAttributeDescriptions() {
+        return std::array {
+            VkVertexInputAttributeDescription {
+                .binding = 0,
+                .location = 0,
+                .format = VK_FORMAT_R16G16B16A16_UNORM,
+                .offset = offsetof(PackedVertex, pos)
+            },
+            VkVertexInputAttributeDescription {
+                .binding = 0,
+                .location = 1,
+                .format = VK_FORMAT_R8G8B8A8_UNORM,
+                .offset = offsetof(PackedVertex, color)
+            },
+            VkVertexInputAttributeDescription{
+                .binding = 0,
+                .location = 2,
+                .format = VK_FORMAT_R16G16_UNORM,
+                .offset = offsetof(PackedVertex, texCoord)
+            }
+        };
+    }
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+// Maps what the vertex shader reads back to model space and texture space:
+// original = offset + scale * stored, with stored in [0, 1] for the UNORM
+// attributes of PackedVertex. The identity for Vertex.
+struct VertexQuantization {
+    glm::vec3 posOffset{0.f};
+    glm::vec3 posScale{1.f};
+    glm::vec2 texCoordOffset{0.f};
+    glm::vec2 texCoordScale{1.f};
+};
+
+// Where one copy of the model goes, in a second vertex buffer that steps
+// once per instance instead of once per vertex
+struct InstanceData {
+    glm::mat4 transform;
+
+    static constexpr auto getBindingDescription() {
+        return VkVertexInputBindingDescription {
+            .binding = 1,
+            .stride = sizeof(InstanceData),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+        };
+    }
+
+    // A mat4 attribute takes one location per column, after the vertex's
+    static constexpr auto getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 4> attributes{};
+        for (uint32_t column = 0; column < 4; ++column) {
+            attributes[column] = {
+                .location = 3 + column,
+                .binding = 1,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = static_cast<uint32_t>(column * sizeof(glm::vec4))
+            };
+        }
+        return attributes;
+    }
+};
+static_assert(sizeof(InstanceData) == 64);
+
 struct UniformBufferObject {
     alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
+};
+
+// Small per-draw values, set with vkCmdPushConstants rather than kept in the
+// uniform buffer
+struct DrawConstants {
+    // texture coordinate scale in xy, offset in zw
+    glm::vec4 texCoordTransform;
+    // with --bindless, the texture's index in the texture table
+    uint32_t textureIndex = 0;
 };
\ No newline at end of file
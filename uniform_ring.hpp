@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "memory_allocator.hpp"
+
+// One persistently mapped uniform buffer with a region per frame in flight,
+// read through UNIFORM_BUFFER_DYNAMIC descriptors: a descriptor is written
+// once with the range a shader sees, and the dynamic offset given when its
+// set is bound picks the data. Each frame pushes its uniforms into its own
+// region in order, at offsets aligned to minUniformBufferOffsetAlignment, and
+// rewrites the region from the start once the frame's fence has signalled.
+//
+// So per-frame and per-object uniforms need neither buffers nor descriptor
+// sets of their own.
+class UniformRing {
+ public:
+  void init(VkPhysicalDevice physicalDevice,
+            VkDevice device,
+            DeviceMemoryAllocator& allocator,
+            uint32_t frameCount,
+            VkDeviceSize frameCapacity) {
+    this->device = device;
+    this->allocator = &allocator;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    alignment = std::max<VkDeviceSize>(
+        properties.limits.minUniformBufferOffsetAlignment, 1);
+    regionSize = alignUp(frameCapacity, alignment);
+
+    VkBufferCreateInfo bufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                  .size = regionSize * frameCount,
+                                  .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                  .sharingMode = VK_SHARING_MODE_EXCLUSIVE};
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create uniform ring");
+    }
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer, &requirements);
+    memory = allocator.allocate(requirements,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                AllocationKind::Linear);
+    vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+  }
+
+  VkBuffer handle() const { return buffer; }
+
+  // The dynamic offset of the first thing pushed for `frame`, which is known
+  // before the frame's uniforms are, so command buffers can be recorded
+  // against it first
+  uint32_t frameOffset(uint32_t frame) const {
+    return static_cast<uint32_t>(frame * regionSize);
+  }
+
+  // Starts refilling `frame`'s region. Call once its fence has signalled.
+  void beginFrame(uint32_t frame) {
+    currentFrame = frame;
+    head = 0;
+  }
+
+  // Copies `size` bytes into the current frame's region and returns the
+  // dynamic offset to bind them at
+  uint32_t push(const void* data, VkDeviceSize size) {
+    const VkDeviceSize offset = alignUp(head, alignment);
+    if (offset + size > regionSize) {
+      throw std::runtime_error("out of uniform ring space for the frame");
+    }
+    const uint32_t dynamicOffset =
+        frameOffset(currentFrame) + static_cast<uint32_t>(offset);
+    std::memcpy(static_cast<std::byte*>(memory.mapped) + dynamicOffset, data,
+                size);
+    head = offset + size;
+    return dynamicOffset;
+  }
+
+  template <typename T>
+  uint32_t push(const T& value) {
+    return push(&value, sizeof(T));
+  }
+
+  void destroy() {
+    if (device == VK_NULL_HANDLE) {
+      return;
+    }
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator->free(memory);
+    buffer = VK_NULL_HANDLE;
+    device = VK_NULL_HANDLE;
+  }
+
+ private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceMemoryAllocator* allocator = nullptr;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation memory;
+  VkDeviceSize alignment = 1;
+  VkDeviceSize regionSize = 0;
+  uint32_t currentFrame = 0;
+  // where the next push goes in the current frame's region
+  VkDeviceSize head = 0;
+};
@@ -0,0 +1,492 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "staging_ring.hpp"
+
+// Batches host-to-device copies into one submission instead of a
+// submit-and-vkQueueWaitIdle per copy.
+//
+// Each batch has two command buffers:
+//  - transfer commands run on the transfer queue family (a dedicated one if
+//    the device has it) and contain the copies.
+//  - graphics commands run on the graphics queue after the transfer commands
+//    and contain whatever needs a graphics queue (blits, transitions to
+//    shader layouts), plus the queue family ownership acquires.
+// Completion is tracked with a fence per batch. Nothing here blocks unless
+// wait() is called explicitly, or the staging ring is full: rendering
+// submitted to the graphics queue after flush() is ordered behind the upload
+// by the barriers in the graphics commands.
+//
+// Source data goes through a persistently mapped staging ring, so an upload
+// is a memcpy plus a recorded copy.
+class UploadService {
+ public:
+  using Ticket = StagingRing::Ticket;
+
+  static constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+  // One mip level of an image upload
+  struct ImageLevel {
+    uint32_t mipLevel;
+    VkExtent2D extent;
+    std::span<const std::byte> data;
+    // bytes per row of texel blocks, and texel rows per block (4 for BCn)
+    VkDeviceSize rowPitch;
+    uint32_t blockHeight = 1;
+  };
+
+  void init(VkDevice device,
+            uint32_t graphicsFamily,
+            VkQueue graphicsQueue,
+            uint32_t transferFamily,
+            VkQueue transferQueue,
+            VkExtent3D transferGranularity) {
+    this->device = device;
+    this->graphicsFamily = graphicsFamily;
+    this->graphicsQueue = graphicsQueue;
+    this->transferFamily = transferFamily;
+    this->transferQueue = transferQueue;
+    this->transferGranularity = transferGranularity;
+
+    graphicsPool = createPool(graphicsFamily);
+    transferPool = createPool(transferFamily);
+  }
+
+  // The staging buffer must be host-visible, host-coherent, persistently
+  // mapped and created with TRANSFER_SRC usage.
+  void initStaging(VkBuffer buffer, void* mapped, VkDeviceSize capacity) {
+    staging.init(buffer, mapped, capacity);
+  }
+
+  const StagingStats& stagingStats() const { return staging.statistics(); }
+
+  // Reserves space in the staging ring. If the ring is full, this flushes
+  // and waits for the oldest upload to finish.
+  StagingRing::Region reserveStaging(VkDeviceSize size,
+                                     VkDeviceSize alignment = STAGING_ALIGNMENT) {
+    while (true) {
+      if (auto region = staging.tryAllocate(size, alignment)) {
+        return *region;
+      }
+
+      if (size > staging.capacity()) {
+        throw std::runtime_error("upload is larger than the staging ring");
+      }
+
+      // back-pressure: our own pending data might be what's filling the ring
+      if (staging.hasPending()) {
+        flush();
+      }
+      auto oldest = staging.oldestTicket();
+      if (!oldest) {
+        throw std::runtime_error("staging ring full with nothing in flight");
+      }
+      staging.recordStall();
+      wait(*oldest);
+    }
+  }
+
+  StagingRing::Region stage(std::span<const std::byte> data,
+                            VkDeviceSize alignment = STAGING_ALIGNMENT) {
+    auto region = reserveStaging(data.size(), alignment);
+    memcpy(region.data, data.data(), data.size());
+    return region;
+  }
+
+  // Copies `data` into `dst` at `dstOffset`, in chunks if it's larger than a
+  // reasonable slice of the staging ring.
+  void uploadBuffer(VkBuffer dst,
+                    VkDeviceSize dstOffset,
+                    std::span<const std::byte> data) {
+    const VkDeviceSize chunkSize = maxChunkSize();
+    for (VkDeviceSize pos = 0; pos < data.size(); pos += chunkSize) {
+      auto chunk = data.subspan(pos, std::min(chunkSize, data.size() - pos));
+      auto region = stage(chunk);
+      copyBuffer(staging.handle(), dst,
+                 VkBufferCopy{.srcOffset = region.offset,
+                              .dstOffset = dstOffset + pos,
+                              .size = chunk.size()});
+    }
+  }
+
+  // Uploads the given levels of an image, transitioning all of its mip levels
+  // from UNDEFINED. The image is left in TRANSFER_DST_OPTIMAL and owned by the
+  // graphics queue, ready for mipmap generation or a transition to its final
+  // layout in graphicsCommands().
+  void uploadImage(VkImage image,
+                   uint32_t mipLevels,
+                   std::span<const ImageLevel> levels) {
+    VkImageMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                          .baseMipLevel = 0,
+                          .levelCount = mipLevels,
+                          .baseArrayLayer = 0,
+                          .layerCount = 1}};
+
+    vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    for (const auto& level : levels) {
+      const uint32_t blockRows =
+          (level.extent.height + level.blockHeight - 1) / level.blockHeight;
+      const uint32_t rowsPerChunk = rowsPerImageChunk(level, blockRows);
+
+      for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+        const uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+        const uint32_t y = row * level.blockHeight;
+        // staging can flush the batch, so fetch the command buffer after
+        auto region = stage(
+            level.data.subspan(row * level.rowPitch, rows * level.rowPitch));
+
+        VkBufferImageCopy copy{
+            .bufferOffset = region.offset,
+            .bufferRowLength = 0,    // indicates tightly packed
+            .bufferImageHeight = 0,  // indicates tightly packed
+            .imageSubresource{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                              .mipLevel = level.mipLevel,
+                              .baseArrayLayer = 0,
+                              .layerCount = 1},
+            .imageOffset{.x = 0, .y = static_cast<int32_t>(y), .z = 0},
+            .imageExtent{
+                .width = level.extent.width,
+                .height = std::min(rows * level.blockHeight,
+                                   level.extent.height - y),
+                .depth = 1}};
+        vkCmdCopyBufferToImage(transferCommands(), staging.handle(), image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+      }
+    }
+
+    // hand the image over to the graphics queue, staying in TRANSFER_DST
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    setOwnershipTransfer(barrier);
+
+    if (hasDedicatedTransferQueue()) {
+      vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                           0, nullptr, 1, &barrier);
+    }
+    vkCmdPipelineBarrier(graphicsCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+  }
+
+  bool hasDedicatedTransferQueue() const {
+    return transferFamily != graphicsFamily;
+  }
+
+  // Records a buffer copy. The destination is usable by any graphics queue
+  // work submitted after the next flush().
+  void copyBuffer(VkBuffer src, VkBuffer dst, const VkBufferCopy& region) {
+    vkCmdCopyBuffer(transferCommands(), src, dst, 1, &region);
+
+    VkBufferMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = dst,
+        .offset = region.dstOffset,
+        .size = region.size};
+    setOwnershipTransfer(barrier);
+
+    if (hasDedicatedTransferQueue()) {
+      // release on the transfer queue; the dst half is ignored there
+      vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                           1, &barrier, 0, nullptr);
+    }
+    // acquire on the graphics queue (or a plain barrier on a shared queue)
+    vkCmdPipelineBarrier(graphicsCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+  }
+
+  // Command buffer of the open batch that runs on the transfer queue
+  VkCommandBuffer transferCommands() {
+    auto& batch = openBatch();
+    if (!batch.transferRecording) {
+      begin(batch.transfer);
+      batch.transferRecording = true;
+    }
+    return batch.transfer;
+  }
+
+  // Command buffer of the open batch that runs on the graphics queue, after
+  // the transfer commands
+  VkCommandBuffer graphicsCommands() {
+    auto& batch = openBatch();
+    if (!batch.graphicsRecording) {
+      begin(batch.graphics);
+      batch.graphicsRecording = true;
+    }
+    return batch.graphics;
+  }
+
+  // Runs `deleter` once the open batch has finished executing. Used to
+  // release staging resources.
+  void releaseAfterCompletion(std::function<void()> deleter) {
+    openBatch().deleters.push_back(std::move(deleter));
+  }
+
+  // Ticket that will be signalled by the open batch. Useful to wait for
+  // something that was just recorded.
+  Ticket pendingTicket() const { return nextTicket; }
+
+  // Submits the open batch, if there is one. Doesn't wait.
+  Ticket flush() {
+    if (!current) {
+      return lastSubmitted;
+    }
+
+    auto& batch = *current;
+    // the graphics half always runs since it holds the ownership acquires
+    graphicsCommands();
+    staging.commit(batch.ticket);
+
+    if (batch.transferRecording) {
+      vkEndCommandBuffer(batch.transfer);
+
+      VkSubmitInfo submitInfo{.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                              .commandBufferCount = 1,
+                              .pCommandBuffers = &batch.transfer,
+                              .signalSemaphoreCount = 1,
+                              .pSignalSemaphores = &batch.transferDone};
+      if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to submit transfer commands");
+      }
+    }
+
+    vkEndCommandBuffer(batch.graphics);
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = batch.transferRecording ? 1u : 0u,
+        .pWaitSemaphores = &batch.transferDone,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch.graphics};
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to submit upload commands");
+    }
+
+    lastSubmitted = batch.ticket;
+    inFlight.push_back(std::move(batch));
+    current.reset();
+    ++nextTicket;
+    return lastSubmitted;
+  }
+
+  bool isComplete(Ticket ticket) {
+    collect();
+    return ticket <= completed;
+  }
+
+  // Blocks until the batch with the given ticket is done. Flushes first if
+  // the ticket belongs to the open batch.
+  void wait(Ticket ticket) {
+    if (current && ticket >= current->ticket) {
+      flush();
+    }
+    for (auto& batch : inFlight) {
+      if (batch.ticket <= ticket) {
+        vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+      }
+    }
+    collect();
+  }
+
+  // Recycles batches whose fence has signalled. Cheap enough to call every
+  // frame.
+  void collect() {
+    while (!inFlight.empty() &&
+           vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS) {
+      auto batch = std::move(inFlight.front());
+      inFlight.pop_front();
+
+      for (auto& deleter : batch.deleters) {
+        deleter();
+      }
+      batch.deleters.clear();
+      completed = batch.ticket;
+
+      vkResetFences(device, 1, &batch.fence);
+      vkResetCommandBuffer(batch.transfer, 0);
+      vkResetCommandBuffer(batch.graphics, 0);
+      batch.transferRecording = batch.graphicsRecording = false;
+      freeBatches.push_back(std::move(batch));
+    }
+
+    staging.retire(completed);
+  }
+
+  void destroy() {
+    if (current) {
+      flush();
+    }
+    wait(lastSubmitted);
+
+    for (auto& batch : freeBatches) {
+      vkDestroyFence(device, batch.fence, nullptr);
+      vkDestroySemaphore(device, batch.transferDone, nullptr);
+    }
+    freeBatches.clear();
+
+    // also frees the command buffers
+    vkDestroyCommandPool(device, graphicsPool, nullptr);
+    vkDestroyCommandPool(device, transferPool, nullptr);
+  }
+
+ private:
+  struct Batch {
+    Ticket ticket = 0;
+    VkCommandBuffer transfer = VK_NULL_HANDLE;
+    VkCommandBuffer graphics = VK_NULL_HANDLE;
+    VkSemaphore transferDone = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    bool transferRecording = false;
+    bool graphicsRecording = false;
+    std::vector<std::function<void()>> deleters;
+  };
+
+  VkCommandPool createPool(uint32_t family) {
+    VkCommandPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                 VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = family};
+
+    VkCommandPool pool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create upload command pool");
+    }
+    return pool;
+  }
+
+  VkCommandBuffer allocateCommandBuffer(VkCommandPool pool) {
+    VkCommandBufferAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1};
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate upload command buffer");
+    }
+    return commandBuffer;
+  }
+
+  Batch& openBatch() {
+    if (current) {
+      return *current;
+    }
+
+    if (!freeBatches.empty()) {
+      current = std::move(freeBatches.back());
+      freeBatches.pop_back();
+    } else {
+      Batch batch{.transfer = allocateCommandBuffer(transferPool),
+                  .graphics = allocateCommandBuffer(graphicsPool)};
+
+      VkSemaphoreCreateInfo semaphoreInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+      VkFenceCreateInfo fenceInfo{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                            &batch.transferDone) != VK_SUCCESS ||
+          vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) !=
+              VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload sync objects");
+      }
+      current = std::move(batch);
+    }
+
+    current->ticket = nextTicket;
+    return *current;
+  }
+
+  static void begin(VkCommandBuffer commandBuffer) {
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin upload command buffer");
+    }
+  }
+
+  // Keeps single copies to a quarter of the ring so that a large upload can
+  // be overlapped with the copy of the previous chunk
+  VkDeviceSize maxChunkSize() const {
+    return std::max<VkDeviceSize>(staging.capacity() / 4, 1);
+  }
+
+  uint32_t rowsPerImageChunk(const ImageLevel& level, uint32_t blockRows) const {
+    // a zero granularity means only whole mip levels can be copied
+    if (level.data.size() <= maxChunkSize() || transferGranularity.height == 0) {
+      return blockRows;
+    }
+
+    // partial copies have to start on a multiple of the granularity
+    const uint32_t granularityRows = std::max(
+        1u, (transferGranularity.height + level.blockHeight - 1) /
+                level.blockHeight);
+    uint32_t rows = static_cast<uint32_t>(
+        std::max<VkDeviceSize>(maxChunkSize() / level.rowPitch, 1));
+    return std::max(granularityRows, rows / granularityRows * granularityRows);
+  }
+
+  // Resources are created with exclusive sharing, so a copy done on a
+  // dedicated transfer queue has to be released to the graphics queue.
+  template <typename Barrier>
+  void setOwnershipTransfer(Barrier& barrier) const {
+    if (hasDedicatedTransferQueue()) {
+      barrier.srcQueueFamilyIndex = transferFamily;
+      barrier.dstQueueFamilyIndex = graphicsFamily;
+    }
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t graphicsFamily = 0;
+  uint32_t transferFamily = 0;
+  VkQueue graphicsQueue = VK_NULL_HANDLE;
+  VkQueue transferQueue = VK_NULL_HANDLE;
+  VkExtent3D transferGranularity{1, 1, 1};
+  VkCommandPool graphicsPool = VK_NULL_HANDLE;
+  VkCommandPool transferPool = VK_NULL_HANDLE;
+
+  StagingRing staging;
+  std::optional<Batch> current;
+  std::deque<Batch> inFlight;
+  std::vector<Batch> freeBatches;
+
+  Ticket nextTicket = 1;
+  Ticket lastSubmitted = 0;
+  Ticket completed = 0;
+};
@@ -1,7 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 std::vector<char> readFile(const std::string& path) {
   std::ifstream file(path, std::ios::ate | std::ios::binary);
@@ -43,4 +62,126 @@ inline constexpr bool hasFlags(T value, E flagsToCheck) {
 inline constexpr bool hasBit(std::convertible_to<size_t> auto value,
                              std::integral auto index) {
   return value & (1 << index);
-}
\ No newline at end of file
+}
+
+// Read-only view of a whole file, memory-mapped where the platform allows it
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+    buffer = readFile(path);
+    view = {reinterpret_cast<const std::byte*>(buffer.data()), buffer.size()};
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("unable to open file");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      throw std::runtime_error("unable to stat file");
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size > 0) {
+      void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("unable to map file");
+      }
+      view = {static_cast<const std::byte*>(data), size};
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+#endif
+  }
+
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    std::swap(view, other.view);
+#ifdef _WIN32
+    std::swap(buffer, other.buffer);
+#endif
+    return *this;
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (!view.empty()) {
+      munmap(const_cast<std::byte*>(view.data()), view.size());
+    }
+#endif
+  }
+
+  std::span<const std::byte> bytes() const { return view; }
+  std::string_view text() const {
+    return {reinterpret_cast<const char*>(view.data()), view.size()};
+  }
+
+ private:
+  std::span<const std::byte> view;
+#ifdef _WIN32
+  std::vector<char> buffer;
+#endif
+};
+
+// Replaces `path` with whatever `write(out)` writes to the std::ofstream
+// `out`, by way of a temporary file, so that readers never see a partially
+// written file. Returns false on failure.
+template <typename Write>
+  requires std::invocable<Write&, std::ofstream&>
+bool writeFileAtomically(const std::string& path, Write&& write) {
+  const std::string tmpPath = path + ".tmp";
+  bool written;
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (out) {
+      write(out);
+    }
+    written = static_cast<bool>(out);
+  }
+  if (!written || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+inline bool writeFileAtomically(const std::string& path,
+                                std::span<const std::byte> data) {
+  return writeFileAtomically(path, [&](std::ofstream& out) {
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+  });
+}
+
+// Fast non-cryptographic 64-bit hash, good enough to notice edited files
+inline uint64_t hashBytes(std::span<const std::byte> data) {
+  constexpr uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+  uint64_t h = data.size() * multiplier;
+
+  auto mix = [&](uint64_t word) {
+    h = (h ^ word) * 0xff51afd7ed558ccdull;
+    h ^= h >> 29;
+  };
+
+  size_t i = 0;
+  for (; i + 8 <= data.size(); i += 8) {
+    uint64_t word;
+    memcpy(&word, data.data() + i, 8);
+    mix(word);
+  }
+  if (i < data.size()) {
+    uint64_t tail = 0;
+    memcpy(&tail, data.data() + i, data.size() - i);
+    mix(tail);
+  }
+
+  return h ^ (h >> 32);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "types.hpp"
+
+struct PackedMesh {
+  std::vector<PackedVertex> vertices;
+  VertexQuantization quantization;
+};
+
+// Packs `vertices` into PackedVertex, quantizing positions and texture
+// coordinates to 16 bits over their bounding boxes. The error is at most
+// 1/131070 of the box's size on each axis.
+inline PackedMesh packVertices(std::span<const Vertex> vertices) {
+  PackedMesh mesh;
+  if (vertices.empty()) {
+    return mesh;
+  }
+
+  glm::vec3 posMin = vertices[0].pos, posMax = vertices[0].pos;
+  glm::vec2 uvMin = vertices[0].texCoord, uvMax = vertices[0].texCoord;
+  for (const Vertex& v : vertices) {
+    posMin = glm::min(posMin, v.pos);
+    posMax = glm::max(posMax, v.pos);
+    uvMin = glm::min(uvMin, v.texCoord);
+    uvMax = glm::max(uvMax, v.texCoord);
+  }
+  // [min, max] maps onto [0, 65535], which the UNORM attributes read back
+  // as [0, 1]; the exported scale undoes the latter
+  auto& q = mesh.quantization;
+  q.posOffset = posMin;
+  q.posScale = posMax - posMin;
+  q.texCoordOffset = uvMin;
+  q.texCoordScale = uvMax - uvMin;
+
+  auto quantize = [](float value, float offset, float range) {
+    if (range <= 0) {
+      // every vertex has the same value on this axis
+      return uint16_t{0};
+    }
+    return static_cast<uint16_t>(std::clamp(
+        std::round((value - offset) / range * 65535.f), 0.f, 65535.f));
+  };
+  auto unorm8 = [](float value) {
+    return static_cast<uint8_t>(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+  };
+
+  mesh.vertices.resize(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const Vertex& v = vertices[i];
+    PackedVertex& packed = mesh.vertices[i];
+    for (int c = 0; c < 3; ++c) {
+      packed.pos[c] = quantize(v.pos[c], q.posOffset[c], q.posScale[c]);
+      packed.color[c] = unorm8(v.color[c]);
+    }
+    packed.pos[3] = 0;
+    packed.color[3] = 255;
+    for (int c = 0; c < 2; ++c) {
+      packed.texCoord[c] =
+          quantize(v.texCoord[c], q.texCoordOffset[c], q.texCoordScale[c]);
+    }
+  }
+  return mesh;
+}